@@ -2,8 +2,21 @@
 #include <fstream>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <type_traits>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -26,19 +39,119 @@ private:
 
 };
 
+// OpenGL 3.3 core context without a window, through EGL. Mesa's
+// surfaceless platform is tried first, so it also works without a display
+// or GPU (llvmpipe). There is no default framebuffer, draw to a RenderTarget.
+class HeadlessContext
+{
+public:
+    HeadlessContext();
+    ~HeadlessContext();
+    bool isOpen() const { return context != NULL; }
+private:
+    // EGLDisplay and EGLContext, kept opaque so EGL stays out of this header.
+    void* display;
+    void* context;
+
+    HeadlessContext(const HeadlessContext&);
+    HeadlessContext& operator=(const HeadlessContext&);
+};
+
+// Framebuffer object with an RGBA8 color and a 24 bit depth buffer.
+class RenderTarget
+{
+public:
+    RenderTarget(int width, int height);
+    ~RenderTarget();
+    bool isComplete() const;
+    void bind();    // Also sets the viewport to the whole target.
+
+    int width, height;
+private:
+    unsigned int framebuffer, color, depth;
+
+    RenderTarget(const RenderTarget&);
+    RenderTarget& operator=(const RenderTarget&);
+};
+
+// Asynchronous glReadPixels through a ring of pixel buffer objects. read()
+// starts copying the bound framebuffer and returns right away. The pixels
+// go to its callback from a later read() or finish(), once the copy is
+// done, so the readback overlaps rendering the next frames.
+class PixelReader
+{
+public:
+    typedef std::function<void(const unsigned char* rgba)> Callback;
+
+    PixelReader(int width, int height, size_t bufferCount = 3);
+    ~PixelReader();
+    void read(const Callback& done);
+    void finish();
+private:
+    struct Pending
+    {
+        unsigned int buffer;
+        GLsync fence;
+        Callback done;
+    };
+
+    int width, height;
+    std::vector<unsigned int> buffers, freeBuffers;
+    std::deque<Pending> pending;
+
+    void collect(bool wait);
+
+    PixelReader(const PixelReader&);
+    PixelReader& operator=(const PixelReader&);
+};
+
+// Location of an active uniform, resolved once by Shader::uniform().
+// Uniforms the program does not use keep location -1, which GL ignores.
+struct Uniform
+{
+    Uniform() : location(-1), type(0) {}
+
+    int location;
+    GLenum type;    // GL_FLOAT_MAT4, GL_SAMPLER_2D etc., 0 if not active.
+};
+
 // Shader class for loading shader from file and compiling.
+// All active uniforms are looked up once after linking. Resolve handles with
+// uniform() at setup time and use the typed setters on them every frame.
 class Shader
 {
 public:
     Shader (const char *vectFile, const char *fragFile);
+    Shader(Shader&& other);
+    Shader& operator=(Shader&& other);
+    ~Shader();
     void use();
     void setInt(const char *name, int a);
+
+    Uniform uniform(const char* name);
+    void setMat4(Uniform uniform, const glm::mat4& value);
+    void setVec3(Uniform uniform, const glm::vec3& value);
+    void setFloat(Uniform uniform, float value);
+    void setInt(Uniform uniform, int value);
+    void setSampler(Uniform uniform, int textureUnit);
+
+    // Lookups by name since the last reset, expected to stay at zero while drawing.
+    size_t lookups() const { return lookupCount; }
+    void resetLookups() { lookupCount = 0; }
+
     unsigned int shaderProgram;
 private:
     unsigned int vertexShader, fragShader;
-    readFile(const char* filename, std::vector<char>& buffer);
+    std::unordered_map<std::string, Uniform> uniforms;
+    size_t lookupCount;
+
+    Shader(const Shader&);
+    Shader& operator=(const Shader&);
+
+    bool readFile(const char* filename, std::vector<char>& buffer);
     void compile(const char* Path, GLenum type, unsigned int *handle);
     void linkShaders();
+    void findUniforms();
 };
 
 // Class for managing camera state.
@@ -47,6 +160,8 @@ class Camera
 public:
     Camera(glm::vec3 position, float yaw, float pitch, float speed, float sensitivity);
     glm::mat4 getViewMatrix();
+    glm::vec3 getPosition() const { return position; }
+    glm::vec3 getFront() const { return front; }
     void processKeys(float deltaTime, GLFWwindow* window);
     void processMouse(float xoffset, float yoffset);
 
@@ -66,6 +181,135 @@ private:
     void update_vectors();
 };
 
+// Fixed set of worker threads shared by the loaders.
+class ThreadPool
+{
+public:
+    ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+    static ThreadPool& shared();
+
+    void enqueue(std::function<void()> job);
+    void parallelFor(size_t count, const std::function<void(size_t)>& body);
+    unsigned int size() const { return workers.size(); }
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > jobs;
+    std::mutex queueMutex;
+    std::condition_variable jobAvailable;
+    bool stopping;
+
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+    void run();
+};
+
+// Collects CPU and GPU timings per named section and per frame. Keeps the
+// last sampleWindow samples of every section for percentiles, and the last
+// traceCapacity scopes for a Chrome trace (chrome://tracing, Perfetto).
+// Scopes may end on any thread. GPU timers use GL_TIME_ELAPSED queries, read
+// back a frame later so they never stall, and must not nest.
+class Profiler
+{
+public:
+    struct Summary
+    {
+        size_t count;
+        double mean, p50, p95, p99;     // Milliseconds.
+    };
+
+    static const size_t sampleWindow = 256;
+    static const size_t traceCapacity = 1 << 16;
+
+    Profiler();
+    static Profiler& shared();
+
+    size_t section(const char* name);
+    void record(size_t section, double start, double end);
+    void beginGpu(size_t section);
+    void endGpu();
+    void frame();   // Ends the current frame, and starts the next.
+
+    Summary summarize(size_t section);
+    void report();
+    bool writeTrace(const char* path);
+    static double now();    // Seconds, on the clock scopes are timed with.
+private:
+    struct Section
+    {
+        std::string name;
+        std::vector<float> samples;     // Ring of the latest durations.
+        size_t next, count;
+    };
+
+    struct Event
+    {
+        uint32_t section, thread;
+        double start, duration;
+    };
+
+    struct GpuQuery
+    {
+        size_t section;
+        unsigned int query;
+        double start;
+    };
+
+    std::mutex dataMutex;
+    std::vector<Section> sections;
+    std::vector<Event> events;          // Ring, oldest at nextEvent once full.
+    size_t nextEvent;
+    // Queries issued in the current and in the previous frame.
+    std::vector<GpuQuery> gpuFrames[2];
+    std::vector<unsigned int> freeQueries;
+    size_t gpuFrame, gpuDropped;
+    bool gpuOpen;
+    size_t frameSection;
+    double origin, frameStart;
+
+    void addEvent(const Event& event);
+    void collectGpu(std::vector<GpuQuery>& queries);
+
+    Profiler(const Profiler&);
+    Profiler& operator=(const Profiler&);
+};
+
+// Times its enclosing scope, see PROFILE_SCOPE.
+class ProfileScope
+{
+public:
+    ProfileScope(size_t section) : section(section), start(Profiler::now()) {}
+    ~ProfileScope() { Profiler::shared().record(section, start, Profiler::now()); }
+private:
+    size_t section;
+    double start;
+};
+
+class GpuProfileScope
+{
+public:
+    GpuProfileScope(size_t section) { Profiler::shared().beginGpu(section); }
+    ~GpuProfileScope() { Profiler::shared().endGpu(); }
+};
+
+// Instrumentation compiles to nothing unless ENABLE_PROFILER is defined.
+// Each use site looks its section up once, in a function local static.
+#ifdef ENABLE_PROFILER
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+    static const size_t PROFILE_CONCAT(profileSection, __LINE__) = Profiler::shared().section(name); \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profileSection, __LINE__))
+#define PROFILE_GPU_SCOPE(name) \
+    static const size_t PROFILE_CONCAT(profileGpuSection, __LINE__) = Profiler::shared().section(name); \
+    GpuProfileScope PROFILE_CONCAT(profileGpuScope, __LINE__)(PROFILE_CONCAT(profileGpuSection, __LINE__))
+#define PROFILE_FRAME() Profiler::shared().frame()
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#define PROFILE_FRAME()
+#endif
+
 struct Vertex
 {
     glm::vec3 position;
@@ -73,30 +317,927 @@ struct Vertex
     glm::vec2 texCoord;
 };
 
+// GL texture object, deleted along with it. Move-only.
 struct Texture
 {
+    Texture() : id(0), type(GL_TEXTURE_2D) {}
+    Texture(Texture&& other) : id(other.id), type(other.type) { other.id = 0; }
+    Texture& operator=(Texture&& other);
+    ~Texture();
+
     unsigned int id;
     int type;
+private:
+    Texture(const Texture&);
+    Texture& operator=(const Texture&);
+};
+
+// Decoded 8 bit RGB image, owns its pixels.
+struct Image
+{
+    Image() : width(0), height(0), data(NULL) {}
+    ~Image();
+
+    int width, height;
+    unsigned char* data;
+private:
+    Image(const Image&);
+    Image& operator=(const Image&);
+};
+
+bool loadImage(const char* path, Image& image);
+// Writes bottom-up RGBA rows, as glReadPixels returns them, to a binary PPM.
+bool writeImage(const char* path, const unsigned char* rgba, int width, int height);
+
+// Texture sampling state, textures with different state are separate GL objects.
+struct SamplerParams
+{
+    SamplerParams() : type(GL_TEXTURE_2D), wrap(GL_REPEAT), minFilter(GL_LINEAR), magFilter(GL_LINEAR) {}
+
+    int type;
+    int wrap;
+    int minFilter;
+    int magFilter;
+};
+
+Texture uploadTexture(const Image& image, const SamplerParams& params);
+std::shared_ptr<Texture> createTexture(const Image& image, const SamplerParams& params);
+std::shared_ptr<Texture> createTexture(const char* path, const SamplerParams& params);
+bool isCompressedTexture(const std::string& path);
+std::string compressedTexturePath(const std::string& path);
+bool loadTexture(const char* path, const SamplerParams& params, Texture& texture);
+
+// BC1 compression and the KTX2 container written by tools/texconvert.
+void encodeBC1(const unsigned char* rgb, int width, int height, std::vector<unsigned char>& blocks);
+void decodeBC1(const unsigned char* blocks, int width, int height, std::vector<unsigned char>& rgb);
+void halveImage(const unsigned char* rgb, int width, int height, std::vector<unsigned char>& out);
+double psnr(const unsigned char* a, const unsigned char* b, size_t bytes);
+bool writeKtx2(const char* path, int width, int height, const std::vector<std::vector<unsigned char> >& levels);
+bool loadKtx2Texture(const char* path, const SamplerParams& params, Texture& texture);
+
+// Shares GL textures between meshes. Textures are keyed by path and sampling
+// state, loaded and uploaded on the first acquire and deleted when the last
+// shared_ptr handed out goes away. acquire() must run on the GL thread,
+// contains() may be called from any thread.
+class TextureCache
+{
+public:
+    TextureCache();
+
+    std::shared_ptr<Texture> acquire(const std::string& path, const SamplerParams& params = SamplerParams(), const Image* decoded = NULL);
+    bool contains(const std::string& path, const SamplerParams& params = SamplerParams());
+
+    size_t hits() const { return hitCount; }
+    size_t misses() const { return missCount; }
+    size_t size();
+    void printStats();
+private:
+    // Shared with the deleters so textures may outlive the cache.
+    struct Entries
+    {
+        std::mutex mutex;
+        std::map<std::string, std::weak_ptr<Texture> > textures;
+    };
+
+    std::shared_ptr<Entries> entries;
+    size_t hitCount, missCount;
+
+    TextureCache(const TextureCache&);
+    TextureCache& operator=(const TextureCache&);
+};
+
+// Read-only view of a whole file mapped into memory.
+class MappedFile
+{
+public:
+    MappedFile(const char* path);
+    ~MappedFile();
+    bool isOpen() const { return data != NULL; }
+
+    const char* data;
+    size_t size;
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+#ifdef _WIN32
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+};
+
+// Monotonic allocator for the temporaries of one load. Allocations bump a
+// pointer through blocks taken from the heap and are never freed one by one,
+// reset() drops all of them at once. A thread that opts in by raising
+// keepBytes keeps one block as large as the last load needed, so loads after
+// it on the same thread (forThisThread()) allocate nothing. ThreadPool
+// workers opt in and release() theirs whenever the queue runs dry. Freeing
+// the last allocation gives its bytes back for the next one.
+class Arena
+{
+public:
+    Arena(size_t blockSize = 1 << 20);
+    ~Arena();
+    static Arena& forThisThread();
+
+    void* allocate(size_t bytes, size_t alignment);
+    void deallocate(void* memory, size_t bytes);
+    void reserve(size_t bytes);
+    void reset();
+    void release();
+    size_t used() const { return usedBytes; }          // Handed out and not given back since the last reset().
+    size_t capacity() const { return capacityBytes; }  // Held in blocks.
+
+    size_t blockAllocations;    // Blocks taken from the heap so far.
+    size_t keepBytes;           // Most reset() holds on to, 0 gives everything back.
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+    std::vector<Block> blocks;
+    size_t blockSize, offset, usedBytes, capacityBytes;
+    size_t peakBytes;       // Most used() or reserve() asked to fit since the last reset().
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+};
+
+// Standard allocator over an Arena, or the heap without one. Moved and
+// swapped containers take their arena along. Copy constructed ones go on the
+// heap, as they may outlive the load, and copy assignment keeps the target's.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator(Arena* arena = NULL) : arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+    ArenaAllocator select_on_container_copy_construction() const { return ArenaAllocator(); }
+
+    T* allocate(size_t count)
+    {
+        if (arena)
+            return (T*) arena->allocate(count * sizeof(T), alignof(T));
+        return (T*) ::operator new(count * sizeof(T));
+    }
+    void deallocate(T* memory, size_t count)
+    {
+        if (arena)
+            arena->deallocate(memory, count * sizeof(T));
+        else
+            ::operator delete(memory);
+    }
+
+    Arena* arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena == b.arena; }
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena != b.arena; }
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+// Corners from firstCorner on use materialNames[material], up to the next run.
+struct ObjMaterialRun
+{
+    size_t firstCorner;
+    unsigned int material;
+};
+
+// Attributes and 0-based triangle corner indices read from an .obj file,
+// before reshaping. Polygons come triangulated, and corners without vt or vn
+// point at a zero uv or a generated normal.
+struct ObjData
+{
+    // The arrays are allocated from arena, or the heap without one.
+    ObjData(Arena* arena = NULL) : temp_vertices(arena), temp_uvs(arena), temp_normals(arena),
+                                   vertexIndices(arena), uvIndices(arena), normalIndices(arena) {}
+
+    ArenaVector<glm::vec3> temp_vertices; // v
+    ArenaVector<glm::vec2> temp_uvs;      // vt
+    ArenaVector<glm::vec3> temp_normals;  // vn
+    ArenaVector<unsigned int> vertexIndices, uvIndices, normalIndices;
+    std::vector<std::string> materialLibraries;   // mtllib, relative to the .obj
+    std::vector<std::string> materialNames;       // usemtl, in order of first use
+    std::vector<ObjMaterialRun> materialRuns;     // One per usemtl, corners before the first have none.
+};
+
+// Surface of a submesh, the parts of a .mtl material the shaders use.
+struct Material
+{
+    Material() : diffuse(1.0f) {}
+
+    std::string name;
+    glm::vec3 diffuse;          // Kd, multiplies the texture.
+    std::string diffuseMap;     // map_Kd, empty for none. Relative to the working directory.
+};
+
+// Which parser Mesh uses to read the .obj file.
+enum LoadMode
+{
+    LOAD_FSCANF,    // Line by line fscanf, the original reader.
+    LOAD_MAPPED,    // Memory mapped file walked by a hand rolled tokenizer.
+    LOAD_PARALLEL   // Memory mapped file split into chunks parsed on ThreadPool::shared().
+};
+
+void loadObj(const char* path, LoadMode mode, ObjData& data);
+bool parseObj(const char* begin, const char* end, ObjData& data);
+bool parseObjParallel(const char* begin, const char* end, ObjData& data, ThreadPool& pool);
+bool parseObjFile(FILE* file, ObjData& data);
+bool loadMaterialLibrary(const char* path, std::vector<Material>& materials);
+std::string resolvePath(const std::string& base, const std::string& relative);
+
+// Every value of one .obj attribute read so far by ObjStreamReader, in a
+// temporary file. The last recentCount stay in memory as well, faces mostly
+// use vertices written shortly before them, so the file is rarely read.
+class AttributeSpill
+{
+public:
+    AttributeSpill(size_t elementSize, size_t recentCount);
+    ~AttributeSpill();
+    bool isOpen() const { return file != NULL; }
+
+    bool append(const void* values, size_t count);
+    bool read(uint64_t index, void* value);
+    uint64_t size() const { return count; }
+
+    uint64_t misses;            // Reads that had to go to the file.
+private:
+    FILE* file;
+    size_t elementSize, recentCount;
+    std::vector<char> recent;   // Ring of the last recentCount values.
+    uint64_t count;
+    bool atEnd;                 // The file position is where the next value goes.
+
+    AttributeSpill(const AttributeSpill&);
+    AttributeSpill& operator=(const AttributeSpill&);
+};
+
+// Reads an .obj file a window at a time, for models larger than memory.
+// Each window comes out as an ObjData of just its faces, with the attributes
+// they use copied in and the indices pointing at those. Earlier attributes
+// stay reachable through AttributeSpill. About a quarter of memoryBudget goes
+// to those, the window text is a 64th of it, leaving the rest for what a
+// window turns into. Normals of a smoothing group are averaged per window.
+class ObjStreamReader
+{
+public:
+    ObjStreamReader(const char* path, size_t memoryBudget);
+    ~ObjStreamReader();
+    bool isOpen() const { return file != NULL && positions.isOpen() && uvs.isOpen() && normals.isOpen(); }
+
+    // False at the end of the file and on errors, failed() tells which.
+    bool next(ObjData& window);
+    bool failed() const { return error; }
+    uint64_t bytesRead() const { return offset; }
+    uint64_t attributeMisses() const { return positions.misses + uvs.misses + normals.misses; }
+
+    // All of the file so far. Window material runs index materialNames.
+    std::vector<std::string> materialLibraries, materialNames;
+private:
+    FILE* file;
+    std::vector<char> buffer;
+    size_t buffered;            // Bytes in buffer, a line the last window cut off.
+    uint64_t offset;
+    AttributeSpill positions, uvs, normals;
+    bool smoothing;             // Inside a smoothing group where the last window ended.
+    unsigned int material;      // In use where the last window ended, ~0u before any usemtl.
+    bool error;
+
+    ObjStreamReader(const ObjStreamReader&);
+    ObjStreamReader& operator=(const ObjStreamReader&);
+
+    bool parseWindow(const char* begin, const char* end, ObjData& window);
+};
+
+// Layout of the vertex buffer Mesh uploads.
+enum VertexFormat
+{
+    VERTEX_FLOAT,               // Vertex as is, 32 bytes.
+    VERTEX_PACKED_OCTAHEDRAL,   // PackedVertex with octahedral snorm16 normals, 16 bytes.
+    VERTEX_PACKED_1010102       // PackedVertex with 10_10_10_2 normals, 16 bytes.
+};
+
+// How computeNormals() weights a face's normal at each of its corners.
+enum NormalWeighting
+{
+    NORMALS_AREA,   // By the face's area, as the .obj loader does for missing vn.
+    NORMALS_ANGLE   // By the corner's angle, so splitting a face changes nothing.
+};
+
+// How Mesh loads and prepares a model.
+struct MeshOptions
+{
+    MeshOptions(LoadMode mode = LOAD_MAPPED) : mode(mode), useCache(true), optimize(false), vertexFormat(VERTEX_FLOAT), keepCpuData(true), buildTriangleBVH(false),
+                                                  lodLevels(0), lodReduction(0.5f), useArena(true), smoothNormals(false),
+                                                  normalWeighting(NORMALS_ANGLE), generateTangents(false) {}
+
+    LoadMode mode;
+    bool useCache;      // Load from, and write, the binary cache next to the .obj.
+    bool optimize;      // Reorder triangles and vertices for the GPU caches after loading.
+    VertexFormat vertexFormat;
+    bool keepCpuData;   // Keep vertices and indices in memory after setupBuffers uploads them.
+    bool buildTriangleBVH;  // Build Mesh::triangles for raycast().
+    int lodLevels;          // Simplified levels generated after the full mesh.
+    float lodReduction;     // Triangles kept from one level to the next.
+    bool useArena;          // Parse into the thread's Arena, see Arena::keepBytes.
+    bool smoothNormals;     // Replace every normal with computeNormals() ones, for files without usable vn.
+    NormalWeighting normalWeighting;
+    bool generateTangents;  // Fill Mesh::tangents for normal mapping.
+};
+
+// Post transform vertex cache efficiency of an index buffer.
+struct VertexCacheStats
+{
+    float acmr;     // Average cache misses per triangle.
+    float atvr;     // Average transforms per vertex.
+};
+
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount);
+void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount);
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices);
+
+// Quadric error simplification over the same vertices, one index list per
+// target count from largest to smallest. errors[i] is how far the surface of
+// levels[i] moved, in model units. Fewer levels come back when the mesh
+// cannot be simplified that far. With triangleMaterials, vertices where two
+// materials meet stay put and levelMaterials gets the material of every
+// triangle kept, in the same order.
+void simplifyMesh(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                  const std::vector<size_t>& targetIndexCounts, std::vector<std::vector<unsigned int> >& levels,
+                  std::vector<float>& errors, const uint32_t* triangleMaterials = NULL,
+                  std::vector<std::vector<uint32_t> >* levelMaterials = NULL);
+
+// Smooth normals and MikkTSpace tangents over an indexed mesh, in batches of
+// triangles as wide as the build allows (AVX2, SSE2 or one at a time, see
+// tangentInstructionSet()). With a pool, ranges of triangles sum into their
+// own span of vertices and the spans are added up per vertex afterwards.
+// computeTangents() reads the vertex normals, and tangents[i].w is the
+// handedness: bitangent = w * cross(normal, tangent).
+void computeNormals(Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                    NormalWeighting weighting, ThreadPool* pool = NULL);
+void computeTangents(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                     glm::vec4* tangents, ThreadPool* pool = NULL);
+const char* tangentInstructionSet();
+
+// Serial one triangle at a time versions of the two, to check them against.
+void computeNormalsScalar(Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                          NormalWeighting weighting);
+void computeTangentsScalar(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                           glm::vec4* tangents);
+
+// Axis aligned bounding box in model space.
+struct AABB
+{
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere
+{
+    glm::vec3 center;
+    float radius;
+};
+
+// Six planes (a, b, c, d) with normals pointing inside: left, right, bottom,
+// top, near, far. A point p is inside a plane when dot(abc, p) + d >= 0.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+Frustum extractFrustum(const glm::mat4& viewProjection);
+bool sphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere);
+
+// Bounding spheres stored as separate arrays, so four can be tested at once.
+struct SphereList
+{
+    std::vector<float> x, y, z, radius;
+
+    size_t size() const { return x.size(); }
+    void clear();
+    void push_back(const BoundingSphere& sphere);
+};
+
+// Sets visible[i] to 1 for spheres intersecting the frustum, 0 otherwise.
+// Returns the number visible. cullSpheresScalar is the reference version.
+size_t cullSpheres(const Frustum& frustum, const SphereList& spheres, std::vector<unsigned char>& visible);
+size_t cullSpheresScalar(const Frustum& frustum, const SphereList& spheres, std::vector<unsigned char>& visible);
+
+bool aabbInFrustum(const Frustum& frustum, const AABB& box);
+
+struct Ray
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+};
+
+// Distance along the ray where it enters box, if it hits within maxDistance.
+bool intersectRayAABB(const Ray& ray, const glm::vec3& inverseDirection, const AABB& box, float maxDistance, float& distance);
+
+// Node of a binary BVH. Inner nodes have count 0 and children at first and
+// first + 1, leaves hold objects[first] to objects[first + count - 1].
+struct BVHNode
+{
+    AABB bounds;
+    uint32_t first;
+    uint32_t count;
+};
+
+// Binned SAH build over object bounds, used by SceneBVH and TriangleBVH.
+// Nodes of up to leafSize objects are never split, nodes of more than
+// maxLeafSize always are.
+void buildBVH(const std::vector<AABB>& bounds, uint32_t leafSize, uint32_t maxLeafSize,
+              std::vector<BVHNode>& nodes, std::vector<uint32_t>& objects);
+
+// Bounding volume hierarchy over the world AABBs of scene objects, used for
+// frustum culling and picking. Objects are referred to by their index in
+// the array given to build(). After objects move, refit() updates the boxes
+// in place; build() again when they have moved far or were added.
+class SceneBVH
+{
+public:
+    // Exact test of an object against a ray whose AABB it hit. Returns true
+    // and sets distance if the object is hit closer than distance.
+    typedef std::function<bool(uint32_t object, const Ray& ray, float& distance)> ObjectIntersector;
+
+    void build(const std::vector<AABB>& bounds);
+    void refit(const std::vector<AABB>& bounds);
+
+    size_t cull(const Frustum& frustum, std::vector<uint32_t>& visible) const;
+    bool raycast(const Ray& ray, float maxDistance, uint32_t& object, float& distance,
+                 const ObjectIntersector& intersect = ObjectIntersector()) const;
+
+    size_t nodeCount() const { return nodes.size(); }
+    bool empty() const { return nodes.empty(); }
+private:
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> objects;
+    std::vector<AABB> objectBounds;
+
+    void collect(uint32_t node, std::vector<uint32_t>& visible) const;
+};
+
+// Where a ray hit a triangle. The hit point is
+// (1 - u - v) * p0 + u * p1 + v * p2 of the triangle's corners.
+struct TriangleHit
+{
+    float distance;
+    uint32_t triangle;  // Index into the index buffer divided by three.
+    float u, v;
+};
+
+// BVH over the triangles of a mesh for ray queries against the geometry
+// itself. Leaves hold up to four triangles, stored so all four are tested
+// at once. Keeps its own copy of what it needs, so it outlives the mesh's
+// CPU data.
+class TriangleBVH
+{
+public:
+    void build(const Vertex* vertices, const unsigned int* indices, size_t indexCount);
+
+    bool intersect(const Ray& ray, float maxDistance, TriangleHit& hit) const;
+    // Many rays spread over the pool's threads. hits[i] is only set where hit[i] is 1.
+    size_t intersect(const std::vector<Ray>& rays, float maxDistance, std::vector<TriangleHit>& hits,
+                     std::vector<unsigned char>& hit, ThreadPool& pool = ThreadPool::shared()) const;
+    // Tests every triangle, for checking the tree.
+    bool intersectBruteForce(const Ray& ray, float maxDistance, TriangleHit& hit) const;
+
+    glm::vec2 texCoord(const TriangleHit& hit) const;
+    size_t triangleCount() const { return texCoords.size() / 3; }
+    size_t nodeCount() const { return nodes.size(); }
+    bool empty() const { return nodes.empty(); }
+private:
+    // Four triangles as corner and two edges, component by component.
+    // Unused lanes have zero edges and never hit.
+    struct TrianglePack
+    {
+        float corner[3][4];
+        float edge1[3][4];
+        float edge2[3][4];
+        uint32_t triangle[4];
+    };
+
+    // Leaves point at one pack each through first.
+    std::vector<BVHNode> nodes;
+    std::vector<TrianglePack> packs;
+    std::vector<glm::vec2> texCoords;   // Three per triangle, in index buffer order.
+
+    void intersectPack(const TrianglePack& pack, const Ray& ray, TriangleHit& hit, bool& found) const;
+};
+
+// Quantized vertex. Positions are snorm16 relative to the mesh AABB, texture
+// coordinates are half floats and the normal is either two octahedral snorm16
+// values (x in the low half) or a signed 10_10_10_2 vector.
+struct PackedVertex
+{
+    int16_t position[4];
+    uint32_t normal;
+    uint16_t texCoord[2];
+};
+
+glm::vec2 encodeOctahedral(glm::vec3 n);
+glm::vec3 decodeOctahedral(glm::vec2 e);
+void positionTransform(const AABB& bounds, glm::vec3& offset, glm::vec3& scale);
+void packVertices(const Vertex* vertices, size_t count, const AABB& bounds, VertexFormat format, std::vector<PackedVertex>& out);
+Vertex unpackVertex(const PackedVertex& packed, const AABB& bounds, VertexFormat format);
+
+struct DrawItem;
+class RenderQueue;
+
+// Triangles of one material in one level of detail, drawn with one call.
+struct MeshRange
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    uint32_t material;      // Index into Mesh::materials.
+};
+
+// One level of detail, a range of the mesh's index buffer sorted by
+// material. Level 0 is the full mesh with no error.
+struct MeshLod
+{
+    uint32_t indexOffset;
+    uint32_t indexCount;
+    float error;            // Largest distance the surface moved, in model units.
+    uint32_t firstRange;    // Its ranges, one per material it uses.
+    uint32_t rangeCount;
+};
+
+// How submit() picks a level of detail: the coarsest whose error covers at
+// most maxPixelError pixels on screen.
+struct LodSettings
+{
+    LodSettings() : screenScale(0.0f), maxPixelError(1.0f) {}
+
+    float screenScale;      // Viewport height / (2 tan(fovy / 2)), zero always draws level 0.
+    float maxPixelError;
 };
 
 class Mesh
 {
 public:
-    Mesh(const char * path);
+    Mesh(const char * path, const MeshOptions& options = MeshOptions());
+    Mesh(Mesh&& other) noexcept;
+    Mesh& operator=(Mesh&& other) noexcept;
+    ~Mesh();
     //Mesh(std::vector<Vertex> vertices);
 
+    // Empty when the mesh was loaded from a cache, use vertexData()/indexData() instead.
+    // Without keepCpuData all of the CPU copy is released once setupBuffers uploads it.
+    // indices holds every level of detail one after the other, see lod().
     std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    // One per vertex with MeshOptions::generateTangents, read at attribute 7.
+    // Computed again after a cache load, the cache only holds vertices.
+    std::vector<glm::vec4> tangents;
+    // From the .mtl files the .obj names. Faces before its first usemtl, or
+    // of models without any, get a default material with no name.
+    std::vector<Material> materials;
+    AABB bounds;
+    BoundingSphere sphere;  // Around the AABB centre, in model space.
+    TriangleBVH triangles;  // Empty unless MeshOptions::buildTriangleBVH was set.
 
+    const Vertex* vertexData() const;
+    size_t vertexCount() const;
+    const unsigned int* indexData() const;
+    size_t indexCount() const;
+    size_t lodCount() const { return lods.size(); }
+    const MeshLod& lod(size_t level) const { return lods[level]; }
+    const MeshRange& range(size_t index) const { return ranges[index]; }
+    size_t selectLod(const glm::mat4& view, const LodSettings& settings) const;
+    bool writeCache(const char* objPath) const;
 
-    void draw(Shader shaderProgram);
+    void draw(Shader& shaderProgram);
+    void submit(RenderQueue& queue, const glm::mat4& view, const LodSettings& settings = LodSettings()) const;
+    BoundingSphere worldSphere() const;
+    AABB worldBounds() const;
+    bool raycast(const Ray& ray, float maxDistance, TriangleHit& hit) const;
     void translate(glm::vec3 direction);
     void rotate(float angle, glm::vec3 axis);
     void scale(glm::vec3 factor);
 
-    void setupBuffers(Shader shaderProgram, const char* texturePath, int textureType);
+    void setupBuffers(Shader& shaderProgram, const char* texturePath, int textureType);
+    void setupBuffers(Shader& shaderProgram, const Image& image, int textureType);
+    void setupBuffers(Shader& shaderProgram, std::shared_ptr<Texture> texture);
+    void loadMaterialTextures(TextureCache& textures);
+    void printStats(const char* name) const;
 private:
-    Texture texture;
+    // Drawn for materials without a diffuse map of their own.
+    std::shared_ptr<Texture> texture;
+    std::vector<std::shared_ptr<Texture> > materialTextures;
     glm::mat4 model;
+    unsigned int program, vao, vbo, ebo, tangentVbo;
+    GLenum indexType;
+    bool optimized;
+    VertexFormat vertexFormat;
+    bool keepCpuData;
+    std::vector<MeshLod> lods;
+    std::vector<MeshRange> ranges;
+    std::vector<std::string> materialLibraries;    // As the .obj names them, for the cache.
+    int lodLevels;      // Options the levels were generated with, for the cache.
+    float lodReduction;
+    bool smoothNormals; // Options the normals were computed with, for the cache.
+    NormalWeighting normalWeighting;
+
+    // Handles into the shader given to setupBuffers, draw() must use the same one.
+    Uniform modelUniform, positionOffsetUniform, positionScaleUniform, octahedralNormalsUniform, diffuseColorUniform;
+
+    // Mapped binary cache the vertex and index data points into, if any.
+    std::shared_ptr<MappedFile> cacheFile;
+    const Vertex* cachedVertices;
+    const unsigned int* cachedIndices;
+    size_t cachedVertexCount, cachedIndexCount;
+
+    // Draws this mesh's buffers many times over.
+    friend class InstancedMesh;
+
+    Mesh(const Mesh&);
+    Mesh& operator=(const Mesh&);
+
+    void load(const char* path, const MeshOptions& options);
+    bool loadCache(const char* objPath, const MeshOptions& options);
+    void loadMaterials(const char* objPath, const std::vector<std::string>& names);
+    void sortByMaterial(const ObjData& data, std::vector<uint32_t>& triangleMaterials);
+    void generateLods(const MeshOptions& options, const std::vector<uint32_t>& triangleMaterials);
+    void releaseBuffers();
+    void bind(Shader& shaderProgram);
+    void drawRanges(Shader& shaderProgram, size_t instanceCount);
+    const Texture& materialTexture(uint32_t material) const;
+    DrawItem drawItem(const MeshRange& range) const;
+};
+
+// Many copies of one mesh drawn with a single instanced draw call. Instance
+// transforms live in a vertex buffer read at attributes 3 to 6 with a divisor
+// of one, see shaders/vert_instanced.glsl. Changed instances are uploaded as
+// one range on the next draw.
+class InstancedMesh
+{
+public:
+    InstancedMesh(Mesh&& mesh);
+    InstancedMesh(InstancedMesh&& other) noexcept;
+    InstancedMesh& operator=(InstancedMesh&& other) noexcept;
+    ~InstancedMesh();
+
+    void setupBuffers(Shader& shaderProgram, std::shared_ptr<Texture> texture);
+    void draw(Shader& shaderProgram);
+    void submit(RenderQueue& queue);
+
+    size_t add(const glm::mat4& transform);
+    void set(size_t instance, const glm::mat4& transform);
+    const glm::mat4& get(size_t instance) const { return transforms[instance]; }
+    size_t size() const { return transforms.size(); }
+private:
+    Mesh mesh;
+    std::vector<glm::mat4> transforms;
+    unsigned int instanceVbo;
+    size_t capacity;                // Instances the GPU buffer has room for.
+    size_t dirtyBegin, dirtyEnd;    // Instances changed since the last upload.
+
+    InstancedMesh(const InstancedMesh&);
+    InstancedMesh& operator=(const InstancedMesh&);
+
+    void markDirty(size_t begin, size_t end);
+    void uploadInstances();
+};
+
+// Vertices made from the distinct (v, vt, vn) triples of ObjData's corners.
+struct CornerKey
+{
+    unsigned int v, vt, vn;
+};
+
+void indexCorners(const ObjData& data, std::vector<unsigned int>& indices, ArenaVector<CornerKey>& keys);
+size_t cornerArenaBytes(size_t corners);
+
+// Piece of a streamed mesh, with vertices of its own. Vertices are not
+// shared between chunks.
+struct MeshChunk
+{
+    const Vertex* vertices;
+    size_t vertexCount;
+    const unsigned int* indices;    // Into this chunk's vertices.
+    size_t indexCount;
+    const MeshRange* ranges;        // Runs of one material over indices, in file order.
+    size_t rangeCount;
+    uint64_t firstVertex, firstIndex;   // Written by the chunks before this one.
+};
+
+// Takes a streamed mesh a chunk at a time, in file order. Materials in the
+// ranges index the names given to finish(), ~0u is none.
+class MeshSink
+{
+public:
+    virtual ~MeshSink() {}
+    virtual bool write(const MeshChunk& chunk) = 0;
+    virtual bool finish(const std::vector<std::string>& materialNames) { (void) materialNames; return true; }
+};
+
+// What streamMesh() read and wrote.
+struct MeshStreamStats
+{
+    MeshStreamStats() : bytes(0), vertices(0), indices(0), chunks(0), attributeMisses(0) {}
+
+    uint64_t bytes, vertices, indices, chunks, attributeMisses;
+    std::vector<std::string> materialLibraries, materialNames;
+};
+
+bool streamMesh(const char* path, MeshSink& sink, size_t memoryBudget, MeshStreamStats& stats);
+bool readMeshStreamTotals(const char* path, uint64_t& vertexCount, uint64_t& indexCount);
+bool replayMeshStream(const char* path, MeshSink& sink);
+
+// Appends chunks to a binary file that replayMeshStream() reads back.
+class FileMeshSink : public MeshSink
+{
+public:
+    FileMeshSink(const char* path);
+    ~FileMeshSink();
+    bool isOpen() const { return file != NULL; }
+
+    virtual bool write(const MeshChunk& chunk);
+    virtual bool finish(const std::vector<std::string>& materialNames);
+private:
+    FILE* file;
+    uint64_t vertexCount, indexCount, chunkCount;
+
+    FileMeshSink(const FileMeshSink&);
+    FileMeshSink& operator=(const FileMeshSink&);
+};
+
+// Sub-uploads chunks into one vertex and one index buffer, made up front
+// with room for the whole mesh. Indices are rebased onto the shared buffer,
+// ranges keep their material with offsets into it.
+class GLBufferMeshSink : public MeshSink
+{
+public:
+    GLBufferMeshSink(uint64_t vertexCapacity, uint64_t indexCapacity);
+    ~GLBufferMeshSink();
+
+    virtual bool write(const MeshChunk& chunk);
+    unsigned int vertexArray() const { return vao; }
+    uint64_t indexCount() const { return indicesWritten; }
+
+    std::vector<MeshRange> ranges;
+private:
     unsigned int vao, vbo, ebo;
-    void setupTexture(Shader shaderProgram, const char* texturePath, int textureType);
+    uint64_t vertexCapacity, indexCapacity, verticesWritten, indicesWritten;
+    std::vector<unsigned int> rebased;
+
+    GLBufferMeshSink(const GLBufferMeshSink&);
+    GLBufferMeshSink& operator=(const GLBufferMeshSink&);
+};
+
+// Everything needed to issue one draw, captured when it is submitted.
+struct DrawItem
+{
+    DrawItem() : program(0), texture(0), textureType(GL_TEXTURE_2D), vertexArray(0), indexType(GL_UNSIGNED_INT),
+                 indexCount(0), indexOffset(0), instanceCount(0), model(1.0f), positionOffset(0.0f), positionScale(1.0f), octahedralNormals(0),
+                 diffuseColor(1.0f) {}
+
+    unsigned int program;
+    unsigned int texture;
+    int textureType;
+    unsigned int vertexArray;
+    GLenum indexType;
+    unsigned int indexCount;
+    unsigned int indexOffset;       // First index drawn.
+    unsigned int instanceCount;     // 0 for a plain, not instanced draw.
+
+    // Per draw uniforms, the handles belong to program.
+    Uniform modelUniform, positionOffsetUniform, positionScaleUniform, octahedralNormalsUniform;
+    glm::mat4 model;
+    glm::vec3 positionOffset, positionScale;
+    int octahedralNormals;
+    Uniform diffuseColorUniform;
+    glm::vec3 diffuseColor;
+};
+
+// The GL calls the render queue makes. GLRenderBackend makes them for real,
+// RecordingRenderBackend only records them, so the queue can be checked
+// without a GL context.
+class RenderBackend
+{
+public:
+    virtual ~RenderBackend() {}
+    virtual void useProgram(unsigned int program) = 0;
+    virtual void bindTexture(int type, unsigned int texture) = 0;
+    virtual void bindVertexArray(unsigned int vertexArray) = 0;
+    virtual void setMat4(int location, const glm::mat4& value) = 0;
+    virtual void setVec3(int location, const glm::vec3& value) = 0;
+    virtual void setInt(int location, int value) = 0;
+    virtual void drawElements(GLenum indexType, unsigned int indexCount, unsigned int indexOffset, unsigned int instanceCount) = 0;
+};
+
+class GLRenderBackend : public RenderBackend
+{
+public:
+    virtual void useProgram(unsigned int program);
+    virtual void bindTexture(int type, unsigned int texture);
+    virtual void bindVertexArray(unsigned int vertexArray);
+    virtual void setMat4(int location, const glm::mat4& value);
+    virtual void setVec3(int location, const glm::vec3& value);
+    virtual void setInt(int location, int value);
+    virtual void drawElements(GLenum indexType, unsigned int indexCount, unsigned int indexOffset, unsigned int instanceCount);
+};
+
+class RecordingRenderBackend : public RenderBackend
+{
+public:
+    enum CallType { USE_PROGRAM, BIND_TEXTURE, BIND_VERTEX_ARRAY, SET_UNIFORM, DRAW };
+    struct Call
+    {
+        CallType type;
+        unsigned int object;    // Program, texture or vertex array bound, uniform location, index count.
+    };
+
+    std::vector<Call> calls;
+
+    size_t count(CallType type) const;
+    virtual void useProgram(unsigned int program);
+    virtual void bindTexture(int type, unsigned int texture);
+    virtual void bindVertexArray(unsigned int vertexArray);
+    virtual void setMat4(int location, const glm::mat4& value);
+    virtual void setVec3(int location, const glm::vec3& value);
+    virtual void setInt(int location, int value);
+    virtual void drawElements(GLenum indexType, unsigned int indexCount, unsigned int indexOffset, unsigned int instanceCount);
+};
+
+// State changes made by one RenderQueue::flush().
+struct RenderStats
+{
+    size_t draws;
+    size_t programChanges;
+    size_t textureChanges;
+    size_t vertexArrayChanges;
+    size_t redundantBinds;      // Binds skipped because the object was already bound.
+};
+
+// Draws submitted during a frame, sorted by a 64 bit key so draws sharing a
+// program, texture and vertex array run back to back, nearest first.
+// Key layout, high to low: program (8 bits), texture (12), vertex array (12),
+// view depth (32, float bits). Objects with colliding low bits only sort
+// worse, flush() still compares full names before skipping a bind.
+class RenderQueue
+{
+public:
+    RenderQueue();
+
+    void submit(const DrawItem& item, float depth);
+    void flush(RenderBackend& backend);
+
+    size_t size() const { return items.size(); }
+    const RenderStats& stats() const { return lastStats; }
+
+    static uint64_t sortKey(const DrawItem& item, float depth);
+private:
+    std::vector<DrawItem> items;
+    std::vector<uint64_t> keys, keyScratch;
+    std::vector<uint32_t> order, orderScratch;
+    RenderStats lastStats;
+};
+
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values,
+               std::vector<uint64_t>& keyScratch, std::vector<uint32_t>& valueScratch);
+
+// Parses meshes and decodes textures on worker threads. Finished assets wait
+// in a queue until upload() hands them to their callbacks on the calling
+// (GL) thread, so the main loop decides how much upload work a frame takes.
+class AssetLoader
+{
+public:
+    typedef std::function<void(Mesh& mesh, const Image* texture)> MeshReady;
+
+    AssetLoader(TextureCache* textures = NULL, ThreadPool& pool = ThreadPool::shared());
+    ~AssetLoader();
+
+    void loadMesh(const char* objPath, const char* texturePath, const MeshOptions& options, MeshReady onReady);
+    int upload(double budgetSeconds);
+    size_t pending();
+private:
+    struct Result
+    {
+        std::shared_ptr<Mesh> mesh;
+        std::shared_ptr<Image> texture;
+        std::string texturePath;
+        MeshReady onReady;
+    };
+
+    TextureCache* textures;
+    ThreadPool& pool;
+    std::mutex resultMutex;
+    // Images being decoded, so meshes sharing a texture wait for one decode.
+    std::map<std::string, std::shared_future<std::shared_ptr<Image> > > decoding;
+    std::condition_variable idle;
+    std::deque<Result> results;
+    size_t loading;
+
+    AssetLoader(const AssetLoader&);
+    AssetLoader& operator=(const AssetLoader&);
 };
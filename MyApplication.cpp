@@ -7,7 +7,9 @@ using namespace std;
 MyApplication::MyApplication(int width, int height) :
     Application(width, height),
     shaderProgram ("./shaders/vert.glsl", "./shaders/frag.glsl"),
-    camera(glm::vec3(0.0f, 0.0f, 3.0f), -90.0f, 0.0f, 5.0f, 0.1f)
+    instancedShader ("./shaders/vert_instanced.glsl", "./shaders/frag.glsl"),
+    camera(glm::vec3(0.0f, 0.0f, 3.0f), -90.0f, 0.0f, 5.0f, 0.1f),
+    assets(&textures)
 {
     // This needs to be done here so we have access to the mouse data.
     // Possible refactor in the future.
@@ -17,24 +19,104 @@ MyApplication::MyApplication(int width, int height) :
     lastX = (float) width / 2.0f;
     lastY = (float) height / 2.0f;
 
-    meshes.push_back(Mesh("assets/models/Intergalactic_Spaceship.obj"));
-    meshes[0].setupBuffers(shaderProgram, "assets/textures/Intergalactic Spaceship_color_4.jpg", GL_TEXTURE_2D);
-    meshes[0].translate(glm::vec3(2.0f, 0.0f, 0.0f));
-    meshes[0].scale(glm::vec3(0.5f, 0.5f, 0.5f));
+    // Models load in the background and pop in once loop() uploads them.
+    MeshOptions options;
+    options.optimize = true;
+    // Geometry only lives on the GPU once uploaded, picking keeps its own copy.
+    options.keepCpuData = false;
+    options.buildTriangleBVH = true;
+    // Distant meshes draw simplified, see lodSettings.
+    options.lodLevels = 4;
 
-    meshes.push_back(Mesh("assets/models/teapot.obj"));
-    meshes[1].setupBuffers(shaderProgram, "assets/textures/tiles.jpg", GL_TEXTURE_2D);
-    meshes[1].translate(glm::vec3(-2.0f, 0.0f, 0.0f));
-    meshes[1].scale(glm::vec3(0.1f, 0.1f, 0.1f));
+    // Textures converted by tools/texconvert are used when they are present.
+    string spaceshipTexture = compressedTexturePath("assets/textures/Intergalactic Spaceship_color_4.jpg");
+    string teapotTexture = compressedTexturePath("assets/textures/tiles.jpg");
+
+    assets.loadMesh("assets/models/Intergalactic_Spaceship.obj", spaceshipTexture.c_str(), options,
+        [this, spaceshipTexture](Mesh& mesh, const Image* texture)
+        {
+            addMesh(mesh, spaceshipTexture.c_str(), texture,
+                    "Intergalactic_Spaceship.obj", glm::vec3(2.0f, 0.0f, 0.0f), glm::vec3(0.5f, 0.5f, 0.5f));
+        });
+
+    assets.loadMesh("assets/models/teapot.obj", teapotTexture.c_str(), options,
+        [this, teapotTexture](Mesh& mesh, const Image* texture)
+        {
+            addMesh(mesh, teapotTexture.c_str(), texture,
+                    "teapot.obj", glm::vec3(-2.0f, 0.0f, 0.0f), glm::vec3(0.1f, 0.1f, 0.1f));
+        });
+
+    // A floor of small crates, all drawn with one instanced call.
+    string crateTexture = compressedTexturePath("assets/textures/wall.jpg");
+    assets.loadMesh("assets/models/cube.obj", crateTexture.c_str(), options,
+        [this, crateTexture](Mesh& mesh, const Image* texture)
+        {
+            addInstances(mesh, crateTexture.c_str(), texture, 32, 0.4f, glm::vec3(0.0f, -1.5f, 0.0f));
+        });
 
-    glm::mat4 projection;
     projection = glm::perspective(glm::radians(45.0f), (float) 800 / (float) 600, 0.1f, 100.0f);
-    unsigned int projectionLoc = glGetUniformLocation(shaderProgram.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    lodSettings.screenScale = height / (2.0f * tanf(glm::radians(45.0f) * 0.5f));
+    shaderProgram.use();
+    shaderProgram.setMat4(shaderProgram.uniform("projection"), projection);
+    viewUniform = shaderProgram.uniform("view");
+    instancedShader.use();
+    instancedShader.setMat4(instancedShader.uniform("projection"), projection);
+    instancedViewUniform = instancedShader.uniform("view");
 
     loop();
 }
 
+// Lays out copies of a mesh on a square grid centred on position.
+// ----------------------------------------------------------------
+void MyApplication::addInstances(Mesh& mesh, const char* texturePath, const Image* image, int gridSize, float spacing, glm::vec3 position)
+{
+    shared_ptr<Texture> texture = textures.acquire(texturePath, SamplerParams(), image);
+    if (!texture)
+    {
+        cerr << "Could not load texture!" << endl;
+        return;
+    }
+
+    mesh.loadMaterialTextures(textures);
+    InstancedMesh crates(move(mesh));
+    crates.setupBuffers(instancedShader, texture);
+    for (int z = 0; z < gridSize; z++)
+        for (int x = 0; x < gridSize; x++)
+        {
+            glm::vec3 offset((x - gridSize * 0.5f) * spacing, 0.0f, (z - gridSize * 0.5f) * spacing);
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), position + offset);
+            crates.add(glm::scale(transform, glm::vec3(spacing * 0.4f)));
+        }
+    instancedMeshes.emplace_back(move(crates));
+}
+
+// Uploads a mesh handed over by the asset loader and places it in the scene.
+// --------------------------------------------------------------------------
+void MyApplication::addMesh(Mesh& mesh, const char* texturePath, const Image* image, const char* name, glm::vec3 position, glm::vec3 size)
+{
+    // Meshes using the same image share one GL texture.
+    shared_ptr<Texture> texture = textures.acquire(texturePath, SamplerParams(), image);
+    if (!texture)
+    {
+        cerr << "Could not load texture!" << endl;
+        return;
+    }
+
+    mesh.printStats(name);
+    mesh.setupBuffers(shaderProgram, texture);
+    mesh.loadMaterialTextures(textures);
+    mesh.translate(position);
+    mesh.scale(size);
+    meshes.emplace_back(move(mesh));
+    textures.printStats();
+
+    // Meshes do not move yet, so the tree only changes when one is added.
+    vector<AABB> bounds;
+    for (size_t i = 0; i < meshes.size(); i++)
+        bounds.push_back(meshes[i].worldBounds());
+    sceneBvh.build(bounds);
+}
+
 // Main loop of the application.
 // -----------------------------
 void MyApplication::loop()
@@ -46,25 +128,66 @@ void MyApplication::loop()
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        PROFILE_FRAME();
 
         // Process user Input.
         // --------------
-        process_input();
+        {
+            PROFILE_SCOPE("input");
+            process_input();
+        }
+
+        // Upload whatever finished loading, within a few milliseconds.
+        // ---------------------------------------------------------------
+        {
+            PROFILE_SCOPE("upload");
+            assets.upload(0.004);
+        }
+        shaderProgram.resetLookups();
+        instancedShader.resetLookups();
 
         // Set up view matrix to add perspective.
         // ----------------
-        unsigned int viewLoc = glGetUniformLocation(shaderProgram.shaderProgram, "view");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(camera.getViewMatrix()));
+        glm::mat4 view = camera.getViewMatrix();
+        shaderProgram.use();
+        shaderProgram.setMat4(viewUniform, view);
+        instancedShader.use();
+        instancedShader.setMat4(instancedViewUniform, view);
 
-        // Render the screen.
+        // Render the screen, sorted to keep state changes down.
         // ------------------
-        shaderProgram.use();
-        meshes[0].draw(shaderProgram);
-        meshes[1].draw(shaderProgram);
+        // Meshes outside the view frustum are dropped before they reach the queue.
+        {
+            PROFILE_SCOPE("culling");
+            sceneBvh.cull(extractFrustum(projection * view), visibleMeshes);
+        }
+        {
+            PROFILE_SCOPE("submit");
+            for (size_t i = 0; i < visibleMeshes.size(); i++)
+                meshes[visibleMeshes[i]].submit(renderQueue, view, lodSettings);
+            for (size_t i = 0; i < instancedMeshes.size(); i++)
+                instancedMeshes[i].submit(renderQueue);
+        }
+        {
+            PROFILE_SCOPE("draw");
+            PROFILE_GPU_SCOPE("draw (gpu)");
+            renderQueue.flush(renderBackend);
+        }
+
+        // Uniforms are resolved at setup, drawing should not look any up by name.
+        size_t lookups = shaderProgram.lookups() + instancedShader.lookups();
+        if (lookups > 0 && !uniformLookupWarned)
+        {
+            cerr << "Warning: " << lookups << " uniform lookups by name in a frame" << endl;
+            uniformLookupWarned = true;
+        }
 
         // Flip buffers and clear z-buffer.
         // --------------------------------
-        glfwSwapBuffers(window);
+        {
+            PROFILE_SCOPE("swap");
+            glfwSwapBuffers(window);
+        }
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         glfwPollEvents();
     }
@@ -78,6 +201,46 @@ void MyApplication::process_input()
 
     if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
     glfwSetWindowShouldClose(window, true);
+
+    // Pick the mesh in the middle of the screen on click.
+    bool clicked = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    if (clicked && !mouseDown)
+    {
+        Ray ray;
+        ray.origin = camera.getPosition();
+        ray.direction = camera.getFront();
+        uint32_t picked;
+        float distance;
+        TriangleHit hit;
+        auto intersect = [&](uint32_t object, const Ray& objectRay, float& objectDistance)
+        {
+            TriangleHit candidate;
+            if (!meshes[object].raycast(objectRay, objectDistance, candidate))
+                return false;
+            objectDistance = candidate.distance;
+            hit = candidate;
+            return true;
+        };
+        if (sceneBvh.raycast(ray, 100.0f, picked, distance, intersect))
+        {
+            glm::vec2 uv = meshes[picked].triangles.texCoord(hit);
+            cout << "Picked mesh " << picked << " triangle " << hit.triangle << " at distance " << distance
+                 << " uv " << uv.x << ", " << uv.y << endl;
+        }
+    }
+    mouseDown = clicked;
+
+#ifdef ENABLE_PROFILER
+    // Print the frame timings and save a trace of the last few seconds on P.
+    bool profileKey = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (profileKey && !profileKeyDown)
+    {
+        Profiler::shared().report();
+        if (Profiler::shared().writeTrace("profile_trace.json"))
+            cout << "Wrote profile_trace.json, open it in chrome://tracing" << endl;
+    }
+    profileKeyDown = profileKey;
+#endif
 }
 
 // Mouse callback calculates the offset from last mouse position and passes these to the camera.
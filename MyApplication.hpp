@@ -8,9 +8,22 @@ public:
 
 private:
     Shader shaderProgram;
+    Uniform viewUniform;
+    Shader instancedShader;
+    Uniform instancedViewUniform;
+    bool uniformLookupWarned = false;
     Camera camera;
 
+    TextureCache textures;
     std::vector<Mesh> meshes;
+    std::vector<InstancedMesh> instancedMeshes;
+    glm::mat4 projection;
+    LodSettings lodSettings;
+    SceneBVH sceneBvh;
+    std::vector<uint32_t> visibleMeshes;
+    RenderQueue renderQueue;
+    GLRenderBackend renderBackend;
+    AssetLoader assets;
 
     float deltaTime = 0.0;
     float lastFrame = 0.0;
@@ -18,7 +31,11 @@ private:
     float lastX;
     float lastY;
     bool firstMouse = true;
+    bool mouseDown = false;
+    bool profileKeyDown = false;
 
+    void addInstances(Mesh& mesh, const char* texturePath, const Image* image, int gridSize, float spacing, glm::vec3 position);
+    void addMesh(Mesh& mesh, const char* texturePath, const Image* image, const char* name, glm::vec3 position, glm::vec3 size);
     virtual void loop();
     virtual void process_input();
 };
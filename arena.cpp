@@ -0,0 +1,122 @@
+#include "Application.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+Arena::Arena(size_t blockSize) : blockAllocations(0), keepBytes(0), blockSize(blockSize), offset(0), usedBytes(0), capacityBytes(0), peakBytes(0)
+{
+}
+
+Arena::~Arena()
+{
+    release();
+}
+
+// One per thread, so loads on the asset loader's workers never share one.
+Arena& Arena::forThisThread()
+{
+    static thread_local Arena arena;
+    return arena;
+}
+
+// Bumps through the last block. What does not fit gets a block sized by the
+// request. When that block would have less room left than the current one,
+// it goes in before it, so the current block keeps taking what fits.
+// Alignment padding counts as used, so reset() knows what a load took.
+// ------------------------------------------------------------------------
+void* Arena::allocate(size_t bytes, size_t alignment)
+{
+    if (!blocks.empty())
+    {
+        const Block& block = blocks.back();
+        size_t padding = (alignment - (uintptr_t)(block.data + offset) % alignment) % alignment;
+        if (offset + padding + bytes <= block.size)
+        {
+            char* memory = block.data + offset + padding;
+            offset += padding + bytes;
+            usedBytes += padding + bytes;
+            peakBytes = max(peakBytes, usedBytes);
+            return memory;
+        }
+    }
+
+    // The heap aligns for any type, so a new block needs no padding.
+    Block block = { NULL, max(blockSize, bytes) };
+    block.data = (char*) ::operator new(block.size);
+    blockAllocations++;
+    capacityBytes += block.size;
+    usedBytes += bytes;
+    peakBytes = max(peakBytes, usedBytes);
+    if (!blocks.empty() && block.size - bytes < blocks.back().size - offset)
+    {
+        blocks.insert(blocks.end() - 1, block);
+    }
+    else
+    {
+        blocks.push_back(block);
+        offset = bytes;
+    }
+    return block.data;
+}
+
+// Only the most recent allocation in the current block can be given back,
+// which is how a temporary allocated after everything else frees its room.
+void Arena::deallocate(void* memory, size_t bytes)
+{
+    if (!blocks.empty() && (char*) memory + bytes == blocks.back().data + offset)
+    {
+        offset -= bytes;
+        usedBytes -= bytes;
+    }
+}
+
+// Makes room for bytes more in the current block, so a load that knows its
+// size up front takes a single block.
+void Arena::reserve(size_t bytes)
+{
+    peakBytes = max(peakBytes, usedBytes + bytes);
+    if (!blocks.empty() && blocks.back().size - offset >= bytes)
+        return;
+
+    Block block = { (char*) ::operator new(bytes), bytes };
+    blocks.push_back(block);
+    blockAllocations++;
+    capacityBytes += bytes;
+    offset = 0;
+}
+
+// Drops everything handed out. A load that took several blocks leaves one
+// block of all it used instead, so the same load again fits in it, unless
+// that is more than keepBytes to hold on to.
+// ----------------------------------------------------------------------
+void Arena::reset()
+{
+    size_t wanted = peakBytes;
+    offset = 0;
+    usedBytes = 0;
+    peakBytes = 0;
+    if (blocks.size() == 1 && blocks[0].size >= wanted && blocks[0].size <= keepBytes)
+        return;
+
+    release();
+    if (wanted > 0 && wanted <= keepBytes)
+    {
+        Block block = { (char*) ::operator new(wanted), wanted };
+        blocks.push_back(block);
+        blockAllocations++;
+        capacityBytes = wanted;
+    }
+}
+
+// Gives every block back to the heap, whatever keepBytes says.
+void Arena::release()
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+        ::operator delete(blocks[i].data);
+    blocks.clear();
+    offset = 0;
+    usedBytes = 0;
+    peakBytes = 0;
+    capacityBytes = 0;
+}
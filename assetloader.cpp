@@ -0,0 +1,127 @@
+#include "Application.hpp"
+
+#include <chrono>
+
+using namespace std;
+
+AssetLoader::AssetLoader(TextureCache* textures, ThreadPool& pool) : textures(textures), pool(pool), loading(0)
+{
+}
+
+// Waits for jobs still running, they write into this loader.
+AssetLoader::~AssetLoader()
+{
+    unique_lock<mutex> lock(resultMutex);
+    while (loading > 0)
+        idle.wait(lock);
+}
+
+// Queues a mesh and its texture for loading on the pool. onReady runs from
+// upload() once both are in memory; texturePath may be NULL. The texture is
+// not decoded again if the cache already holds it or another job is on it,
+// in that case onReady may get no image and should acquire it from the cache.
+// ------------------------------------------------------------------------
+void AssetLoader::loadMesh(const char* objPath, const char* texturePath, const MeshOptions& options, MeshReady onReady)
+{
+    string meshFile = objPath;
+    string textureFile = texturePath ? texturePath : "";
+
+    {
+        lock_guard<mutex> lock(resultMutex);
+        loading++;
+    }
+
+    pool.enqueue([this, meshFile, textureFile, options, onReady]()
+    {
+        PROFILE_SCOPE("load asset");
+        Result result;
+        result.onReady = onReady;
+        result.mesh = make_shared<Mesh>(meshFile.c_str(), options);
+
+        // Compressed textures are uploaded as they are stored, nothing to decode here.
+        if (!textureFile.empty() && !isCompressedTexture(textureFile) && !(textures && textures->contains(textureFile)))
+        {
+            result.texturePath = textureFile;
+
+            // The first job asking for an image decodes it, the others wait on its future.
+            promise<shared_ptr<Image> > decoded;
+            shared_future<shared_ptr<Image> > image;
+            bool decodeHere = false;
+            {
+                lock_guard<mutex> lock(resultMutex);
+                map<string, shared_future<shared_ptr<Image> > >::iterator it = decoding.find(textureFile);
+                if (it == decoding.end())
+                {
+                    image = decoded.get_future().share();
+                    decoding[textureFile] = image;
+                    decodeHere = true;
+                }
+                else
+                {
+                    image = it->second;
+                }
+            }
+
+            if (decodeHere)
+            {
+                shared_ptr<Image> texture = make_shared<Image>();
+                if (!loadImage(textureFile.c_str(), *texture))
+                {
+                    cerr << "Could not load texture " << textureFile << endl;
+                    texture.reset();
+                }
+                decoded.set_value(texture);
+            }
+            result.texture = image.get();
+        }
+
+        lock_guard<mutex> lock(resultMutex);
+        results.push_back(result);
+        loading--;
+        idle.notify_all();
+    });
+}
+
+// Hands finished assets to their callbacks until the time budget is used up.
+// At least one asset is uploaded per call so loading always makes progress.
+// Returns the number of assets uploaded.
+// ------------------------------------------------------------------------
+int AssetLoader::upload(double budgetSeconds)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int uploaded = 0;
+
+    while (1)
+    {
+        Result result;
+        {
+            lock_guard<mutex> lock(resultMutex);
+            if (results.empty())
+                break;
+            result = results.front();
+            results.pop_front();
+        }
+
+        result.onReady(*result.mesh, result.texture.get());
+        uploaded++;
+
+        // Once uploaded the texture cache has the image, later jobs go there.
+        if (!result.texturePath.empty())
+        {
+            lock_guard<mutex> lock(resultMutex);
+            decoding.erase(result.texturePath);
+        }
+
+        if (chrono::duration<double>(chrono::steady_clock::now() - start).count() >= budgetSeconds)
+            break;
+    }
+
+    return uploaded;
+}
+
+// Assets that are still loading or waiting to be uploaded.
+size_t AssetLoader::pending()
+{
+    lock_guard<mutex> lock(resultMutex);
+    return loading + results.size();
+}
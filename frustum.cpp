@@ -0,0 +1,142 @@
+#include "Application.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define FRUSTUM_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+// Gribb and Hartmann: each clip plane is the last row of the matrix plus or
+// minus one of the others. glm is column major, so row i is m[.][i].
+// -------------------------------------------------------------------------
+Frustum extractFrustum(const glm::mat4& m)
+{
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+
+    // Normalized so plane distances compare against radii.
+    for (int i = 0; i < 6; i++)
+        frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+    return frustum;
+}
+
+bool sphereInFrustum(const Frustum& frustum, const BoundingSphere& sphere)
+{
+    // Summed in the same order as cullSpheres, so both agree on the edges.
+    for (int i = 0; i < 6; i++)
+    {
+        const glm::vec4& plane = frustum.planes[i];
+        float distance = (plane.x * sphere.center.x + plane.y * sphere.center.y) + (plane.z * sphere.center.z + plane.w);
+        if (distance < -sphere.radius)
+            return false;
+    }
+    return true;
+}
+
+// Conservative box test: rejects the box only when it is entirely behind a plane.
+bool aabbInFrustum(const Frustum& frustum, const AABB& box)
+{
+    for (int i = 0; i < 6; i++)
+    {
+        const glm::vec4& plane = frustum.planes[i];
+        glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x,
+                           plane.y >= 0.0f ? box.max.y : box.min.y,
+                           plane.z >= 0.0f ? box.max.z : box.min.z);
+        if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+void SphereList::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    radius.clear();
+}
+
+void SphereList::push_back(const BoundingSphere& sphere)
+{
+    x.push_back(sphere.center.x);
+    y.push_back(sphere.center.y);
+    z.push_back(sphere.center.z);
+    radius.push_back(sphere.radius);
+}
+
+size_t cullSpheresScalar(const Frustum& frustum, const SphereList& spheres, vector<unsigned char>& visible)
+{
+    size_t count = spheres.size(), inside = 0;
+    visible.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        BoundingSphere sphere;
+        sphere.center = glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]);
+        sphere.radius = spheres.radius[i];
+        visible[i] = sphereInFrustum(frustum, sphere);
+        inside += visible[i];
+    }
+    return inside;
+}
+
+// Tests four spheres per step against all six planes, without branching.
+// ----------------------------------------------------------------------
+size_t cullSpheres(const Frustum& frustum, const SphereList& spheres, vector<unsigned char>& visible)
+{
+#ifdef FRUSTUM_SSE
+    size_t count = spheres.size(), inside = 0;
+    visible.resize(count);
+
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; p++)
+        for (int k = 0; k < 4; k++)
+            planes[p][k] = _mm_set1_ps(frustum.planes[p][k]);
+
+    const __m128 zero = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&spheres.x[i]);
+        __m128 y = _mm_loadu_ps(&spheres.y[i]);
+        __m128 z = _mm_loadu_ps(&spheres.z[i]);
+        __m128 negativeRadius = _mm_sub_ps(zero, _mm_loadu_ps(&spheres.radius[i]));
+
+        __m128 in = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+                                         _mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+            in = _mm_and_ps(in, _mm_cmpge_ps(distance, negativeRadius));
+        }
+
+        int mask = _mm_movemask_ps(in);
+        visible[i] = mask & 1;
+        visible[i + 1] = (mask >> 1) & 1;
+        visible[i + 2] = (mask >> 2) & 1;
+        visible[i + 3] = (mask >> 3) & 1;
+        inside += visible[i] + visible[i + 1] + visible[i + 2] + visible[i + 3];
+    }
+
+    for (; i < count; i++)
+    {
+        BoundingSphere sphere;
+        sphere.center = glm::vec3(spheres.x[i], spheres.y[i], spheres.z[i]);
+        sphere.radius = spheres.radius[i];
+        visible[i] = sphereInFrustum(frustum, sphere);
+        inside += visible[i];
+    }
+    return inside;
+#else
+    return cullSpheresScalar(frustum, spheres, visible);
+#endif
+}
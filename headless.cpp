@@ -0,0 +1,232 @@
+#include "Application.hpp"
+
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+using namespace std;
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Surfaceless display where Mesa offers one, the default display otherwise.
+static EGLDisplay openDisplay()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    if (getPlatformDisplay && extensions && strstr(extensions, "EGL_MESA_platform_surfaceless"))
+    {
+        EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+            return display;
+    }
+
+    EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL))
+        return display;
+    return EGL_NO_DISPLAY;
+}
+
+// Sets up EGL and loads the GL functions through it.
+// --------------------------------------------------
+HeadlessContext::HeadlessContext() :
+    display(NULL), context(NULL)
+{
+    EGLDisplay eglDisplay = openDisplay();
+    if (eglDisplay == EGL_NO_DISPLAY)
+    {
+        cerr << "Failed to open an EGL display" << endl;
+        return;
+    }
+    display = eglDisplay;
+
+    // Pbuffer bit only so the config is usable without any surface support.
+    const EGLint configAttributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configCount = 0;
+    if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(eglDisplay, configAttributes, &config, 1, &configCount) || configCount == 0)
+    {
+        // Surfaceless displays may not list pbuffer configs.
+        const EGLint anyConfig[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        if (!eglChooseConfig(eglDisplay, anyConfig, &config, 1, &configCount) || configCount == 0)
+        {
+            cerr << "No EGL config supports OpenGL" << endl;
+            return;
+        }
+    }
+
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+    EGLContext eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
+    if (eglContext == EGL_NO_CONTEXT)
+    {
+        cerr << "Failed to create an OpenGL 3.3 context" << endl;
+        return;
+    }
+
+    if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext))
+    {
+        cerr << "Failed to make the context current without a surface" << endl;
+        eglDestroyContext(eglDisplay, eglContext);
+        return;
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc) eglGetProcAddress))
+    {
+        cerr << "Failed to initialize GLAD" << endl;
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(eglDisplay, eglContext);
+        return;
+    }
+    context = eglContext;
+
+    glEnable(GL_DEPTH_TEST);
+}
+
+HeadlessContext::~HeadlessContext()
+{
+    if (context)
+    {
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+    }
+    if (display)
+        eglTerminate(display);
+}
+
+RenderTarget::RenderTarget(int width, int height) :
+    width(width), height(height), framebuffer(0), color(0), depth(0)
+{
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &color);
+    glGenRenderbuffers(1, &depth);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+    if (!isComplete())
+        cerr << "Framebuffer " << width << "x" << height << " is incomplete" << endl;
+}
+
+RenderTarget::~RenderTarget()
+{
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+}
+
+bool RenderTarget::isComplete() const
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+void RenderTarget::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+}
+
+PixelReader::PixelReader(int width, int height, size_t bufferCount) :
+    width(width), height(height), buffers(max(bufferCount, (size_t) 1))
+{
+    glGenBuffers(buffers.size(), buffers.data());
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (size_t) width * height * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    freeBuffers = buffers;
+}
+
+PixelReader::~PixelReader()
+{
+    finish();
+    glDeleteBuffers(buffers.size(), buffers.data());
+}
+
+// Queues a copy of the bound framebuffer into a free buffer. When all of them
+// are in flight this waits for the oldest, which bounds the latency.
+// ----------------------------------------------------------------------------
+void PixelReader::read(const Callback& done)
+{
+    collect(false);
+    while (freeBuffers.empty())
+        collect(true);
+
+    Pending copy;
+    copy.buffer = freeBuffers.back();
+    copy.done = done;
+    freeBuffers.pop_back();
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, copy.buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    copy.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Without a flush the fence may never reach the GPU and waiting on it hangs.
+    glFlush();
+    pending.push_back(copy);
+}
+
+void PixelReader::finish()
+{
+    while (!pending.empty())
+        collect(true);
+}
+
+// Hands finished copies to their callbacks in the order they were read.
+// Only the oldest copy is waited for, and only when wait is set.
+// -----------------------------------------------------------------------
+void PixelReader::collect(bool wait)
+{
+    while (!pending.empty())
+    {
+        Pending& copy = pending.front();
+        GLuint64 timeout = wait ? 1000000000ull : 0;
+        GLenum status = glClientWaitSync(copy.fence, 0, timeout);
+        if (status == GL_TIMEOUT_EXPIRED && !wait)
+            return;
+        if (status == GL_WAIT_FAILED)
+            cerr << "Waiting for a pixel readback failed" << endl;
+        // A copy that is still running after a second is read anyway, mapping blocks until it is done.
+
+        glDeleteSync(copy.fence);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, copy.buffer);
+        const unsigned char* pixels = (const unsigned char*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t) width * height * 4, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            copy.done(pixels);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+        {
+            cerr << "Could not map a pixel buffer" << endl;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        freeBuffers.push_back(copy.buffer);
+        pending.pop_front();
+        // Later copies are waited for by later calls, or polled now.
+        wait = false;
+    }
+}
@@ -0,0 +1,142 @@
+#include "Application.hpp"
+
+#include <float.h>
+
+using namespace std;
+
+static const size_t noInstance = ~(size_t) 0;
+
+InstancedMesh::InstancedMesh(Mesh&& geometry) :
+    mesh(move(geometry)), instanceVbo(0), capacity(0), dirtyBegin(noInstance), dirtyEnd(0)
+{
+}
+
+InstancedMesh::InstancedMesh(InstancedMesh&& other) noexcept :
+    mesh(move(other.mesh)), transforms(move(other.transforms)), instanceVbo(other.instanceVbo),
+    capacity(other.capacity), dirtyBegin(other.dirtyBegin), dirtyEnd(other.dirtyEnd)
+{
+    other.instanceVbo = 0;
+    other.capacity = 0;
+}
+
+InstancedMesh& InstancedMesh::operator=(InstancedMesh&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    if (instanceVbo)
+        glDeleteBuffers(1, &instanceVbo);
+    mesh = move(other.mesh);
+    transforms = move(other.transforms);
+    instanceVbo = other.instanceVbo;
+    capacity = other.capacity;
+    dirtyBegin = other.dirtyBegin;
+    dirtyEnd = other.dirtyEnd;
+
+    other.instanceVbo = 0;
+    other.capacity = 0;
+    return *this;
+}
+
+InstancedMesh::~InstancedMesh()
+{
+    if (instanceVbo)
+        glDeleteBuffers(1, &instanceVbo);
+}
+
+// Uploads the mesh for an instanced shader and adds the per instance matrix
+// to its vertex array.
+// -------------------------------------------------------------------------
+void InstancedMesh::setupBuffers(Shader& shaderProgram, shared_ptr<Texture> texture)
+{
+    mesh.setupBuffers(shaderProgram, texture);
+
+    glBindVertexArray(mesh.vao);
+    glGenBuffers(1, &instanceVbo);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+
+    // A mat4 attribute takes four locations, one per column.
+    for (int column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(3 + column);
+        glVertexAttribDivisor(3 + column, 1);
+    }
+    glBindVertexArray(0);
+
+    // Whatever was added before setup goes up with the first draw.
+    capacity = 0;
+    markDirty(0, transforms.size());
+}
+
+size_t InstancedMesh::add(const glm::mat4& transform)
+{
+    transforms.push_back(transform);
+    markDirty(transforms.size() - 1, transforms.size());
+    return transforms.size() - 1;
+}
+
+void InstancedMesh::set(size_t instance, const glm::mat4& transform)
+{
+    transforms[instance] = transform;
+    markDirty(instance, instance + 1);
+}
+
+void InstancedMesh::markDirty(size_t begin, size_t end)
+{
+    dirtyBegin = min(dirtyBegin, begin);
+    dirtyEnd = max(dirtyEnd, end);
+}
+
+// Sends changed instances to the GPU. The buffer grows by doubling and is
+// then filled completely, otherwise only the changed range is written.
+// -----------------------------------------------------------------------
+void InstancedMesh::uploadInstances()
+{
+    if (dirtyBegin >= dirtyEnd)
+        return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+    if (transforms.size() > capacity)
+    {
+        capacity = max(transforms.size(), capacity * 2);
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(glm::mat4), transforms.data());
+    }
+    else
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, dirtyBegin * sizeof(glm::mat4), (dirtyEnd - dirtyBegin) * sizeof(glm::mat4),
+                        &transforms[dirtyBegin]);
+    }
+
+    dirtyBegin = noInstance;
+    dirtyEnd = 0;
+}
+
+// Draws every instance with one call, using the shader given to setupBuffers.
+void InstancedMesh::draw(Shader& shaderProgram)
+{
+    if (transforms.empty())
+        return;
+
+    uploadInstances();
+    mesh.bind(shaderProgram);
+    mesh.drawRanges(shaderProgram, transforms.size());
+}
+
+// Queues all instances as one draw per material. Instances are spread out,
+// so the group is not depth sorted and goes after other draws with the same state.
+void InstancedMesh::submit(RenderQueue& queue)
+{
+    if (transforms.empty())
+        return;
+
+    uploadInstances();
+    const MeshLod& full = mesh.lods[0];
+    for (size_t i = full.firstRange; i < full.firstRange + full.rangeCount; i++)
+    {
+        DrawItem item = mesh.drawItem(mesh.ranges[i]);
+        item.instanceCount = transforms.size();
+        queue.submit(item, FLT_MAX);
+    }
+}
@@ -0,0 +1,386 @@
+#include "Application.hpp"
+
+using namespace std;
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+// BC1 (DXT1) block compression. Every 4x4 block is two RGB565 endpoints and
+// sixteen 2 bit indices into a palette interpolated between them.
+// -------------------------------------------------------------------------
+
+static inline uint16_t toRgb565(const float* c)
+{
+    int r = (int) floorf(glm::clamp(c[0], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    int g = (int) floorf(glm::clamp(c[1], 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+    int b = (int) floorf(glm::clamp(c[2], 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline void fromRgb565(uint16_t c, int* rgb)
+{
+    int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Palette of a block in the four colour mode (c0 > c1), or three colours and black.
+static void blockPalette(uint16_t c0, uint16_t c1, int palette[4][3])
+{
+    fromRgb565(c0, palette[0]);
+    fromRgb565(c1, palette[1]);
+    for (int i = 0; i < 3; i++)
+    {
+        if (c0 > c1)
+        {
+            palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+            palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+        }
+        else
+        {
+            palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+            palette[3][i] = 0;
+        }
+    }
+}
+
+// Endpoints are the extremes of the block along its principal colour axis.
+static void encodeBlock(const unsigned char pixels[16][3], unsigned char* out)
+{
+    float mean[3] = { 0.0f, 0.0f, 0.0f };
+    for (int p = 0; p < 16; p++)
+        for (int i = 0; i < 3; i++)
+            mean[i] += pixels[p][i] / 16.0f;
+
+    float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+    for (int p = 0; p < 16; p++)
+    {
+        float d[3] = { pixels[p][0] - mean[0], pixels[p][1] - mean[1], pixels[p][2] - mean[2] };
+        covariance[0] += d[0] * d[0]; covariance[1] += d[0] * d[1]; covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1]; covariance[4] += d[1] * d[2]; covariance[5] += d[2] * d[2];
+    }
+
+    // A few power iterations are plenty for a 3x3 matrix.
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+        };
+        float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f)
+            break;
+        for (int i = 0; i < 3; i++)
+            axis[i] = next[i] / length;
+    }
+
+    float lowest = 1e30f, highest = -1e30f;
+    for (int p = 0; p < 16; p++)
+    {
+        float t = (pixels[p][0] - mean[0]) * axis[0] + (pixels[p][1] - mean[1]) * axis[1] + (pixels[p][2] - mean[2]) * axis[2];
+        lowest = min(lowest, t);
+        highest = max(highest, t);
+    }
+
+    float high[3], low[3];
+    for (int i = 0; i < 3; i++)
+    {
+        high[i] = mean[i] + axis[i] * highest;
+        low[i] = mean[i] + axis[i] * lowest;
+    }
+
+    uint16_t c0 = toRgb565(high), c1 = toRgb565(low);
+    if (c0 < c1)
+        swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1)
+    {
+        int palette[4][3];
+        blockPalette(c0, c1, palette);
+
+        for (int p = 0; p < 16; p++)
+        {
+            int best = 0, bestError = 1 << 30;
+            for (int k = 0; k < 4; k++)
+            {
+                int dr = pixels[p][0] - palette[k][0], dg = pixels[p][1] - palette[k][1], db = pixels[p][2] - palette[k][2];
+                int error = dr * dr + dg * dg + db * db;
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = k;
+                }
+            }
+            indices |= (uint32_t) best << (2 * p);
+        }
+    }
+
+    out[0] = c0 & 0xff; out[1] = c0 >> 8;
+    out[2] = c1 & 0xff; out[3] = c1 >> 8;
+    for (int i = 0; i < 4; i++)
+        out[4 + i] = (indices >> (8 * i)) & 0xff;
+}
+
+// Compresses an RGB image, edge blocks repeat the last row and column.
+void encodeBC1(const unsigned char* rgb, int width, int height, vector<unsigned char>& blocks)
+{
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    blocks.resize((size_t) blocksX * blocksY * 8);
+
+    for (int by = 0; by < blocksY; by++)
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            unsigned char pixels[16][3];
+            for (int p = 0; p < 16; p++)
+            {
+                int x = min(bx * 4 + p % 4, width - 1), y = min(by * 4 + p / 4, height - 1);
+                memcpy(pixels[p], rgb + ((size_t) y * width + x) * 3, 3);
+            }
+            encodeBlock(pixels, &blocks[((size_t) by * blocksX + bx) * 8]);
+        }
+}
+
+// Reference decoder, used to measure what the GPU will show.
+void decodeBC1(const unsigned char* blocks, int width, int height, vector<unsigned char>& rgb)
+{
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    rgb.resize((size_t) width * height * 3);
+
+    for (int by = 0; by < blocksY; by++)
+        for (int bx = 0; bx < blocksX; bx++)
+        {
+            const unsigned char* block = blocks + ((size_t) by * blocksX + bx) * 8;
+            uint16_t c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+            uint32_t indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t) block[7] << 24);
+
+            int palette[4][3];
+            blockPalette(c0, c1, palette);
+
+            for (int p = 0; p < 16; p++)
+            {
+                int x = bx * 4 + p % 4, y = by * 4 + p / 4;
+                if (x >= width || y >= height)
+                    continue;
+                const int* color = palette[(indices >> (2 * p)) & 3];
+                unsigned char* out = &rgb[((size_t) y * width + x) * 3];
+                out[0] = color[0]; out[1] = color[1]; out[2] = color[2];
+            }
+        }
+}
+
+// Next mip level with a 2x2 box filter, odd edges reuse the last texel.
+void halveImage(const unsigned char* rgb, int width, int height, vector<unsigned char>& out)
+{
+    int halfWidth = max(1, width / 2), halfHeight = max(1, height / 2);
+    out.resize((size_t) halfWidth * halfHeight * 3);
+
+    for (int y = 0; y < halfHeight; y++)
+        for (int x = 0; x < halfWidth; x++)
+        {
+            int x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+            int y0 = min(2 * y, height - 1), y1 = min(2 * y + 1, height - 1);
+            for (int i = 0; i < 3; i++)
+            {
+                int sum = rgb[((size_t) y0 * width + x0) * 3 + i] + rgb[((size_t) y0 * width + x1) * 3 + i] +
+                          rgb[((size_t) y1 * width + x0) * 3 + i] + rgb[((size_t) y1 * width + x1) * 3 + i];
+                out[((size_t) y * halfWidth + x) * 3 + i] = (unsigned char)((sum + 2) / 4);
+            }
+        }
+}
+
+double psnr(const unsigned char* a, const unsigned char* b, size_t bytes)
+{
+    double error = 0.0;
+    for (size_t i = 0; i < bytes; i++)
+    {
+        double d = (double) a[i] - b[i];
+        error += d * d;
+    }
+    if (error == 0.0)
+        return 99.0;
+    return 10.0 * log10(255.0 * 255.0 / (error / bytes));
+}
+
+// KTX2 container holding a BC1 mip chain, no supercompression.
+// ------------------------------------------------------------
+static const unsigned char ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const uint32_t vkFormatBC1RgbUnorm = 131;
+
+struct Ktx2Header
+{
+    unsigned char identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth, pixelHeight, pixelDepth;
+    uint32_t layerCount, faceCount, levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset, dfdByteLength;
+    uint32_t kvdByteOffset, kvdByteLength;
+    uint64_t sgdByteOffset, sgdByteLength;
+};
+
+struct Ktx2Level
+{
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+static void append(vector<unsigned char>& file, const void* data, size_t size)
+{
+    file.insert(file.end(), (const unsigned char*) data, (const unsigned char*) data + size);
+}
+
+static void align(vector<unsigned char>& file, size_t alignment)
+{
+    while (file.size() % alignment)
+        file.push_back(0);
+}
+
+// Writes levels (largest first) as a KTX2 file. The data keeps the bottom-up
+// row order the loader uploads, which the KTXorientation key records.
+// -------------------------------------------------------------------------
+bool writeKtx2(const char* path, int width, int height, const vector<vector<unsigned char> >& levels)
+{
+    // Data format descriptor: one basic block with a single BC1 sample.
+    const uint32_t dfd[] = {
+        44,                         // dfdTotalSize
+        0,                          // vendorId, descriptorType
+        2 | (40u << 16),            // versionNumber, descriptorBlockSize
+        128 | (1 << 8) | (1 << 16), // colorModel BC1A, primaries BT709, linear transfer
+        3 | (3 << 8),               // 4x4 texel blocks
+        8, 0,                       // bytesPlane0 = 8
+        (63u << 16),                // bitOffset 0, bitLength 64, channel BC1 colour
+        0,                          // samplePosition
+        0, 0xffffffffu              // sampleLower, sampleUpper
+    };
+    const char orientation[] = "KTXorientation\0ru";
+
+    Ktx2Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, ktx2Identifier, sizeof(ktx2Identifier));
+    header.vkFormat = vkFormatBC1RgbUnorm;
+    header.typeSize = 1;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.faceCount = 1;
+    header.levelCount = levels.size();
+
+    vector<Ktx2Level> index(levels.size());
+    size_t indexEnd = sizeof(Ktx2Header) + index.size() * sizeof(Ktx2Level);
+    header.dfdByteOffset = indexEnd;
+    header.dfdByteLength = sizeof(dfd);
+    header.kvdByteOffset = indexEnd + sizeof(dfd);
+    header.kvdByteLength = (4 + sizeof(orientation) + 3) & ~3u;
+
+    vector<unsigned char> file;
+    file.resize(indexEnd);
+    append(file, dfd, sizeof(dfd));
+    uint32_t entryLength = sizeof(orientation);
+    append(file, &entryLength, 4);
+    append(file, orientation, sizeof(orientation));
+    align(file, 4);
+
+    // Smallest level first, as the spec recommends for streaming.
+    for (size_t i = levels.size(); i-- > 0;)
+    {
+        align(file, 8);
+        index[i].byteOffset = file.size();
+        index[i].byteLength = index[i].uncompressedByteLength = levels[i].size();
+        append(file, levels[i].data(), levels[i].size());
+    }
+
+    memcpy(&file[0], &header, sizeof(header));
+    memcpy(&file[sizeof(header)], index.data(), index.size() * sizeof(Ktx2Level));
+
+    FILE* out = fopen(path, "wb");
+    if (!out)
+        return false;
+    bool ok = fwrite(file.data(), 1, file.size(), out) == file.size();
+    return (fclose(out) == 0) && ok;
+}
+
+// Whether the current context can sample BC1 blocks itself.
+static bool hasS3tc()
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++)
+    {
+        const char* name = (const char*) glGetStringi(GL_EXTENSIONS, i);
+        if (name && strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+            return true;
+    }
+    return false;
+}
+
+// Uploads a KTX2 BC1 file level by level straight from the mapped file.
+// Without S3TC support the levels are decoded to RGB here instead.
+// ---------------------------------------------------------------------
+bool loadKtx2Texture(const char* path, const SamplerParams& params, Texture& texture)
+{
+    MappedFile file(path);
+    if (!file.isOpen() || file.size < sizeof(Ktx2Header))
+        return false;
+
+    Ktx2Header header;
+    memcpy(&header, file.data, sizeof(header));
+    if (memcmp(header.identifier, ktx2Identifier, sizeof(ktx2Identifier)) != 0 ||
+        header.vkFormat != vkFormatBC1RgbUnorm || header.supercompressionScheme != 0 ||
+        header.pixelWidth == 0 || header.pixelHeight == 0 ||
+        header.levelCount == 0 || header.levelCount > 32 || header.faceCount != 1 ||
+        sizeof(Ktx2Header) + header.levelCount * sizeof(Ktx2Level) > file.size)
+    {
+        cerr << path << " is not a BC1 KTX2 texture" << endl;
+        return false;
+    }
+
+    // Every level must hold exactly its blocks and lie inside the file.
+    const Ktx2Level* levels = (const Ktx2Level*)(file.data + sizeof(Ktx2Header));
+    for (uint32_t i = 0; i < header.levelCount; i++)
+    {
+        uint64_t width = max(1u, header.pixelWidth >> i), height = max(1u, header.pixelHeight >> i);
+        if (levels[i].byteLength != ((width + 3) / 4) * ((height + 3) / 4) * 8 ||
+            levels[i].byteOffset > file.size || levels[i].byteLength > file.size - levels[i].byteOffset)
+        {
+            cerr << path << " has a broken level " << i << endl;
+            return false;
+        }
+    }
+
+    bool compressed = hasS3tc();
+
+    texture.type = params.type;
+    glGenTextures(1, &(texture.id));
+    glBindTexture(texture.type, texture.id);
+    glTexParameteri(texture.type, GL_TEXTURE_WRAP_S, params.wrap);
+    glTexParameteri(texture.type, GL_TEXTURE_WRAP_T, params.wrap);
+    glTexParameteri(texture.type, GL_TEXTURE_MIN_FILTER, params.minFilter);
+    glTexParameteri(texture.type, GL_TEXTURE_MAG_FILTER, params.magFilter);
+    glTexParameteri(texture.type, GL_TEXTURE_MAX_LEVEL, header.levelCount - 1);
+    if (!compressed)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    vector<unsigned char> rgb;
+    for (uint32_t i = 0; i < header.levelCount; i++)
+    {
+        int width = max(1u, header.pixelWidth >> i), height = max(1u, header.pixelHeight >> i);
+        const unsigned char* blocks = (const unsigned char*) file.data + levels[i].byteOffset;
+        if (compressed)
+        {
+            glCompressedTexImage2D(texture.type, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, width, height, 0,
+                                   levels[i].byteLength, blocks);
+        }
+        else
+        {
+            decodeBC1(blocks, width, height, rgb);
+            glTexImage2D(texture.type, i, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+        }
+    }
+    return true;
+}
@@ -2,163 +2,706 @@
 
 using namespace std;
 
-Mesh::Mesh(const char * path)
+static inline size_t hashCorner(const CornerKey& key, size_t mask)
 {
-    FILE *file = fopen(path, "r");
+    unsigned long long h = key.v * 0x9E3779B97F4A7C15ull;
+    h ^= (key.vt + 0x632BE59BD9B4E019ull) * 0xC2B2AE3D27D4EB4Full;
+    h ^= (key.vn + 0x165667B19E3779F9ull) * 0x85EBCA77C2B2AE63ull;
+    return (size_t)(h ^ (h >> 29)) & mask;
+}
+
+// Slots of the corner table, a power of two at least twice the corners.
+static size_t cornerTableCapacity(size_t corners)
+{
+    size_t capacity = 16;
+    while (capacity < corners * 2)
+        capacity *= 2;
+    return capacity;
+}
+
+// What indexCorners() takes from the arena after parsing a file of this many
+// corners, so the parser can reserve it up front. The table is freed last,
+// and sortByMaterial() reuses its room.
+size_t cornerArenaBytes(size_t corners)
+{
+    return cornerTableCapacity(corners) * sizeof(unsigned int) + corners * sizeof(CornerKey);
+}
 
-    if (file)
+// Gives every distinct (v, vt, vn) corner one vertex and indexes it, through
+// an open addressing table from index triples to vertex ids. keys gets the
+// triple each vertex is made from. The table comes from the keys' arena,
+// after the keys, so freeing it gives its room back.
+// --------------------------------------------------------------------------
+void indexCorners(const ObjData& data, vector<unsigned int>& indices, ArenaVector<CornerKey>& keys)
+{
+    size_t corners = data.vertexIndices.size();
+    size_t capacity = cornerTableCapacity(corners);
+
+    keys.clear();
+    keys.reserve(corners);
+    const unsigned int empty = ~0u;
+    ArenaVector<unsigned int> table(capacity, empty, keys.get_allocator());
+    indices.resize(corners);
+
+    for (size_t i = 0; i < corners; i++)
     {
-        vector< unsigned int > vertexIndices, uvIndices, normalIndices;
-        vector< glm::vec3 > temp_vertices; // v
-        vector< glm::vec2 > temp_uvs;      // vt
-        vector< glm::vec3 > temp_normals;  // vn
+        CornerKey key = { data.vertexIndices[i], data.uvIndices[i], data.normalIndices[i] };
+        size_t slot = hashCorner(key, capacity - 1);
 
-        // Read in file into temp format.
-        while (1)
+        while (table[slot] != empty)
         {
-            char lineHeader[128];
-            int res = fscanf(file, "%s", lineHeader);
-            if (res == EOF)
-            {
+            const CornerKey& other = keys[table[slot]];
+            if (other.v == key.v && other.vt == key.vt && other.vn == key.vn)
                 break;
-            }
-
-            if (strcmp(lineHeader, "v") == 0)
-            {
-                glm::vec3 vertex;
-                fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
-                temp_vertices.push_back(vertex);
+            slot = (slot + 1) & (capacity - 1);
+        }
 
-            }
-            else if (strcmp(lineHeader, "vt") == 0)
-            {
-                glm::vec2 textureCoord;
-                fscanf(file, "%f %f\n", &textureCoord.x, &textureCoord.y);
-                temp_uvs.push_back(textureCoord);
-            }
-            else if (strcmp(lineHeader, "vn") == 0)
-            {
-                glm::vec3 normal;
-                fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
-                temp_normals.push_back(normal);
-            }
-            else if (strcmp(lineHeader, "f") == 0)
-            {
-                unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-                int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-                if (matches != 9){
-                    cout << "File cannot be read\n" << endl;
-                    exit(1);
-                }
-
-                vertexIndices.push_back(vertexIndex[0] - 1);
-                vertexIndices.push_back(vertexIndex[1] - 1);
-                vertexIndices.push_back(vertexIndex[2] - 1);
-                uvIndices    .push_back(uvIndex[0] - 1);
-                uvIndices    .push_back(uvIndex[1] - 1);
-                uvIndices    .push_back(uvIndex[2] - 1);
-                normalIndices.push_back(normalIndex[0] - 1);
-                normalIndices.push_back(normalIndex[1] - 1);
-                normalIndices.push_back(normalIndex[2] - 1);
-            }
+        if (table[slot] == empty)
+        {
+            table[slot] = keys.size();
+            keys.push_back(key);
         }
+        indices[i] = table[slot];
+    }
+}
+
+// Vertex cache order within each run of one material, so the runs stay whole.
+static void optimizeByMaterial(vector<unsigned int>& indices, const vector<uint32_t>& triangleMaterials, size_t vertexCount)
+{
+    vector<unsigned int> run;
+    for (size_t first = 0; first < triangleMaterials.size();)
+    {
+        size_t last = first + 1;
+        while (last < triangleMaterials.size() && triangleMaterials[last] == triangleMaterials[first])
+            last++;
+        run.assign(indices.begin() + first * 3, indices.begin() + last * 3);
+        optimizeVertexCache(run, vertexCount);
+        copy(run.begin(), run.end(), indices.begin() + first * 3);
+        first = last;
+    }
+}
+
+// One range per run of a material in a level starting at indexOffset.
+static void appendRanges(const vector<uint32_t>& triangleMaterials, uint32_t indexOffset, vector<MeshRange>& ranges)
+{
+    for (size_t first = 0; first < triangleMaterials.size();)
+    {
+        size_t last = first + 1;
+        while (last < triangleMaterials.size() && triangleMaterials[last] == triangleMaterials[first])
+            last++;
+        MeshRange range = { indexOffset + (uint32_t) first * 3, (uint32_t)(last - first) * 3, triangleMaterials[first] };
+        ranges.push_back(range);
+        first = last;
+    }
+}
+
+Mesh::Mesh(const char * path, const MeshOptions& options) :
+    program(0), vao(0), vbo(0), ebo(0), tangentVbo(0), optimized(false), vertexFormat(options.vertexFormat), keepCpuData(options.keepCpuData),
+    lodLevels(options.lodLevels), lodReduction(options.lodReduction),
+    smoothNormals(options.smoothNormals), normalWeighting(options.normalWeighting),
+    cachedVertices(NULL), cachedIndices(NULL), cachedVertexCount(0), cachedIndexCount(0)
+{
+    if (!options.useCache || !loadCache(path, options))
+    {
+        load(path, options);
+
+        if (options.useCache && !writeCache(path))
+            cerr << "Could not write mesh cache for " << path << endl;
+    }
+
+    if (options.buildTriangleBVH)
+        triangles.build(vertexData(), indexData(), lods[0].indexCount);
+
+    // Every level uses the same vertices, the full one covers them all.
+    if (options.generateTangents)
+    {
+        tangents.resize(vertexCount());
+        computeTangents(vertexData(), vertexCount(), indexData(), lods[0].indexCount, tangents.data(), &ThreadPool::shared());
+    }
+}
+
+// Parses the .obj file and builds the indexed vertex data.
+// --------------------------------------------------------
+void Mesh::load(const char * path, const MeshOptions& options)
+{
+    // Everything up to the reshaped vertices is a temporary. With useArena
+    // those come from this thread's arena and go back in one reset, which
+    // keeps a block only on threads that set the arena's keepBytes.
+    Arena* arena = options.useArena ? &Arena::forThisThread() : NULL;
+    vector<uint32_t> triangleMaterials;
+    {
+        // Read in file into temp format.
+        ObjData data(arena);
+        loadObj(path, options.mode, data);
+
+        ArenaVector<CornerKey> keys(arena);
+        indexCorners(data, indices, keys);
+
+        sortByMaterial(data, triangleMaterials);
+        materialLibraries = data.materialLibraries;
+        vector<string> names = data.materialNames;
+        if (materials.size() > names.size())
+            names.push_back("");
+        loadMaterials(path, names);
 
         // Reshape data so opengl can use it.
-        for (int i = 0; i < vertexIndices.size(); i+=3)
+        vertices.resize(keys.size());
+        auto reshape = [&](size_t first, size_t last)
         {
-            Vertex temp_vertex;
-
-            for (int s = 0; s < 3; s++)
+            for (size_t i = first; i < last; i++)
             {
-                temp_vertex.position = temp_vertices.at(vertexIndices[s + i]);
-                temp_vertex.normal = temp_normals.at(normalIndices[s + i]);
-                temp_vertex.texCoord = temp_uvs.at(uvIndices[s + i]);
-                vertices.push_back(temp_vertex);
+                vertices[i].position = data.temp_vertices.at(keys[i].v);
+                vertices[i].normal = data.temp_normals.at(keys[i].vn);
+                vertices[i].texCoord = data.temp_uvs.at(keys[i].vt);
             }
+        };
+
+        if (options.mode == LOAD_PARALLEL)
+        {
+            const size_t batch = 64 * 1024;
+            ThreadPool::shared().parallelFor((vertices.size() + batch - 1) / batch, [&](size_t b)
+            {
+                reshape(b * batch, min((b + 1) * batch, vertices.size()));
+            });
+        }
+        else
+        {
+            reshape(0, vertices.size());
         }
     }
+    if (arena)
+        arena->reset();
 
-    else
+    if (options.optimize)
     {
-        cerr << "Cannot open " << path << endl;
+        optimizeByMaterial(indices, triangleMaterials, vertices.size());
+        optimizeVertexFetch(vertices, indices);
+        optimized = true;
+    }
+
+    // After the reorder, so each range of triangles touches few vertices.
+    if (options.smoothNormals)
+        computeNormals(vertices.data(), vertices.size(), indices.data(), indices.size(), options.normalWeighting, &ThreadPool::shared());
+
+    indexType = vertices.size() <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    bounds.min = bounds.max = vertices.empty() ? glm::vec3(0.0f) : vertices[0].position;
+    for (size_t i = 1; i < vertices.size(); i++)
+    {
+        bounds.min = glm::min(bounds.min, vertices[i].position);
+        bounds.max = glm::max(bounds.max, vertices[i].position);
+    }
+
+    sphere.center = (bounds.min + bounds.max) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        glm::vec3 offset = vertices[i].position - sphere.center;
+        radiusSquared = max(radiusSquared, glm::dot(offset, offset));
+    }
+    sphere.radius = sqrtf(radiusSquared);
+
+    generateLods(options, triangleMaterials);
+}
+
+// Groups the triangles by material, in the order the .obj first uses them.
+// Faces before its first usemtl get a default material after the named ones,
+// which materials only holds when there are such faces. triangleMaterials
+// gets the material of every triangle in the new order.
+// --------------------------------------------------------------------------
+void Mesh::sortByMaterial(const ObjData& data, vector<uint32_t>& triangleMaterials)
+{
+    size_t triangleCount = indices.size() / 3;
+    uint32_t defaultMaterial = data.materialNames.size();
+    ArenaVector<uint32_t> original(triangleCount, defaultMaterial, data.vertexIndices.get_allocator());
+    for (size_t r = 0; r < data.materialRuns.size(); r++)
+    {
+        size_t first = data.materialRuns[r].firstCorner / 3;
+        size_t last = r + 1 < data.materialRuns.size() ? data.materialRuns[r + 1].firstCorner / 3 : triangleCount;
+        fill(original.begin() + first, original.begin() + last, data.materialRuns[r].material);
+    }
+
+    // Counting sort, stable so each material's faces keep their order.
+    ArenaVector<size_t> starts(defaultMaterial + 2, 0, data.vertexIndices.get_allocator());
+    for (size_t t = 0; t < triangleCount; t++)
+        starts[original[t] + 1]++;
+    for (size_t m = 0; m + 1 < starts.size(); m++)
+        starts[m + 1] += starts[m];
+    materials.resize(starts[defaultMaterial + 1] > starts[defaultMaterial] ? defaultMaterial + 1 : defaultMaterial);
+
+    vector<unsigned int> sorted(indices.size());
+    triangleMaterials.resize(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        size_t to = starts[original[t]]++;
+        memcpy(&sorted[to * 3], &indices[t * 3], 3 * sizeof(unsigned int));
+        triangleMaterials[to] = original[t];
+    }
+    indices.swap(sorted);
+}
+
+// Looks the material names up in the libraries the .obj names, next to it.
+// Materials that are not found stay white and draw with the texture given
+// to setupBuffers, like the unnamed default one.
+// ------------------------------------------------------------------------
+void Mesh::loadMaterials(const char* objPath, const vector<string>& names)
+{
+    vector<Material> library;
+    for (size_t i = 0; i < materialLibraries.size(); i++)
+    {
+        string path = resolvePath(objPath, materialLibraries[i]);
+        if (!loadMaterialLibrary(path.c_str(), library))
+            cerr << "Could not read material library " << path << endl;
+    }
+
+    materials.assign(names.size(), Material());
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        materials[i].name = names[i];
+        if (names[i].empty())
+            continue;
+
+        size_t found = 0;
+        while (found < library.size() && library[found].name != names[i])
+            found++;
+        if (found < library.size())
+            materials[i] = library[found];
+        else if (!library.empty())
+            cerr << "Material " << names[i] << " of " << objPath << " is in none of its libraries" << endl;
+    }
+}
+
+// Appends the simplified levels to the index buffer, each about lodReduction
+// of the one before. Stops early once simplification stops making progress.
+// Materials simplify together, their borders stay where they are.
+// ---------------------------------------------------------------------------
+void Mesh::generateLods(const MeshOptions& options, const vector<uint32_t>& triangleMaterials)
+{
+    MeshLod full = { 0, (uint32_t) indices.size(), 0.0f, 0, 0 };
+    ranges.clear();
+    appendRanges(triangleMaterials, 0, ranges);
+    full.rangeCount = ranges.size();
+    lods.assign(1, full);
+
+    vector<size_t> targets;
+    size_t target = indices.size() / 3;
+    for (int level = 1; level <= options.lodLevels; level++)
+    {
+        target = (size_t)(target * options.lodReduction);
+        if (target == 0)
+            break;
+        targets.push_back(target * 3);
+    }
+
+    vector<vector<unsigned int> > levels;
+    vector<vector<uint32_t> > levelMaterials;
+    vector<float> errors;
+    simplifyMesh(vertices.data(), vertices.size(), indices.data(), indices.size(), targets, levels, errors,
+                 triangleMaterials.data(), &levelMaterials);
+
+    for (size_t level = 0; level < levels.size(); level++)
+    {
+        if (levels[level].size() > lods.back().indexCount * 0.95f)
+            break;
+        if (options.optimize)
+            optimizeByMaterial(levels[level], levelMaterials[level], vertices.size());
+
+        MeshLod lod = { (uint32_t) indices.size(), (uint32_t) levels[level].size(), errors[level], (uint32_t) ranges.size(), 0 };
+        appendRanges(levelMaterials[level], lod.indexOffset, ranges);
+        lod.rangeCount = ranges.size() - lod.firstRange;
+        indices.insert(indices.end(), levels[level].begin(), levels[level].end());
+        lods.push_back(lod);
+    }
+}
+
+Mesh::Mesh(Mesh&& other) noexcept : program(0), vao(0), vbo(0), ebo(0), tangentVbo(0)
+{
+    *this = move(other);
+}
+
+// Takes over the other mesh's buffers and data without copying vertices.
+Mesh& Mesh::operator=(Mesh&& other) noexcept
+{
+    if (this == &other)
+        return *this;
+
+    releaseBuffers();
+    vertices = move(other.vertices);
+    indices = move(other.indices);
+    tangents = move(other.tangents);
+    bounds = other.bounds;
+    sphere = other.sphere;
+    triangles = move(other.triangles);
+    lods = move(other.lods);
+    ranges = move(other.ranges);
+    materials = move(other.materials);
+    materialLibraries = move(other.materialLibraries);
+    materialTextures = move(other.materialTextures);
+    lodLevels = other.lodLevels;
+    lodReduction = other.lodReduction;
+    smoothNormals = other.smoothNormals;
+    normalWeighting = other.normalWeighting;
+    texture = move(other.texture);
+    model = other.model;
+    program = other.program;
+    vao = other.vao;
+    vbo = other.vbo;
+    ebo = other.ebo;
+    tangentVbo = other.tangentVbo;
+    indexType = other.indexType;
+    optimized = other.optimized;
+    vertexFormat = other.vertexFormat;
+    keepCpuData = other.keepCpuData;
+    modelUniform = other.modelUniform;
+    positionOffsetUniform = other.positionOffsetUniform;
+    positionScaleUniform = other.positionScaleUniform;
+    octahedralNormalsUniform = other.octahedralNormalsUniform;
+    diffuseColorUniform = other.diffuseColorUniform;
+    cacheFile = move(other.cacheFile);
+    cachedVertices = other.cachedVertices;
+    cachedIndices = other.cachedIndices;
+    cachedVertexCount = other.cachedVertexCount;
+    cachedIndexCount = other.cachedIndexCount;
+
+    other.vao = other.vbo = other.ebo = other.tangentVbo = 0;
+    return *this;
+}
+
+Mesh::~Mesh()
+{
+    releaseBuffers();
+}
+
+void Mesh::releaseBuffers()
+{
+    if (vao)
+        glDeleteVertexArrays(1, &vao);
+    if (vbo)
+        glDeleteBuffers(1, &vbo);
+    if (ebo)
+        glDeleteBuffers(1, &ebo);
+    if (tangentVbo)
+        glDeleteBuffers(1, &tangentVbo);
+    vao = vbo = ebo = tangentVbo = 0;
+}
+
+const Vertex* Mesh::vertexData() const
+{
+    return cacheFile ? cachedVertices : vertices.data();
+}
+
+size_t Mesh::vertexCount() const
+{
+    return cacheFile ? cachedVertexCount : vertices.size();
+}
+
+const unsigned int* Mesh::indexData() const
+{
+    return cacheFile ? cachedIndices : indices.data();
+}
+
+size_t Mesh::indexCount() const
+{
+    return cacheFile ? cachedIndexCount : indices.size();
+}
+
+// Prints how much indexing saved over one vertex per triangle corner, and
+// the size and error of every level of detail.
+// ------------------------------------------------------------------------
+void Mesh::printStats(const char* name) const
+{
+    size_t corners = lods[0].indexCount;
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    size_t flatBytes = corners * sizeof(Vertex);
+    size_t indexedBytes = vertexCount() * sizeof(Vertex) + corners * indexSize;
+    double ratio = vertexCount() ? (double) corners / vertexCount() : 0.0;
+
+    VertexCacheStats cache = analyzeVertexCache(indexData(), corners, vertexCount());
+
+    cout << name << ": " << corners << " corners -> " << vertexCount() << " vertices ("
+         << ratio << "x dedup), " << flatBytes / 1024 << " KB -> " << indexedBytes / 1024 << " KB, "
+         << (long long)(flatBytes - indexedBytes) / 1024 << " KB saved, ACMR " << cache.acmr
+         << ", ATVR " << cache.atvr << (optimized ? " (optimized)" : "") << endl;
+
+    if (lods[0].rangeCount > 1)
+        cout << "  " << lods[0].rangeCount << " materials, one draw each from the shared buffers" << endl;
+    for (size_t level = 1; level < lods.size(); level++)
+        cout << "  LOD " << level << ": " << lods[level].indexCount / 3 << " triangles ("
+             << 100.0 * lods[level].indexCount / corners << "%), error " << lods[level].error
+             << " (" << 100.0f * lods[level].error / sphere.radius << "% of radius)" << endl;
+}
+
+// Loads the texture from file, then uploads everything.
+void Mesh::setupBuffers(Shader& shaderProgram, const char * texturePath, int textureType) {
+    SamplerParams params;
+    params.type = textureType;
+    shared_ptr<Texture> texture = createTexture(texturePath, params);
+    if (!texture)
+    {
+        cerr << "Could not load texture!" << endl;
         exit(1);
     }
+    setupBuffers(shaderProgram, texture);
+}
 
+void Mesh::setupBuffers(Shader& shaderProgram, const Image& image, int textureType) {
+    SamplerParams params;
+    params.type = textureType;
+    setupBuffers(shaderProgram, createTexture(image, params));
 }
 
-void Mesh::setupBuffers(Shader shaderProgram, const char * texturePath, int textureType) {
+// Uploads the geometry and uses a texture that may be shared with other
+// meshes, for every material without a diffuse map of its own.
+void Mesh::setupBuffers(Shader& shaderProgram, shared_ptr<Texture> texture) {
+    this->texture = texture;
+    materialTextures.resize(materials.size());
+    program = shaderProgram.shaderProgram;
+
+    releaseBuffers();
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
 
     // Bind to vertex array.
     glBindVertexArray(vao);
 
     // Copy vertices into vertex buffer object.
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * (sizeof(glm::vec3) * 2 + sizeof(glm::vec2)), &vertices[0], GL_STATIC_DRAW);
+    if (vertexFormat == VERTEX_FLOAT)
+    {
+        // For cached meshes this reads straight out of the mapped file.
+        glBufferData(GL_ARRAY_BUFFER, vertexCount() * (sizeof(glm::vec3) * 2 + sizeof(glm::vec2)), vertexData(), GL_STATIC_DRAW);
+    }
+    else
+    {
+        vector<PackedVertex> packed;
+        packVertices(vertexData(), vertexCount(), bounds, vertexFormat, packed);
+        glBufferData(GL_ARRAY_BUFFER, packed.size() * sizeof(PackedVertex), packed.data(), GL_STATIC_DRAW);
+    }
+
+    // Copy indices into element buffer object, 16 bit when every vertex fits.
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    if (indexType == GL_UNSIGNED_SHORT)
+    {
+        vector<unsigned short> shortIndices(indexData(), indexData() + indexCount());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+    }
+    else
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount() * sizeof(unsigned int), indexData(), GL_STATIC_DRAW);
+    }
 
     // Setup attributes.
     // -----------------
-    // Position attribute.
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    if (vertexFormat == VERTEX_FLOAT)
+    {
+        // Position attribute.
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+        // Normal attribute.
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3* sizeof(float)));
+        // Texture attribute
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    }
+    else
+    {
+        // Positions in the AABB, scaled back by the shader.
+        glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*) offsetof(PackedVertex, position));
+        if (vertexFormat == VERTEX_PACKED_OCTAHEDRAL)
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*) offsetof(PackedVertex, normal));
+        else
+            glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (void*) offsetof(PackedVertex, normal));
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*) offsetof(PackedVertex, texCoord));
+    }
     glEnableVertexAttribArray(0);
-    // Color attribute (change to normal soon..).
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3* sizeof(float)));
     glEnableVertexAttribArray(1);
-    // Texture attribute
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
     glEnableVertexAttribArray(2);
 
-    // Load and create texure.
-    // -----------------------
-    setupTexture(shaderProgram, texturePath, textureType);
+    // Tangents in a buffer of their own, past the instance transform at 3 to 6.
+    if (!tangents.empty())
+    {
+        glGenBuffers(1, &tangentVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, tangentVbo);
+        glBufferData(GL_ARRAY_BUFFER, tangents.size() * sizeof(glm::vec4), tangents.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(7, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*) 0);
+        glEnableVertexAttribArray(7);
+    }
+
+    // Set texture uniform for the shader to use.
+    // -----------------------------------------
+    shaderProgram.use();
+    shaderProgram.setSampler(shaderProgram.uniform("diffuse"), 0);
+
+    // Resolve the uniforms draw() sets every frame.
+    modelUniform = shaderProgram.uniform("model");
+    positionOffsetUniform = shaderProgram.uniform("positionOffset");
+    positionScaleUniform = shaderProgram.uniform("positionScale");
+    octahedralNormalsUniform = shaderProgram.uniform("octahedralNormals");
+    diffuseColorUniform = shaderProgram.uniform("diffuseColor");
 
     // Set up model transformation to identity matrix.
     model = glm::mat4(1.0f);
+
+    // The GPU has its own copy now.
+    if (!keepCpuData)
+    {
+        vector<Vertex>().swap(vertices);
+        vector<unsigned int>().swap(indices);
+        vector<glm::vec4>().swap(tangents);
+        cacheFile.reset();
+        cachedVertexCount = cachedIndexCount = 0;
+    }
 }
 
-void Mesh::draw(Shader shaderProgram) {
+// Diffuse maps of the materials, shared through the cache. Materials whose
+// map cannot be loaded keep the texture given to setupBuffers.
+void Mesh::loadMaterialTextures(TextureCache& textures) {
+    materialTextures.resize(materials.size());
+    for (size_t i = 0; i < materials.size(); i++)
+    {
+        if (materials[i].diffuseMap.empty() || materialTextures[i])
+            continue;
+        materialTextures[i] = textures.acquire(compressedTexturePath(materials[i].diffuseMap));
+        if (!materialTextures[i])
+            cerr << "Could not load texture " << materials[i].diffuseMap << " of material " << materials[i].name << endl;
+    }
+}
+
+const Texture& Mesh::materialTexture(uint32_t material) const {
+    return material < materialTextures.size() && materialTextures[material] ? *materialTextures[material] : *texture;
+}
+
+void Mesh::draw(Shader& shaderProgram) {
     // Send matrices to vertex shader.
-    unsigned int modelLoc = glGetUniformLocation(shaderProgram.shaderProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    shaderProgram.setMat4(modelUniform, model);
+
+    bind(shaderProgram);
+    drawRanges(shaderProgram, 0);
+}
+
+// One draw per material of level 0, all from the vertex array bind() bound.
+// instanceCount copies of each when it is not zero.
+void Mesh::drawRanges(Shader& shaderProgram, size_t instanceCount) {
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    const Texture* bound = NULL;
+    for (size_t i = lods[0].firstRange; i < lods[0].firstRange + lods[0].rangeCount; i++)
+    {
+        const MeshRange& range = ranges[i];
+        const Texture& rangeTexture = materialTexture(range.material);
+        if (&rangeTexture != bound)
+        {
+            glBindTexture(rangeTexture.type, rangeTexture.id);
+            bound = &rangeTexture;
+        }
+        shaderProgram.setVec3(diffuseColorUniform, materials[range.material].diffuse);
+
+        void* offset = (void*)(range.indexOffset * indexSize);
+        if (instanceCount)
+            glDrawElementsInstanced(GL_TRIANGLES, range.indexCount, indexType, offset, instanceCount);
+        else
+            glDrawElements(GL_TRIANGLES, range.indexCount, indexType, offset);
+    }
+}
+
+// Binds the vertex array and tells the shader how to decode this mesh's vertex format.
+void Mesh::bind(Shader& shaderProgram) {
+    glm::vec3 offset(0.0f), scale(1.0f);
+    if (vertexFormat != VERTEX_FLOAT)
+        positionTransform(bounds, offset, scale);
+    shaderProgram.setVec3(positionOffsetUniform, offset);
+    shaderProgram.setVec3(positionScaleUniform, scale);
+    shaderProgram.setInt(octahedralNormalsUniform, vertexFormat == VERTEX_PACKED_OCTAHEDRAL);
 
-    glBindTexture(texture.type, texture.id);
     glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, vertices.size());
-}
-
-// Loads texture from specified file and set up for usage.
-void Mesh::setupTexture(Shader shaderProgram, const char * texturePath, int textureType) {
-    texture.type = textureType;
-    glGenTextures(1, &(texture.id));
-    glBindTexture(texture.type, texture.id);
-    // Set wrapping parameters.
-    glTexParameteri(texture.type, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(texture.type, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // Set filtering parameters.
-    glTexParameteri(texture.type, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(texture.type, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    // Load texture image.
-    int tex_width, tex_height, nrChannels;
-    stbi_set_flip_vertically_on_load(true);
-    unsigned char *data = stbi_load(texturePath, &tex_width, &tex_height, &nrChannels, 0);
-
-    // If texture loaded successfuly then generate mipmaps.
-    if (data)
-    {
-        glTexImage2D(texture.type, 0, GL_RGB, tex_width, tex_height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(texture.type);
+}
+
+// Coarsest level whose error stays within settings.maxPixelError on screen,
+// measured at the nearest point of the bounding sphere.
+size_t Mesh::selectLod(const glm::mat4& view, const LodSettings& settings) const {
+    if (settings.screenScale <= 0.0f || lods.size() < 2)
+        return 0;
+
+    BoundingSphere world = worldSphere();
+    float scale = sphere.radius > 0.0f ? world.radius / sphere.radius : 1.0f;
+    glm::vec3 center = glm::vec3(view * glm::vec4(world.center, 1.0f));
+    float distance = glm::length(center) - world.radius;
+    if (distance <= 0.0f)
+        return 0;
+
+    size_t level = 0;
+    while (level + 1 < lods.size() && lods[level + 1].error * scale * settings.screenScale / distance <= settings.maxPixelError)
+        level++;
+    return level;
+}
+
+// Queues one draw per material of the level of detail, sorted by the mesh's
+// distance along the view direction. They share the vertex array, so the
+// queue binds it once for all of them.
+void Mesh::submit(RenderQueue& queue, const glm::mat4& view, const LodSettings& settings) const {
+    const MeshLod& level = lods[selectLod(view, settings)];
+    glm::vec4 center = view * model[3];
+    for (size_t i = level.firstRange; i < level.firstRange + level.rangeCount; i++)
+    {
+        DrawItem item = drawItem(ranges[i]);
+        item.modelUniform = modelUniform;
+        item.model = model;
+        queue.submit(item, -center.z);
     }
-    else
+}
+
+// Bounding sphere moved by the model matrix. Scaling grows the radius by
+// the longest axis, so it stays conservative for non uniform scales.
+BoundingSphere Mesh::worldSphere() const {
+    BoundingSphere world;
+    world.center = glm::vec3(model * glm::vec4(sphere.center, 1.0f));
+    float scale = max(glm::length(glm::vec3(model[0])), max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    world.radius = sphere.radius * scale;
+    return world;
+}
+
+// AABB of the mesh after the model matrix, around its eight moved corners.
+AABB Mesh::worldBounds() const {
+    AABB world;
+    for (int i = 0; i < 8; i++)
     {
-        cerr << "Could not load texture!" << endl;
-        exit(1);
+        glm::vec3 corner((i & 1) ? bounds.max.x : bounds.min.x, (i & 2) ? bounds.max.y : bounds.min.y, (i & 4) ? bounds.max.z : bounds.min.z);
+        glm::vec3 moved = glm::vec3(model * glm::vec4(corner, 1.0f));
+        world.min = i ? glm::min(world.min, moved) : moved;
+        world.max = i ? glm::max(world.max, moved) : moved;
     }
-    stbi_image_free(data);
+    return world;
+}
 
-    // Set texture uniform for the shader to use.
-    shaderProgram.use();
-    shaderProgram.setInt("texture", 0);
+// Nearest triangle hit by a world space ray, needs MeshOptions::buildTriangleBVH.
+// The ray goes into model space unnormalized, so distances stay world distances.
+bool Mesh::raycast(const Ray& ray, float maxDistance, TriangleHit& hit) const {
+    glm::mat4 inverse = glm::inverse(model);
+    Ray local;
+    local.origin = glm::vec3(inverse * glm::vec4(ray.origin, 1.0f));
+    local.direction = glm::vec3(inverse * glm::vec4(ray.direction, 0.0f));
+    return triangles.intersect(local, maxDistance, hit);
+}
+
+// The state and uniforms bind() would set, for the render queue.
+DrawItem Mesh::drawItem(const MeshRange& range) const {
+    const Texture& rangeTexture = materialTexture(range.material);
+    DrawItem item;
+    item.program = program;
+    item.texture = rangeTexture.id;
+    item.textureType = rangeTexture.type;
+    item.vertexArray = vao;
+    item.indexType = indexType;
+    item.indexCount = range.indexCount;
+    item.indexOffset = range.indexOffset;
+    item.diffuseColorUniform = diffuseColorUniform;
+    item.diffuseColor = materials[range.material].diffuse;
+
+    item.positionOffsetUniform = positionOffsetUniform;
+    item.positionScaleUniform = positionScaleUniform;
+    item.octahedralNormalsUniform = octahedralNormalsUniform;
+    if (vertexFormat != VERTEX_FLOAT)
+        positionTransform(bounds, item.positionOffset, item.positionScale);
+    item.octahedralNormals = vertexFormat == VERTEX_PACKED_OCTAHEDRAL;
+    return item;
 }
 
 void Mesh::translate(glm::vec3 direction)
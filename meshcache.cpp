@@ -0,0 +1,266 @@
+#include "Application.hpp"
+
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Binary mesh cache, written next to the .obj as "<name>.obj.cache".
+// Layout: MeshCacheHeader, Vertex[vertexCount], uint32 index[indexCount],
+// MeshLod[lodCount], MeshRange[rangeCount], then the material library paths
+// and material names as null terminated strings. The indices hold every
+// level of detail. Materials are read from their libraries again on load,
+// so editing a .mtl does not need a new cache.
+// The vertex array is uploaded straight from the mapping, so it is stored
+// exactly as Vertex is laid out in memory on the machine that wrote it.
+
+static const char cacheMagic[4] = { 'O', 'B', 'J', 'C' };
+static const uint32_t cacheVersion = 6;
+
+// Bits in MeshCacheHeader::flags.
+static const uint32_t cacheOptimized = 1;
+static const uint32_t cacheSmoothNormals = 2;   // Normals from computeNormals(),
+static const uint32_t cacheAngleWeighted = 4;   // weighted by NORMALS_ANGLE.
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexSize;    // sizeof(Vertex) when written.
+    uint32_t indexType;     // GL type used for the element buffer.
+    uint32_t flags;         // Processing applied after parsing.
+    float sphereRadius;     // Bounding sphere around the AABB centre.
+    uint64_t sourceSize;    // Size, time and content hash of the .obj it was built from.
+    int64_t sourceTime;
+    uint64_t sourceHash;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    float boundsMin[3];
+    float boundsMax[3];
+    int32_t lodLevels;      // MeshOptions it was generated with, and the levels that came out.
+    float lodReduction;
+    uint32_t lodCount;
+    uint32_t rangeCount;
+    uint32_t libraryCount;
+    uint32_t materialCount;
+    uint64_t stringBytes;   // Libraries and names, terminators included.
+};
+
+static string cachePath(const char* objPath)
+{
+    return string(objPath) + ".cache";
+}
+
+// Name of the file one writer fills before renaming it over the cache. It
+// carries the process and thread, so writers of the same .obj at once do not
+// truncate each other's file.
+static string temporaryPath(const string& path)
+{
+#ifdef _WIN32
+    int process = _getpid();
+#else
+    int process = getpid();
+#endif
+    size_t thread = hash<std::thread::id>()(this_thread::get_id());
+    return path + ".tmp." + to_string(process) + "." + to_string(thread);
+}
+
+// FNV-1a over the whole source file.
+static uint64_t hashFile(const char* path)
+{
+    MappedFile file(path);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < file.size; i++)
+    {
+        hash ^= (unsigned char) file.data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool sourceInfo(const char* path, uint64_t& size, int64_t& time)
+{
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return false;
+    size = (uint64_t) info.st_size;
+    time = (int64_t) info.st_mtime;
+    return true;
+}
+
+// Overwrites the source time in the header of an existing cache.
+static void storeSourceTime(const char* objPath, int64_t time)
+{
+    FILE* file = fopen(cachePath(objPath).c_str(), "r+b");
+    if (!file)
+        return;
+    if (fseek(file, offsetof(MeshCacheHeader, sourceTime), SEEK_SET) == 0)
+        fwrite(&time, sizeof(time), 1, file);
+    fclose(file);
+}
+
+// Maps the cache for objPath if it exists and still matches the source.
+// A changed modification time alone (e.g. after a checkout) falls back to
+// comparing content hashes before the cache is thrown away, and if they
+// match the new time is stored so the next load does not hash again.
+// -----------------------------------------------------------------------
+bool Mesh::loadCache(const char* objPath, const MeshOptions& options)
+{
+    uint64_t size;
+    int64_t time;
+    if (!sourceInfo(objPath, size, time))
+        return false;
+
+    shared_ptr<MappedFile> file(new MappedFile(cachePath(objPath).c_str()));
+    if (!file->isOpen() || file->size < sizeof(MeshCacheHeader))
+        return false;
+
+    const MeshCacheHeader* header = (const MeshCacheHeader*) file->data;
+    if (memcmp(header->magic, cacheMagic, 4) != 0 || header->version != cacheVersion ||
+        header->vertexSize != sizeof(Vertex) || header->sourceSize != size)
+        return false;
+
+    // A cache baked with different processing is as stale as an old one.
+    if (((header->flags & cacheOptimized) != 0) != options.optimize ||
+        ((header->flags & cacheSmoothNormals) != 0) != options.smoothNormals ||
+        (options.smoothNormals && ((header->flags & cacheAngleWeighted) != 0) != (options.normalWeighting == NORMALS_ANGLE)) ||
+        header->lodLevels != options.lodLevels || (options.lodLevels && header->lodReduction != options.lodReduction))
+        return false;
+
+    if (header->vertexCount > (file->size - sizeof(MeshCacheHeader)) / sizeof(Vertex) || header->lodCount == 0 ||
+        sizeof(MeshCacheHeader) + header->vertexCount * sizeof(Vertex) + header->indexCount * sizeof(uint32_t) +
+        header->lodCount * sizeof(MeshLod) + header->rangeCount * sizeof(MeshRange) + header->stringBytes != file->size)
+        return false;
+
+    bool retimed = header->sourceTime != time;
+    if (retimed && header->sourceHash != hashFile(objPath))
+        return false;
+
+    const char* data = file->data + sizeof(MeshCacheHeader) + header->vertexCount * sizeof(Vertex);
+    const MeshLod* cachedLods = (const MeshLod*)(data + header->indexCount * sizeof(uint32_t));
+    const MeshRange* cachedRanges = (const MeshRange*)(cachedLods + header->lodCount);
+    const char* strings = (const char*)(cachedRanges + header->rangeCount);
+    const char* stringsEnd = strings + header->stringBytes;
+
+    // An index past the vertices would have the GPU read outside the buffer.
+    const uint32_t* indices = (const uint32_t*) data;
+    uint32_t maxIndex = 0;
+    for (uint64_t i = 0; i < header->indexCount; i++)
+        maxIndex = max(maxIndex, indices[i]);
+    if (header->indexCount && maxIndex >= header->vertexCount)
+        return false;
+
+    vector<string> names;
+    for (const char* p = strings; p < stringsEnd; p += names.back().size() + 1)
+    {
+        const char* terminator = (const char*) memchr(p, '\0', stringsEnd - p);
+        if (!terminator)
+            return false;
+        names.push_back(string(p, terminator));
+    }
+    if (names.size() != (size_t) header->libraryCount + header->materialCount)
+        return false;
+
+    vector<MeshRange> cachedRangeList(cachedRanges, cachedRanges + header->rangeCount);
+    for (size_t i = 0; i < cachedRangeList.size(); i++)
+        if (cachedRangeList[i].material >= header->materialCount ||
+            (uint64_t) cachedRangeList[i].indexOffset + cachedRangeList[i].indexCount > header->indexCount)
+            return false;
+    for (uint32_t i = 0; i < header->lodCount; i++)
+        if ((uint64_t) cachedLods[i].firstRange + cachedLods[i].rangeCount > header->rangeCount)
+            return false;
+
+    cacheFile = file;
+    cachedVertexCount = header->vertexCount;
+    cachedIndexCount = header->indexCount;
+    cachedVertices = (const Vertex*)(file->data + sizeof(MeshCacheHeader));
+    cachedIndices = (const unsigned int*)(cachedVertices + cachedVertexCount);
+    lods.assign(cachedLods, cachedLods + header->lodCount);
+    ranges.swap(cachedRangeList);
+    materialLibraries.assign(names.begin(), names.begin() + header->libraryCount);
+    loadMaterials(objPath, vector<string>(names.begin() + header->libraryCount, names.end()));
+    indexType = header->indexType;
+    optimized = (header->flags & cacheOptimized) != 0;
+    bounds.min = glm::vec3(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]);
+    bounds.max = glm::vec3(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]);
+    sphere.center = (bounds.min + bounds.max) * 0.5f;
+    sphere.radius = header->sphereRadius;
+    if (retimed)
+        storeSourceTime(objPath, time);
+    return true;
+}
+
+// Writes the cache for objPath. The file is written under a temporary name
+// of its own and renamed so a reader never maps a half written cache.
+// ------------------------------------------------------------------------
+bool Mesh::writeCache(const char* objPath) const
+{
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, 4);
+    header.version = cacheVersion;
+    header.vertexSize = sizeof(Vertex);
+    header.indexType = indexType;
+    header.flags = optimized ? cacheOptimized : 0;
+    if (smoothNormals)
+        header.flags |= cacheSmoothNormals | (normalWeighting == NORMALS_ANGLE ? cacheAngleWeighted : 0);
+    if (!sourceInfo(objPath, header.sourceSize, header.sourceTime))
+        return false;
+    header.sourceHash = hashFile(objPath);
+    header.vertexCount = vertexCount();
+    header.indexCount = indexCount();
+    header.sphereRadius = sphere.radius;
+    header.lodLevels = lodLevels;
+    header.lodReduction = lodReduction;
+    header.lodCount = lods.size();
+    header.rangeCount = ranges.size();
+    header.libraryCount = materialLibraries.size();
+    header.materialCount = materials.size();
+
+    string strings;
+    for (size_t i = 0; i < materialLibraries.size(); i++)
+        strings.append(materialLibraries[i].c_str(), materialLibraries[i].size() + 1);
+    for (size_t i = 0; i < materials.size(); i++)
+        strings.append(materials[i].name.c_str(), materials[i].name.size() + 1);
+    header.stringBytes = strings.size();
+
+    for (int i = 0; i < 3; i++)
+    {
+        header.boundsMin[i] = bounds.min[i];
+        header.boundsMax[i] = bounds.max[i];
+    }
+
+    string path = cachePath(objPath);
+    string temporary = temporaryPath(path);
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (ok && vertexCount())
+        ok = fwrite(vertexData(), sizeof(Vertex), vertexCount(), file) == vertexCount();
+    if (ok && indexCount())
+        ok = fwrite(indexData(), sizeof(uint32_t), indexCount(), file) == indexCount();
+    if (ok)
+        ok = fwrite(lods.data(), sizeof(MeshLod), lods.size(), file) == lods.size();
+    if (ok && !ranges.empty())
+        ok = fwrite(ranges.data(), sizeof(MeshRange), ranges.size(), file) == ranges.size();
+    if (ok && !strings.empty())
+        ok = fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    ok = (fclose(file) == 0) && ok;
+
+    if (ok)
+    {
+        // rename() does not replace an existing file on Windows.
+        remove(path.c_str());
+        ok = rename(temporary.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+        remove(temporary.c_str());
+    return ok;
+}
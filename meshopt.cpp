@@ -0,0 +1,188 @@
+#include "Application.hpp"
+
+using namespace std;
+
+// Post transform cache size assumed by the optimizer and the stats.
+static const int cacheSize = 32;
+
+// Simulates a FIFO post transform cache over the index buffer.
+// ACMR is cache misses per triangle (0.5 is ideal on a regular grid, 3 the
+// worst), ATVR is misses per unique vertex (1.0 is ideal).
+// -------------------------------------------------------------------------
+VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount)
+{
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if (indexCount < 3 || vertexCount == 0)
+        return stats;
+
+    // timestamps[v] is the miss counter value when v entered the cache.
+    vector<size_t> timestamps(vertexCount, 0);
+    size_t misses = 0;
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        unsigned int v = indices[i];
+        if (timestamps[v] == 0 || misses - timestamps[v] >= (size_t) cacheSize)
+        {
+            misses++;
+            timestamps[v] = misses;
+        }
+    }
+
+    vector<char> used(vertexCount, 0);
+    size_t unique = 0;
+    for (size_t i = 0; i < indexCount; i++)
+        if (!used[indices[i]])
+        {
+            used[indices[i]] = 1;
+            unique++;
+        }
+
+    stats.acmr = (float) misses / (indexCount / 3);
+    stats.atvr = (float) misses / unique;
+    return stats;
+}
+
+// Score of a vertex, after Forsyth's "Linear-Speed Vertex Cache Optimisation".
+static float vertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 3)
+        score = powf(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+    else if (cachePosition >= 0)
+        // The last triangle's vertices get a fixed score so it is not picked again right away.
+        score = 0.75f;
+
+    // Prefer finishing off vertices with few triangles left.
+    return score + 2.0f * powf((float) remainingTriangles, -0.5f);
+}
+
+// Reorders triangles so vertices are reused while still in the post transform cache.
+// -----------------------------------------------------------------------------------
+void optimizeVertexCache(vector<unsigned int>& indices, size_t vertexCount)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // Triangle adjacency per vertex, in compressed rows.
+    vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < indices.size(); i++)
+        offsets[indices[i] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] += offsets[v];
+
+    vector<unsigned int> adjacency(indices.size());
+    vector<unsigned int> remaining(vertexCount, 0);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        unsigned int v = indices[i];
+        adjacency[offsets[v] + remaining[v]++] = i / 3;
+    }
+
+    vector<float> scores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        scores[v] = vertexScore(-1, remaining[v]);
+
+    vector<char> emitted(triangleCount, 0);
+    vector<unsigned int> output;
+    output.reserve(indices.size());
+
+    // Simulated LRU cache, with room for the three vertices pushed in front.
+    vector<unsigned int> cache, nextCache;
+    cache.reserve(cacheSize + 3);
+    nextCache.reserve(cacheSize + 3);
+
+    size_t scanPosition = 0;
+    long long best = -1;
+
+    while (output.size() < indices.size())
+    {
+        // Nothing in the cache to continue from, take the next unused triangle.
+        if (best < 0)
+        {
+            while (emitted[scanPosition])
+                scanPosition++;
+            best = scanPosition;
+        }
+
+        emitted[best] = 1;
+        unsigned int* triangle = &indices[best * 3];
+        nextCache.clear();
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int v = triangle[k];
+            output.push_back(v);
+            nextCache.push_back(v);
+
+            // Drop the triangle from the vertex's list of remaining triangles.
+            unsigned int* begin = &adjacency[offsets[v]];
+            unsigned int* end = begin + remaining[v];
+            *find(begin, end, (unsigned int) best) = end[-1];
+            remaining[v]--;
+        }
+        for (size_t i = 0; i < cache.size(); i++)
+        {
+            unsigned int v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        }
+
+        // Vertices pushed out of the cache lose their position score.
+        for (size_t i = cacheSize; i < nextCache.size(); i++)
+            scores[nextCache[i]] = vertexScore(-1, remaining[nextCache[i]]);
+        if (nextCache.size() > (size_t) cacheSize)
+            nextCache.resize(cacheSize);
+        cache.swap(nextCache);
+
+        for (size_t i = 0; i < cache.size(); i++)
+            scores[cache[i]] = vertexScore(i, remaining[cache[i]]);
+
+        // Rescore triangles touching the cache and pick the best for the next step.
+        best = -1;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cache.size(); i++)
+        {
+            unsigned int v = cache[i];
+            for (unsigned int j = offsets[v]; j < offsets[v] + remaining[v]; j++)
+            {
+                unsigned int t = adjacency[j];
+                float score = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+    }
+
+    indices.swap(output);
+}
+
+// Renumbers vertices in the order the index buffer first uses them, so vertex
+// fetches walk the buffer mostly linearly.
+// ---------------------------------------------------------------------------
+void optimizeVertexFetch(vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+    const unsigned int unused = ~0u;
+    vector<unsigned int> remap(vertices.size(), unused);
+    vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        unsigned int& target = remap[indices[i]];
+        if (target == unused)
+        {
+            target = reordered.size();
+            reordered.push_back(vertices[indices[i]]);
+        }
+        indices[i] = target;
+    }
+
+    vertices.swap(reordered);
+}
@@ -0,0 +1,316 @@
+#include "Application.hpp"
+
+using namespace std;
+
+// Streamed mesh file, what FileMeshSink writes. Layout: MeshStreamHeader,
+// then per chunk a MeshStreamChunk followed by its Vertex[vertexCount],
+// uint32 index[indexCount] and MeshRange[rangeCount], then the material
+// names as null terminated strings. The totals in the header are filled in
+// by finish(), so a GPU buffer can be sized before the chunks are read back.
+
+static const char streamMagic[4] = { 'O', 'B', 'J', 'S' };
+static const uint32_t streamVersion = 1;
+
+struct MeshStreamHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexSize;    // sizeof(Vertex) when written.
+    uint32_t materialCount;
+    uint64_t vertexCount;   // Of all chunks together.
+    uint64_t indexCount;
+    uint64_t chunkCount;
+    uint64_t stringBytes;   // Material names, terminators included.
+};
+
+struct MeshStreamChunk
+{
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t rangeCount;
+    uint32_t reserved;
+};
+
+// One range per run of a material over the window's triangles. Runs that go
+// on with the material before them are merged into it.
+static void windowRanges(const ObjData& window, vector<MeshRange>& ranges)
+{
+    ranges.clear();
+    size_t corners = window.vertexIndices.size();
+    for (size_t r = 0; r <= window.materialRuns.size(); r++)
+    {
+        size_t first = r == 0 ? 0 : window.materialRuns[r - 1].firstCorner;
+        size_t last = r < window.materialRuns.size() ? window.materialRuns[r].firstCorner : corners;
+        uint32_t material = r == 0 ? ~0u : window.materialRuns[r - 1].material;
+        if (last <= first)
+            continue;
+        if (!ranges.empty() && ranges.back().material == material)
+        {
+            ranges.back().indexCount += last - first;
+            continue;
+        }
+        MeshRange range = { (uint32_t) first, (uint32_t)(last - first), material };
+        ranges.push_back(range);
+    }
+}
+
+// Reads path a window at a time and hands each to the sink as a chunk with
+// vertices of its own, so about memoryBudget bytes are held however large
+// the file is. See ObjStreamReader for how the budget is split.
+// ----------------------------------------------------------------------
+bool streamMesh(const char* path, MeshSink& sink, size_t memoryBudget, MeshStreamStats& stats)
+{
+    stats = MeshStreamStats();
+    ObjStreamReader reader(path, memoryBudget);
+    if (!reader.isOpen())
+    {
+        cerr << "Cannot open " << path << endl;
+        return false;
+    }
+
+    ObjData window;
+    vector<unsigned int> indices;
+    ArenaVector<CornerKey> keys;
+    vector<Vertex> vertices;
+    vector<MeshRange> ranges;
+
+    while (reader.next(window))
+    {
+        indexCorners(window, indices, keys);
+        vertices.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            vertices[i].position = window.temp_vertices[keys[i].v];
+            vertices[i].normal = window.temp_normals[keys[i].vn];
+            vertices[i].texCoord = window.temp_uvs[keys[i].vt];
+        }
+        windowRanges(window, ranges);
+
+        MeshChunk chunk = { vertices.data(), vertices.size(), indices.data(), indices.size(),
+                            ranges.data(), ranges.size(), stats.vertices, stats.indices };
+        if (!sink.write(chunk))
+        {
+            cerr << "Could not write the mesh streamed from " << path << endl;
+            return false;
+        }
+        stats.vertices += vertices.size();
+        stats.indices += indices.size();
+        stats.chunks++;
+    }
+
+    stats.bytes = reader.bytesRead();
+    stats.attributeMisses = reader.attributeMisses();
+    stats.materialLibraries = reader.materialLibraries;
+    stats.materialNames = reader.materialNames;
+    if (reader.failed())
+    {
+        cerr << path << " cannot be read past byte " << stats.bytes << endl;
+        return false;
+    }
+    if (!sink.finish(reader.materialNames))
+    {
+        cerr << "Could not write the mesh streamed from " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+FileMeshSink::FileMeshSink(const char* path) : file(fopen(path, "wb")), vertexCount(0), indexCount(0), chunkCount(0)
+{
+    MeshStreamHeader header;
+    memset(&header, 0, sizeof(header));
+    if (file && fwrite(&header, sizeof(header), 1, file) != 1)
+    {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+FileMeshSink::~FileMeshSink()
+{
+    if (file)
+        fclose(file);
+}
+
+bool FileMeshSink::write(const MeshChunk& chunk)
+{
+    if (!file)
+        return false;
+
+    MeshStreamChunk header = { (uint32_t) chunk.vertexCount, (uint32_t) chunk.indexCount, (uint32_t) chunk.rangeCount, 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (ok && chunk.vertexCount)
+        ok = fwrite(chunk.vertices, sizeof(Vertex), chunk.vertexCount, file) == chunk.vertexCount;
+    if (ok && chunk.indexCount)
+        ok = fwrite(chunk.indices, sizeof(uint32_t), chunk.indexCount, file) == chunk.indexCount;
+    if (ok && chunk.rangeCount)
+        ok = fwrite(chunk.ranges, sizeof(MeshRange), chunk.rangeCount, file) == chunk.rangeCount;
+
+    vertexCount += chunk.vertexCount;
+    indexCount += chunk.indexCount;
+    chunkCount++;
+    return ok;
+}
+
+// Appends the names and goes back to fill in the header.
+bool FileMeshSink::finish(const vector<string>& materialNames)
+{
+    if (!file)
+        return false;
+
+    string strings;
+    for (size_t i = 0; i < materialNames.size(); i++)
+        strings.append(materialNames[i].c_str(), materialNames[i].size() + 1);
+
+    MeshStreamHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, streamMagic, 4);
+    header.version = streamVersion;
+    header.vertexSize = sizeof(Vertex);
+    header.materialCount = materialNames.size();
+    header.vertexCount = vertexCount;
+    header.indexCount = indexCount;
+    header.chunkCount = chunkCount;
+    header.stringBytes = strings.size();
+
+    bool ok = strings.empty() || fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = (fclose(file) == 0) && ok;
+    file = NULL;
+    return ok;
+}
+
+static bool readStreamHeader(FILE* file, MeshStreamHeader& header)
+{
+    return fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, streamMagic, 4) == 0 &&
+           header.version == streamVersion && header.vertexSize == sizeof(Vertex);
+}
+
+// Totals of a file FileMeshSink finished, for sizing buffers before replaying it.
+bool readMeshStreamTotals(const char* path, uint64_t& vertexCount, uint64_t& indexCount)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    MeshStreamHeader header;
+    bool ok = readStreamHeader(file, header);
+    fclose(file);
+
+    vertexCount = ok ? header.vertexCount : 0;
+    indexCount = ok ? header.indexCount : 0;
+    return ok;
+}
+
+// Feeds a FileMeshSink file to another sink a chunk at a time, holding no
+// more than the largest chunk.
+// ------------------------------------------------------------------------
+bool replayMeshStream(const char* path, MeshSink& sink)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    MeshStreamHeader header;
+    bool ok = readStreamHeader(file, header);
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<MeshRange> ranges;
+    uint64_t firstVertex = 0, firstIndex = 0;
+
+    for (uint64_t c = 0; ok && c < header.chunkCount; c++)
+    {
+        MeshStreamChunk counts;
+        ok = fread(&counts, sizeof(counts), 1, file) == 1;
+        if (!ok)
+            break;
+        vertices.resize(counts.vertexCount);
+        indices.resize(counts.indexCount);
+        ranges.resize(counts.rangeCount);
+        ok = fread(vertices.data(), sizeof(Vertex), vertices.size(), file) == vertices.size() &&
+             fread(indices.data(), sizeof(uint32_t), indices.size(), file) == indices.size() &&
+             fread(ranges.data(), sizeof(MeshRange), ranges.size(), file) == ranges.size();
+        for (size_t i = 0; ok && i < indices.size(); i++)
+            ok = indices[i] < vertices.size();
+        for (size_t r = 0; ok && r < ranges.size(); r++)
+            ok = (uint64_t) ranges[r].indexOffset + ranges[r].indexCount <= indices.size();
+        if (!ok)
+            break;
+
+        MeshChunk chunk = { vertices.data(), vertices.size(), indices.data(), indices.size(),
+                            ranges.data(), ranges.size(), firstVertex, firstIndex };
+        ok = sink.write(chunk);
+        firstVertex += vertices.size();
+        firstIndex += indices.size();
+    }
+
+    vector<string> names;
+    if (ok && header.stringBytes)
+    {
+        string strings(header.stringBytes, '\0');
+        ok = fread(&strings[0], 1, strings.size(), file) == strings.size() && strings.back() == '\0';
+        for (size_t start = 0; ok && start < strings.size(); start = strings.find('\0', start) + 1)
+            names.push_back(strings.c_str() + start);
+        ok = ok && names.size() == header.materialCount;
+    }
+    fclose(file);
+    return ok && sink.finish(names);
+}
+
+GLBufferMeshSink::GLBufferMeshSink(uint64_t vertexCapacity, uint64_t indexCapacity) :
+    vao(0), vbo(0), ebo(0), vertexCapacity(vertexCapacity), indexCapacity(indexCapacity), verticesWritten(0), indicesWritten(0)
+{
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexCapacity * sizeof(Vertex), NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity * sizeof(uint32_t), NULL, GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, position));
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, normal));
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, texCoord));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+}
+
+GLBufferMeshSink::~GLBufferMeshSink()
+{
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+}
+
+bool GLBufferMeshSink::write(const MeshChunk& chunk)
+{
+    if (verticesWritten + chunk.vertexCount > vertexCapacity || indicesWritten + chunk.indexCount > indexCapacity)
+    {
+        cerr << "Streamed mesh does not fit its buffers of " << vertexCapacity << " vertices and "
+             << indexCapacity << " indices" << endl;
+        return false;
+    }
+
+    rebased.resize(chunk.indexCount);
+    for (size_t i = 0; i < chunk.indexCount; i++)
+        rebased[i] = chunk.indices[i] + (unsigned int) verticesWritten;
+    for (size_t r = 0; r < chunk.rangeCount; r++)
+    {
+        MeshRange range = chunk.ranges[r];
+        range.indexOffset += (uint32_t) indicesWritten;
+        ranges.push_back(range);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, verticesWritten * sizeof(Vertex), chunk.vertexCount * sizeof(Vertex), chunk.vertices);
+    glBindVertexArray(vao);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesWritten * sizeof(uint32_t), chunk.indexCount * sizeof(uint32_t), rebased.data());
+    glBindVertexArray(0);
+
+    verticesWritten += chunk.vertexCount;
+    indicesWritten += chunk.indexCount;
+    return true;
+}
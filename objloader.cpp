@@ -0,0 +1,1263 @@
+#include "Application.hpp"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Maps the whole file read-only into memory.
+// ------------------------------------------
+MappedFile::MappedFile(const char* path) : data(NULL), size(0)
+{
+#ifdef _WIN32
+    fileHandle = mappingHandle = NULL;
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    fileHandle = file;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        return;
+    size = (size_t) fileSize.QuadPart;
+
+    mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle == NULL)
+        return;
+    data = (const char*) MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void* mapping = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            data = (const char*) mapping;
+            size = (size_t) info.st_size;
+            // The parser walks the file front to back exactly once.
+            madvise(mapping, size, MADV_SEQUENTIAL);
+        }
+    }
+    // The mapping keeps its own reference to the file.
+    close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data)
+        UnmapViewOfFile(data);
+    if (mappingHandle)
+        CloseHandle(mappingHandle);
+    if (fileHandle)
+        CloseHandle(fileHandle);
+#else
+    if (data)
+        munmap((void*) data, size);
+#endif
+}
+
+// Tokenizer helpers. All of them stop at 'end' since the mapping is not null terminated.
+// ---------------------------------------------------------------------------------------
+static inline const char* skipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+static inline const char* skipLine(const char* p, const char* end)
+{
+    const char* newline = (const char*) memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+static inline bool isDigit(char c)
+{
+    return (unsigned char)(c - '0') < 10;
+}
+
+// Whether the line at p starts with keyword and a blank.
+static inline bool isKeyword(const char* p, const char* end, const char* keyword, size_t length)
+{
+    return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+}
+
+// The rest of the line without surrounding blanks, for names and paths that may contain spaces.
+static string restOfLine(const char* p, const char* end)
+{
+    p = skipSpaces(p, end);
+    if (p >= end)
+        return string();
+    const char* last = (const char*) memchr(p, '\n', end - p);
+    if (!last)
+        last = end;
+    while (last > p && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+        last--;
+    return string(p, last);
+}
+
+// Parses a decimal float without going through the C locale machinery.
+// Returns NULL if no number starts at p.
+static const char* parseFloat(const char* p, const char* end, float& out)
+{
+    static const double powers[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    p = skipSpaces(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+
+    unsigned long long mantissa = 0;
+    int digits = 0, exponent = 0;
+    const char* start = p;
+
+    // Keep the first 19 significant digits, the rest only shift the exponent.
+    for (; p < end && isDigit(*p); p++)
+    {
+        if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) digits++; }
+        else exponent++;
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && isDigit(*p); p++)
+        {
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); exponent--; if (mantissa) digits++; }
+        }
+    }
+    if (p == start || (p == start + 1 && *start == '.'))
+        return NULL;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        const char* q = p + 1;
+        bool negativeExp = false;
+        if (q < end && (*q == '-' || *q == '+'))
+        {
+            negativeExp = (*q == '-');
+            q++;
+        }
+        if (q < end && isDigit(*q))
+        {
+            int e = 0;
+            for (; q < end && isDigit(*q); q++)
+                if (e < 10000) e = e * 10 + (*q - '0');
+            exponent += negativeExp ? -e : e;
+            p = q;
+        }
+    }
+
+    double value = (double) mantissa;
+    if (exponent < 0)
+        value = (exponent >= -22) ? value / powers[-exponent] : value * pow(10.0, exponent);
+    else if (exponent > 0)
+        value = (exponent <= 22) ? value * powers[exponent] : value * pow(10.0, exponent);
+
+    out = (float)(negative ? -value : value);
+    return p;
+}
+
+// Reads up to count floats into out, missing trailing ones are 0 so a short
+// record like "vt u" still takes its place in the index numbering.
+static void parseFloats(const char* p, const char* end, float* out, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (p)
+            p = parseFloat(p, end, out[i]);
+        if (!p)
+            out[i] = 0.0f;
+    }
+}
+
+// Parses a signed decimal integer. Returns NULL if no digits were found.
+static const char* parseInt(const char* p, const char* end, int& out)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p >= end || !isDigit(*p))
+        return NULL;
+
+    int value = 0;
+    for (; p < end && isDigit(*p); p++)
+        value = value * 10 + (*p - '0');
+    out = negative ? -value : value;
+    return p;
+}
+
+// Indices the tokenizer stores for what a face corner leaves out, until
+// completeFaces() fills them in.
+static const unsigned int noIndex = ~0u;                // vt, or vn outside a smoothing group
+static const unsigned int smoothNormal = ~0u - 1;       // vn inside a smoothing group
+static const unsigned int inheritedNormal = ~0u - 2;    // vn before a chunk's first "s" line
+
+enum Smoothing
+{
+    SMOOTHING_OFF,      // "s off" or "s 0", also the default.
+    SMOOTHING_ON,
+    SMOOTHING_INHERITED // Whatever the previous chunk ended with.
+};
+
+// Face of more than three corners, fanned into count - 2 triangles starting
+// at firstCorner of the index arrays.
+struct ObjPolygon
+{
+    size_t firstCorner;
+    unsigned int count;
+};
+
+// What parsing a range leaves for the passes after it.
+struct ObjParseState
+{
+    ObjParseState(Smoothing smoothing = SMOOTHING_OFF) : smoothing(smoothing), missingUvs(false), missingNormals(false) {}
+
+    Smoothing smoothing;
+    bool missingUvs, missingNormals;
+    std::vector<ObjPolygon> polygons;
+    // Corners with negative indices, resolved against the counts of this
+    // range only: their place in the index arrays, and bits 1, 2, 4 for v, vt, vn.
+    std::vector<std::pair<size_t, unsigned char> > relative;
+};
+
+// 1-based or negative (counted back from the last one read) to 0-based.
+static inline bool resolveIndex(int value, size_t count, unsigned int& index, unsigned char bit, unsigned char& relative)
+{
+    if (value > 0)
+        index = value - 1;
+    else if (value < 0)
+    {
+        index = (unsigned int) count + value;
+        relative |= bit;
+    }
+    else
+        return false;
+    return true;
+}
+
+// Parses one "v/vt/vn" face corner, the form of the fast path.
+static inline const char* parseFullCorner(const char* p, const char* end, int& v, int& vt, int& vn)
+{
+    p = skipSpaces(p, end);
+    if (!(p = parseInt(p, end, v)) || p >= end || *p != '/')
+        return NULL;
+    if (!(p = parseInt(p + 1, end, vt)) || p >= end || *p != '/')
+        return NULL;
+    return parseInt(p + 1, end, vn);
+}
+
+// Parses one "v", "v/vt", "v//vn" or "v/vt/vn" face corner. What it leaves
+// out stays at noIndex, given has bits 2 and 4 set for a vt and a vn.
+// A relative index may equal noIndex until it is fixed up, so only given tells.
+static const char* parseCorner(const char* p, const char* end, const ObjData& data, unsigned int index[3],
+                               unsigned char& given, unsigned char& relative)
+{
+    int value;
+    given = 1;
+    relative = 0;
+    index[1] = index[2] = noIndex;
+    if (!(p = parseInt(p, end, value)) || !resolveIndex(value, data.temp_vertices.size(), index[0], 1, relative))
+        return NULL;
+    if (p >= end || *p != '/')
+        return p;
+
+    p++;
+    if (p < end && *p != '/')
+    {
+        if (!(p = parseInt(p, end, value)) || !resolveIndex(value, data.temp_uvs.size(), index[1], 2, relative))
+            return NULL;
+        given |= 2;
+    }
+    if (p >= end || *p != '/')
+        return p;
+
+    if (!(p = parseInt(p + 1, end, value)) || !resolveIndex(value, data.temp_normals.size(), index[2], 4, relative))
+        return NULL;
+    given |= 4;
+    return p;
+}
+
+static inline void emitCorner(ObjData& data, ObjParseState& state, const unsigned int index[3], unsigned char relative)
+{
+    if (relative)
+        state.relative.push_back(make_pair(data.vertexIndices.size(), relative));
+    data.vertexIndices.push_back(index[0]);
+    data.uvIndices    .push_back(index[1]);
+    data.normalIndices.push_back(index[2]);
+}
+
+// Reads a face of any form and size after the "f". Corner 0 and the
+// previous corner make a triangle with each new one. Kept out of
+// parseRange() so its loop stays small for the common case.
+// ----------------------------------------------------------------------
+static bool parseFace(const char* p, const char* end, ObjData& data, ObjParseState& state)
+{
+    unsigned int first[3], previous[3], corner[3];
+    unsigned char firstRelative = 0, previousRelative = 0, given, relative;
+    size_t firstCorner = data.vertexIndices.size();
+    unsigned int count = 0;
+
+    while (1)
+    {
+        p = skipSpaces(p, end);
+        if (p >= end || *p == '\n' || *p == '#')
+            break;
+        if (!(p = parseCorner(p, end, data, corner, given, relative)))
+            return false;
+
+        if (!(given & 2))
+            state.missingUvs = true;
+        if (!(given & 4))
+        {
+            state.missingNormals = true;
+            if (state.smoothing != SMOOTHING_OFF)
+                corner[2] = state.smoothing == SMOOTHING_ON ? smoothNormal : inheritedNormal;
+        }
+
+        if (count == 0)
+        {
+            memcpy(first, corner, sizeof(first));
+            firstRelative = relative;
+        }
+        else if (count >= 2)
+        {
+            emitCorner(data, state, first, firstRelative);
+            emitCorner(data, state, previous, previousRelative);
+            emitCorner(data, state, corner, relative);
+        }
+        memcpy(previous, corner, sizeof(previous));
+        previousRelative = relative;
+        count++;
+    }
+
+    if (count < 3)
+        return false;
+    if (count > 3)
+    {
+        ObjPolygon polygon = { firstCorner, count };
+        state.polygons.push_back(polygon);
+    }
+    return true;
+}
+
+// Index of name in names, added at the end if it is not there yet.
+static unsigned int nameIndex(vector<string>& names, const string& name)
+{
+    for (size_t i = 0; i < names.size(); i++)
+        if (names[i] == name)
+            return i;
+    names.push_back(name);
+    return names.size() - 1;
+}
+
+// Tokenizes a range of an .obj file held in memory. Faces are fanned into
+// triangles as they are read, completeFaces() finishes them.
+// -------------------------------------------------------------------------
+static bool parseRange(const char* begin, const char* end, ObjData& data, ObjParseState& state)
+{
+    const char* p = begin;
+
+    while (p < end)
+    {
+        p = skipSpaces(p, end);
+        if (p >= end)
+            break;
+
+        if (p[0] == 'v' && p + 1 < end)
+        {
+            if (p[1] == ' ' || p[1] == '\t')
+            {
+                glm::vec3 vertex;
+                parseFloats(p + 2, end, &vertex.x, 3);
+                data.temp_vertices.push_back(vertex);
+            }
+            else if (p[1] == 't')
+            {
+                glm::vec2 textureCoord;
+                parseFloats(p + 2, end, &textureCoord.x, 2);
+                data.temp_uvs.push_back(textureCoord);
+            }
+            else if (p[1] == 'n')
+            {
+                glm::vec3 normal;
+                parseFloats(p + 2, end, &normal.x, 3);
+                data.temp_normals.push_back(normal);
+            }
+        }
+        else if (p[0] == 'f' && p + 1 < end && (p[1] == ' ' || p[1] == '\t'))
+        {
+            // Most files are all triangles with every attribute and positive
+            // indices, those go straight in.
+            int v[3], vt[3], vn[3];
+            const char* q = p + 1;
+            for (int s = 0; s < 3 && q; s++)
+                if ((q = parseFullCorner(q, end, v[s], vt[s], vn[s])) && (v[s] <= 0 || vt[s] <= 0 || vn[s] <= 0))
+                    q = NULL;
+            if (q)
+                q = skipSpaces(q, end);
+            if (q && (q >= end || *q == '\n' || *q == '#'))
+            {
+                for (int s = 0; s < 3; s++)
+                {
+                    data.vertexIndices.push_back(v[s] - 1);
+                    data.uvIndices    .push_back(vt[s] - 1);
+                    data.normalIndices.push_back(vn[s] - 1);
+                }
+                p = skipLine(q, end);
+                continue;
+            }
+
+            // Anything else is read again corner by corner.
+            if (!parseFace(p + 1, end, data, state))
+                return false;
+        }
+        else if (p[0] == 's' && p + 1 < end && (p[1] == ' ' || p[1] == '\t'))
+        {
+            const char* q = skipSpaces(p + 1, end);
+            bool off = (end - q >= 3 && memcmp(q, "off", 3) == 0) ||
+                       (q < end && *q == '0' && (q + 1 >= end || !isDigit(q[1])));
+            state.smoothing = off ? SMOOTHING_OFF : SMOOTHING_ON;
+        }
+        else if (isKeyword(p, end, "usemtl", 6))
+        {
+            ObjMaterialRun run = { data.vertexIndices.size(), nameIndex(data.materialNames, restOfLine(p + 6, end)) };
+            data.materialRuns.push_back(run);
+        }
+        else if (isKeyword(p, end, "mtllib", 6))
+        {
+            // Taken as one path, names with spaces are more common than several libraries on a line.
+            string library = restOfLine(p + 6, end);
+            if (!library.empty())
+                nameIndex(data.materialLibraries, library);
+        }
+
+        // Comments, groups and anything unsupported are skipped.
+        p = skipLine(p, end);
+    }
+
+    return true;
+}
+
+static inline float cross2(const glm::vec2& a, const glm::vec2& b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+// Counter-clockwise triangle, points on its edges count as inside.
+static inline bool insideTriangle(const glm::vec2& p, const glm::vec2& a, const glm::vec2& b, const glm::vec2& c)
+{
+    return cross2(b - a, p - a) >= 0.0f && cross2(c - b, p - b) >= 0.0f && cross2(a - c, p - c) >= 0.0f;
+}
+
+// The fans are right for convex polygons. Concave ones are redone with ear
+// clipping, in place since both give count - 2 triangles. Each polygon is
+// projected along the dominant axis of its Newell normal.
+// -------------------------------------------------------------------------
+static bool triangulatePolygons(ObjData& data, const vector<ObjPolygon>& polygons)
+{
+    vector<unsigned int> corners[3];
+    vector<glm::vec2> points;
+    vector<unsigned int> remaining;
+
+    for (size_t i = 0; i < polygons.size(); i++)
+    {
+        const ObjPolygon& polygon = polygons[i];
+        size_t n = polygon.count;
+
+        // Fan triangle k is (0, k + 1, k + 2), so its last corner is the next polygon corner.
+        for (int a = 0; a < 3; a++)
+            corners[a].resize(n);
+        for (size_t k = 0; k < n; k++)
+        {
+            size_t at = polygon.firstCorner + (k < 3 ? k : 3 * (k - 2) + 2);
+            corners[0][k] = data.vertexIndices[at];
+            corners[1][k] = data.uvIndices[at];
+            corners[2][k] = data.normalIndices[at];
+            if (corners[0][k] >= data.temp_vertices.size())
+                return false;
+        }
+
+        glm::vec3 normal(0.0f);
+        for (size_t k = 0; k < n; k++)
+        {
+            const glm::vec3& current = data.temp_vertices[corners[0][k]];
+            const glm::vec3& next = data.temp_vertices[corners[0][(k + 1) % n]];
+            normal += glm::vec3((current.y - next.y) * (current.z + next.z),
+                                (current.z - next.z) * (current.x + next.x),
+                                (current.x - next.x) * (current.y + next.y));
+        }
+        glm::vec3 magnitude = glm::abs(normal);
+        int axis = (magnitude.x > magnitude.y && magnitude.x > magnitude.z) ? 0 : (magnitude.y > magnitude.z ? 1 : 2);
+        // The two other axes in cyclic order, so the polygon winds counter-clockwise.
+        int u = (axis + 1) % 3, v = (axis + 2) % 3;
+        float flip = normal[axis] < 0.0f ? -1.0f : 1.0f;
+
+        points.resize(n);
+        for (size_t k = 0; k < n; k++)
+        {
+            const glm::vec3& position = data.temp_vertices[corners[0][k]];
+            points[k] = glm::vec2(position[u] * flip, position[v]);
+        }
+
+        bool convex = true;
+        for (size_t k = 0; k < n && convex; k++)
+            convex = cross2(points[(k + 1) % n] - points[k], points[(k + 2) % n] - points[(k + 1) % n]) >= 0.0f;
+        if (convex)
+            continue;
+
+        remaining.resize(n);
+        for (size_t k = 0; k < n; k++)
+            remaining[k] = k;
+
+        size_t out = polygon.firstCorner;
+        auto emit = [&](unsigned int a, unsigned int b, unsigned int c)
+        {
+            unsigned int triangle[3] = { a, b, c };
+            for (int k = 0; k < 3; k++, out++)
+            {
+                data.vertexIndices[out] = corners[0][triangle[k]];
+                data.uvIndices[out] = corners[1][triangle[k]];
+                data.normalIndices[out] = corners[2][triangle[k]];
+            }
+        };
+
+        while (remaining.size() > 3)
+        {
+            size_t m = remaining.size(), ear = 0;
+            bool found = false;
+            for (size_t k = 0; k < m && !found; k++)
+            {
+                unsigned int a = remaining[(k + m - 1) % m], b = remaining[k], c = remaining[(k + 1) % m];
+                if (cross2(points[b] - points[a], points[c] - points[b]) <= 0.0f)
+                    continue;
+
+                found = true;
+                for (size_t r = 0; r < m && found; r++)
+                {
+                    unsigned int other = remaining[r];
+                    if (other != a && other != b && other != c && insideTriangle(points[other], points[a], points[b], points[c]))
+                        found = false;
+                }
+                ear = k;
+            }
+            // Self intersecting or degenerate, clip anything so the triangle count stays right.
+            if (!found)
+                ear = 0;
+
+            emit(remaining[(ear + m - 1) % m], remaining[ear], remaining[(ear + 1) % m]);
+            remaining.erase(remaining.begin() + ear);
+        }
+        emit(remaining[0], remaining[1], remaining[2]);
+    }
+    return true;
+}
+
+static inline glm::vec3 normalizeOr(const glm::vec3& v, const glm::vec3& fallback)
+{
+    float length = glm::length(v);
+    return length > 0.0f ? v / length : fallback;
+}
+
+// Normals for corners without vn: the area weighted average of the faces
+// around the position inside a smoothing group, the face normal outside one.
+// ---------------------------------------------------------------------------
+static bool generateNormals(ObjData& data)
+{
+    const glm::vec3 up(0.0f, 0.0f, 1.0f);
+    vector<glm::vec3> sums;
+    vector<unsigned int> smoothIndex;
+
+    for (size_t i = 0; i + 2 < data.vertexIndices.size(); i += 3)
+    {
+        unsigned int* normals = &data.normalIndices[i];
+        if (normals[0] < smoothNormal && normals[1] < smoothNormal && normals[2] < smoothNormal)
+            continue;
+
+        const unsigned int* vertices = &data.vertexIndices[i];
+        if (vertices[0] >= data.temp_vertices.size() || vertices[1] >= data.temp_vertices.size() || vertices[2] >= data.temp_vertices.size())
+            return false;
+        const glm::vec3& a = data.temp_vertices[vertices[0]];
+        glm::vec3 face = glm::cross(data.temp_vertices[vertices[1]] - a, data.temp_vertices[vertices[2]] - a);
+
+        unsigned int flat = noIndex;
+        for (int k = 0; k < 3; k++)
+        {
+            if (normals[k] == noIndex)
+            {
+                if (flat == noIndex)
+                {
+                    flat = data.temp_normals.size();
+                    data.temp_normals.push_back(normalizeOr(face, up));
+                }
+                normals[k] = flat;
+            }
+            else if (normals[k] == smoothNormal)
+            {
+                if (sums.empty())
+                    sums.resize(data.temp_vertices.size(), glm::vec3(0.0f));
+                sums[vertices[k]] += face;
+            }
+        }
+    }
+
+    if (sums.empty())
+        return true;
+
+    smoothIndex.resize(sums.size(), noIndex);
+    for (size_t i = 0; i < data.normalIndices.size(); i++)
+    {
+        if (data.normalIndices[i] != smoothNormal)
+            continue;
+        unsigned int& index = smoothIndex[data.vertexIndices[i]];
+        if (index == noIndex)
+        {
+            index = data.temp_normals.size();
+            data.temp_normals.push_back(normalizeOr(sums[data.vertexIndices[i]], up));
+        }
+        data.normalIndices[i] = index;
+    }
+    return true;
+}
+
+// Triangulates concave polygons and fills in missing attributes, so the
+// indices only point at real data. Files of triangles with every attribute
+// have nothing to do here.
+// -------------------------------------------------------------------------
+static bool completeFaces(ObjData& data, const ObjParseState& state)
+{
+    if (!triangulatePolygons(data, state.polygons))
+        return false;
+
+    if (state.missingUvs)
+    {
+        unsigned int zero = data.temp_uvs.size();
+        data.temp_uvs.push_back(glm::vec2(0.0f));
+        for (size_t i = 0; i < data.uvIndices.size(); i++)
+            if (data.uvIndices[i] == noIndex)
+                data.uvIndices[i] = zero;
+    }
+
+    return !state.missingNormals || generateNormals(data);
+}
+
+// Arena bytes of a load with these many attributes and corners: the arrays,
+// what indexing the corners takes after, and alignment padding.
+static size_t loadArenaBytes(size_t v, size_t vt, size_t vn, size_t corners)
+{
+    return (v + vn) * sizeof(glm::vec3) + vt * sizeof(glm::vec2) + corners * 3 * sizeof(unsigned int) +
+        cornerArenaBytes(corners) + 256;
+}
+
+// Reserves the arrays for a range of an .obj from the lines in a few samples
+// spread over it, scaled up to its length with some slack, so they are
+// allocated once. Short ranges are counted whole. Faces count as
+// triangles, files of larger polygons grow the index arrays once more.
+// With an arena all of it, and the corner indexing after, takes one block.
+// ----------------------------------------------------------------------------
+static void reserveEstimate(const char* begin, const char* end, ObjData& data)
+{
+    const size_t sampleCount = 64, sampleSize = 1024;
+    size_t size = end - begin, sampled = 0;
+    size_t v = 0, vt = 0, vn = 0, f = 0;
+    bool whole = size <= sampleCount * sampleSize;
+
+    for (size_t s = 0; s < (whole ? 1 : sampleCount); s++)
+    {
+        const char* p = begin + size / sampleCount * s;
+        if (p > begin)
+            p = skipLine(p - 1, end);
+        const char* first = p;
+        const char* last = whole ? end : p + min(sampleSize, (size_t)(end - p));
+        while (p < last)
+        {
+            if (p[0] == 'v' && p + 1 < end)
+            {
+                v += p[1] == ' ' || p[1] == '\t';
+                vt += p[1] == 't';
+                vn += p[1] == 'n';
+            }
+            else
+                f += p[0] == 'f';
+            p = skipLine(p, end);
+        }
+        sampled += p - first;
+    }
+    if (sampled == 0)
+        return;
+
+    double scale = whole ? 1.0 : 1.05 * size / sampled;
+    v = data.temp_vertices.size() + (size_t)(v * scale);
+    vt = data.temp_uvs.size() + (size_t)(vt * scale);
+    vn = data.temp_normals.size() + (size_t)(vn * scale);
+    size_t corners = data.vertexIndices.size() + (size_t)(f * scale) * 3;
+
+    Arena* arena = data.vertexIndices.get_allocator().arena;
+    if (arena)
+        arena->reserve(loadArenaBytes(v, vt, vn, corners));
+    data.temp_vertices.reserve(v);
+    data.temp_uvs.reserve(vt);
+    data.temp_normals.reserve(vn);
+    data.vertexIndices.reserve(corners);
+    data.uvIndices.reserve(corners);
+    data.normalIndices.reserve(corners);
+}
+
+// Pointer based parser for a whole .obj file held in memory. Takes faces of
+// any size with or without vt and vn, and negative indices.
+// -------------------------------------------------------------------------
+bool parseObj(const char* begin, const char* end, ObjData& data)
+{
+    ObjParseState state;
+    reserveEstimate(begin, end, data);
+    return parseRange(begin, end, data, state) && completeFaces(data, state);
+}
+
+// Copies every chunk's array into one, each at the prefix sum of the sizes before it.
+template <typename T>
+static void concatenate(vector<ObjData>& chunks, ArenaVector<T> ObjData::* member, ArenaVector<T>& out, ThreadPool& pool)
+{
+    vector<size_t> offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); i++)
+        offsets[i + 1] = offsets[i] + (chunks[i].*member).size();
+
+    out.resize(offsets.back());
+    pool.parallelFor(chunks.size(), [&](size_t i)
+    {
+        ArenaVector<T>& part = chunks[i].*member;
+        if (!part.empty())
+            memcpy(&out[offsets[i]], &part[0], part.size() * sizeof(T));
+        ArenaVector<T>().swap(part);
+    });
+}
+
+// Splits the file at line boundaries and parses the pieces on the pool.
+// Positive face indices in .obj files are global, so chunks can be parsed
+// independently and concatenated in file order. Negative indices, material
+// numbers and the smoothing state at the start of a chunk are then fixed up
+// from the chunks before it, giving the same result as parseObj.
+// ----------------------------------------------------------------------------
+bool parseObjParallel(const char* begin, const char* end, ObjData& data, ThreadPool& pool)
+{
+    // Small files are not worth the hand-off.
+    const size_t minChunkSize = 256 * 1024;
+    size_t size = end - begin;
+    size_t chunkCount = min((size_t) pool.size() * 4, size / minChunkSize);
+    if (chunkCount <= 1)
+        return parseObj(begin, end, data);
+
+    vector<const char*> bounds(chunkCount + 1);
+    bounds[0] = begin;
+    bounds[chunkCount] = end;
+    for (size_t i = 1; i < chunkCount; i++)
+        bounds[i] = max(bounds[i - 1], skipLine(begin + size / chunkCount * i, end));
+
+    vector<ObjData> chunks(chunkCount);
+    vector<ObjParseState> states(chunkCount, ObjParseState(SMOOTHING_INHERITED));
+    states[0].smoothing = SMOOTHING_OFF;
+    vector<char> parsed(chunkCount, 0);
+    pool.parallelFor(chunkCount, [&](size_t i)
+    {
+        reserveEstimate(bounds[i], bounds[i + 1], chunks[i]);
+        parsed[i] = parseRange(bounds[i], bounds[i + 1], chunks[i], states[i]);
+    });
+
+    for (size_t i = 0; i < chunkCount; i++)
+        if (!parsed[i])
+            return false;
+
+    // Where each chunk's corners and attributes start once concatenated.
+    vector<size_t> corners(chunkCount), vertices(chunkCount), uvs(chunkCount), normals(chunkCount);
+    for (size_t i = 1; i < chunkCount; i++)
+    {
+        corners[i] = corners[i - 1] + chunks[i - 1].vertexIndices.size();
+        vertices[i] = vertices[i - 1] + chunks[i - 1].temp_vertices.size();
+        uvs[i] = uvs[i - 1] + chunks[i - 1].temp_uvs.size();
+        normals[i] = normals[i - 1] + chunks[i - 1].temp_normals.size();
+    }
+
+    size_t last = chunkCount - 1;
+    Arena* arena = data.vertexIndices.get_allocator().arena;
+    if (arena)
+        arena->reserve(loadArenaBytes(vertices[last] + chunks[last].temp_vertices.size(), uvs[last] + chunks[last].temp_uvs.size(),
+                                      normals[last] + chunks[last].temp_normals.size(), corners[last] + chunks[last].vertexIndices.size()));
+    concatenate(chunks, &ObjData::temp_vertices, data.temp_vertices, pool);
+    concatenate(chunks, &ObjData::temp_uvs, data.temp_uvs, pool);
+    concatenate(chunks, &ObjData::temp_normals, data.temp_normals, pool);
+    concatenate(chunks, &ObjData::vertexIndices, data.vertexIndices, pool);
+    concatenate(chunks, &ObjData::uvIndices, data.uvIndices, pool);
+    concatenate(chunks, &ObjData::normalIndices, data.normalIndices, pool);
+
+    ObjParseState merged;
+    Smoothing smoothing = SMOOTHING_OFF;
+    for (size_t i = 0; i < chunkCount; i++)
+    {
+        const ObjParseState& state = states[i];
+        for (size_t r = 0; r < state.relative.size(); r++)
+        {
+            size_t at = corners[i] + state.relative[r].first;
+            unsigned char relative = state.relative[r].second;
+            if (relative & 1) data.vertexIndices[at] += vertices[i];
+            if (relative & 2) data.uvIndices[at] += uvs[i];
+            if (relative & 4) data.normalIndices[at] += normals[i];
+        }
+
+        if (state.missingNormals && i > 0)
+        {
+            unsigned int carried = smoothing == SMOOTHING_ON ? smoothNormal : noIndex;
+            size_t last = i + 1 < chunkCount ? corners[i + 1] : data.normalIndices.size();
+            for (size_t c = corners[i]; c < last; c++)
+                if (data.normalIndices[c] == inheritedNormal)
+                    data.normalIndices[c] = carried;
+        }
+        if (state.smoothing != SMOOTHING_INHERITED)
+            smoothing = state.smoothing;
+
+        for (size_t k = 0; k < state.polygons.size(); k++)
+        {
+            ObjPolygon polygon = state.polygons[k];
+            polygon.firstCorner += corners[i];
+            merged.polygons.push_back(polygon);
+        }
+        merged.missingUvs |= state.missingUvs;
+        merged.missingNormals |= state.missingNormals;
+
+        // Material names are numbered per chunk, runs move to the merged numbering.
+        const ObjData& chunk = chunks[i];
+        for (size_t k = 0; k < chunk.materialLibraries.size(); k++)
+            nameIndex(data.materialLibraries, chunk.materialLibraries[k]);
+        for (size_t k = 0; k < chunk.materialRuns.size(); k++)
+        {
+            ObjMaterialRun run = chunk.materialRuns[k];
+            run.firstCorner += corners[i];
+            run.material = nameIndex(data.materialNames, chunk.materialNames[run.material]);
+            data.materialRuns.push_back(run);
+        }
+    }
+
+    return completeFaces(data, merged);
+}
+
+// Original fscanf based parser, kept as a reference for correctness and benchmarking.
+// Only reads triangles given as v/vt/vn.
+// -----------------------------------------------------------------------------------
+bool parseObjFile(FILE* file, ObjData& data)
+{
+    while (1)
+    {
+        char lineHeader[128];
+        int res = fscanf(file, "%127s", lineHeader);
+        if (res == EOF)
+        {
+            break;
+        }
+
+        if (strcmp(lineHeader, "v") == 0)
+        {
+            glm::vec3 vertex;
+            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z);
+            data.temp_vertices.push_back(vertex);
+        }
+        else if (strcmp(lineHeader, "vt") == 0)
+        {
+            glm::vec2 textureCoord;
+            fscanf(file, "%f %f\n", &textureCoord.x, &textureCoord.y);
+            data.temp_uvs.push_back(textureCoord);
+        }
+        else if (strcmp(lineHeader, "vn") == 0)
+        {
+            glm::vec3 normal;
+            fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z);
+            data.temp_normals.push_back(normal);
+        }
+        else if (strcmp(lineHeader, "f") == 0)
+        {
+            unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
+            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
+            if (matches != 9)
+                return false;
+
+            for (int s = 0; s < 3; s++)
+            {
+                data.vertexIndices.push_back(vertexIndex[s] - 1);
+                data.uvIndices    .push_back(uvIndex[s] - 1);
+                data.normalIndices.push_back(normalIndex[s] - 1);
+            }
+        }
+    }
+
+    return true;
+}
+
+// Reads an .obj file with the requested parser, exits on failure like the rest of the app.
+// ----------------------------------------------------------------------------------------
+void loadObj(const char* path, LoadMode mode, ObjData& data)
+{
+    bool ok;
+
+    if (mode == LOAD_FSCANF)
+    {
+        FILE *file = fopen(path, "r");
+        if (!file)
+        {
+            cerr << "Cannot open " << path << endl;
+            exit(1);
+        }
+        ok = parseObjFile(file, data);
+        fclose(file);
+    }
+    else
+    {
+        MappedFile file(path);
+        if (!file.isOpen())
+        {
+            cerr << "Cannot open " << path << endl;
+            exit(1);
+        }
+        if (mode == LOAD_PARALLEL)
+            ok = parseObjParallel(file.data, file.data + file.size, data, ThreadPool::shared());
+        else
+            ok = parseObj(file.data, file.data + file.size, data);
+    }
+
+    if (!ok)
+    {
+        cout << "File cannot be read\n" << endl;
+        exit(1);
+    }
+}
+
+// Seeks with 64 bit offsets, long is 32 bits on Windows.
+static int seekFile(FILE* file, uint64_t offset, int origin)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (__int64) offset, origin);
+#else
+    return fseeko(file, (off_t) offset, origin);
+#endif
+}
+
+// The file is deleted when it is closed, or when the process ends.
+AttributeSpill::AttributeSpill(size_t elementSize, size_t recentCount) :
+    misses(0), file(tmpfile()), elementSize(elementSize), recentCount(max(recentCount, (size_t) 1)), count(0), atEnd(true)
+{
+}
+
+AttributeSpill::~AttributeSpill()
+{
+    if (file)
+        fclose(file);
+}
+
+bool AttributeSpill::append(const void* values, size_t newCount)
+{
+    if (!file)
+        return false;
+    if (newCount == 0)
+        return true;
+    if (!atEnd && seekFile(file, 0, SEEK_END) != 0)
+        return false;
+    atEnd = true;
+    if (fwrite(values, elementSize, newCount, file) != newCount)
+        return false;
+
+    // The ring grows to its full size exactly, never past it.
+    size_t ringBytes = min(count + newCount, (uint64_t) recentCount) * elementSize;
+    if (recent.size() < ringBytes)
+    {
+        if (recent.capacity() < ringBytes)
+            recent.reserve(min(max(ringBytes, recent.capacity() * 2), recentCount * elementSize));
+        recent.resize(ringBytes);
+    }
+    const char* bytes = (const char*) values;
+    for (size_t i = newCount > recentCount ? newCount - recentCount : 0; i < newCount; i++)
+        memcpy(&recent[((count + i) % recentCount) * elementSize], bytes + i * elementSize, elementSize);
+    count += newCount;
+    return true;
+}
+
+bool AttributeSpill::read(uint64_t index, void* value)
+{
+    if (index >= count)
+        return false;
+    if (count - index <= recentCount)
+    {
+        memcpy(value, &recent[(index % recentCount) * elementSize], elementSize);
+        return true;
+    }
+
+    misses++;
+    atEnd = false;
+    return seekFile(file, index * elementSize, SEEK_SET) == 0 && fread(value, elementSize, 1, file) == 1;
+}
+
+// A quarter of the budget keeps recent attributes, shared evenly by the
+// three kinds. The window is small next to what its faces turn into.
+ObjStreamReader::ObjStreamReader(const char* path, size_t memoryBudget) :
+    file(fopen(path, "rb")), buffered(0), offset(0),
+    positions(sizeof(glm::vec3), memoryBudget / 4 / (2 * sizeof(glm::vec3) + sizeof(glm::vec2))),
+    uvs(sizeof(glm::vec2), memoryBudget / 4 / (2 * sizeof(glm::vec3) + sizeof(glm::vec2))),
+    normals(sizeof(glm::vec3), memoryBudget / 4 / (2 * sizeof(glm::vec3) + sizeof(glm::vec2))),
+    smoothing(false), material(~0u), error(false)
+{
+    buffer.resize(max(memoryBudget / 64, (size_t) 64 * 1024));
+}
+
+ObjStreamReader::~ObjStreamReader()
+{
+    if (file)
+        fclose(file);
+}
+
+// Replaces the file wide indices of one attribute with indices into values,
+// which gets a copy of every value they use. Indices from firstMarker up
+// are left for completeFaces() to fill in.
+// -------------------------------------------------------------------------
+template <typename T>
+static bool gatherAttribute(ArenaVector<unsigned int>& indices, AttributeSpill& spill, ArenaVector<T>& values, uint64_t firstMarker)
+{
+    size_t capacity = 16;
+    while (capacity < indices.size() * 2)
+        capacity *= 2;
+    vector<unsigned int> table(capacity, noIndex), used;
+    values.clear();
+
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        unsigned int index = indices[i];
+        if (index >= firstMarker)
+            continue;
+
+        size_t slot = (size_t)(index * 0x9E3779B97F4A7C15ull >> 32) & (capacity - 1);
+        while (table[slot] != noIndex && used[table[slot]] != index)
+            slot = (slot + 1) & (capacity - 1);
+        if (table[slot] == noIndex)
+        {
+            T value;
+            if (!spill.read(index, &value))
+                return false;
+            table[slot] = values.size();
+            used.push_back(index);
+            values.push_back(value);
+        }
+        indices[i] = table[slot];
+    }
+    return true;
+}
+
+// Parses a window of whole lines into window, carrying what the .obj format
+// lets lines depend on (attribute counts, smoothing, the material) over
+// from the windows before it.
+// ----------------------------------------------------------------------------
+bool ObjStreamReader::parseWindow(const char* begin, const char* end, ObjData& window)
+{
+    window.temp_vertices.clear();
+    window.temp_uvs.clear();
+    window.temp_normals.clear();
+    window.vertexIndices.clear();
+    window.uvIndices.clear();
+    window.normalIndices.clear();
+    window.materialLibraries.clear();
+    window.materialNames.clear();
+    window.materialRuns.clear();
+
+    ObjParseState state(smoothing ? SMOOTHING_ON : SMOOTHING_OFF);
+    if (!parseRange(begin, end, window, state))
+        return false;
+    smoothing = state.smoothing == SMOOTHING_ON;
+
+    // Negative indices were counted back from the end of this window.
+    for (size_t r = 0; r < state.relative.size(); r++)
+    {
+        size_t at = state.relative[r].first;
+        unsigned char relative = state.relative[r].second;
+        if (relative & 1) window.vertexIndices[at] += positions.size();
+        if (relative & 2) window.uvIndices[at] += uvs.size();
+        if (relative & 4) window.normalIndices[at] += normals.size();
+    }
+
+    if (!positions.append(window.temp_vertices.data(), window.temp_vertices.size()) ||
+        !uvs.append(window.temp_uvs.data(), window.temp_uvs.size()) ||
+        !normals.append(window.temp_normals.data(), window.temp_normals.size()))
+        return false;
+
+    // Material numbers of the whole file. Faces before the window's first
+    // usemtl keep the material the last window ended with.
+    for (size_t i = 0; i < window.materialLibraries.size(); i++)
+        nameIndex(materialLibraries, window.materialLibraries[i]);
+    for (size_t i = 0; i < window.materialRuns.size(); i++)
+        window.materialRuns[i].material = nameIndex(materialNames, window.materialNames[window.materialRuns[i].material]);
+    if (material != ~0u && (window.materialRuns.empty() || window.materialRuns[0].firstCorner > 0))
+    {
+        ObjMaterialRun run = { 0, material };
+        window.materialRuns.insert(window.materialRuns.begin(), run);
+    }
+    if (!window.materialRuns.empty())
+        material = window.materialRuns.back().material;
+    window.materialLibraries = materialLibraries;
+    window.materialNames = materialNames;
+
+    return gatherAttribute(window.vertexIndices, positions, window.temp_vertices, 1ull << 32) &&
+           gatherAttribute(window.uvIndices, uvs, window.temp_uvs, noIndex) &&
+           gatherAttribute(window.normalIndices, normals, window.temp_normals, smoothNormal) &&
+           completeFaces(window, state);
+}
+
+// Reads up to a window of text and parses its whole lines. The cut off line
+// at the end is moved to the front of the buffer for the next window.
+// Windows without faces are read past.
+// -------------------------------------------------------------------------
+bool ObjStreamReader::next(ObjData& window)
+{
+    while (file && !error)
+    {
+        size_t wanted = buffer.size() - buffered;
+        size_t read = fread(&buffer[buffered], 1, wanted, file);
+        if (ferror(file))
+        {
+            error = true;
+            break;
+        }
+        size_t filled = buffered + read;
+        bool last = read < wanted;
+        if (filled == 0)
+            break;
+
+        size_t cut = filled;
+        if (!last)
+        {
+            while (cut > 0 && buffer[cut - 1] != '\n')
+                cut--;
+            // A line longer than the whole window.
+            if (cut == 0)
+            {
+                error = true;
+                break;
+            }
+        }
+
+        bool parsed = parseWindow(&buffer[0], &buffer[0] + cut, window);
+        offset += cut;
+        buffered = filled - cut;
+        memmove(&buffer[0], &buffer[cut], buffered);
+        if (!parsed)
+        {
+            error = true;
+            break;
+        }
+        if (!window.vertexIndices.empty())
+            return true;
+        if (last && buffered == 0)
+            break;
+    }
+    return false;
+}
+
+// Path of relative seen from the directory holding base. Backslashes from
+// files exported on Windows become slashes, which work everywhere.
+string resolvePath(const string& base, const string& relative)
+{
+    string path = relative;
+    replace(path.begin(), path.end(), '\\', '/');
+    if (path.empty() || path[0] == '/' || (path.size() > 1 && path[1] == ':'))
+        return path;
+
+    size_t slash = base.find_last_of("/\\");
+    return slash == string::npos ? path : base.substr(0, slash + 1) + path;
+}
+
+static inline const char* tokenEnd(const char* p, const char* end)
+{
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        p++;
+    return p;
+}
+
+// Skips map options like "-s 1 1 1" or "-clamp on" before a texture path.
+static const char* skipMapOptions(const char* p, const char* end)
+{
+    p = skipSpaces(p, end);
+    while (p < end && *p == '-')
+    {
+        // The option, then its numbers, on/off or channel letter.
+        p = tokenEnd(p, end);
+        while (1)
+        {
+            const char* argument = skipSpaces(p, end);
+            const char* after = tokenEnd(argument, end);
+            float number;
+            bool isArgument = (parseFloat(argument, end, number) == after) ||
+                              (after - argument == 2 && memcmp(argument, "on", 2) == 0) ||
+                              (after - argument == 3 && memcmp(argument, "off", 3) == 0) ||
+                              (after - argument == 1 && strchr("rgbmlz", *argument));
+            if (argument == after || !isArgument)
+                break;
+            p = after;
+        }
+        p = skipSpaces(p, end);
+    }
+    return p;
+}
+
+// Appends the materials of a .mtl file, with texture paths resolved against
+// its directory. Statements the shaders have no use for are skipped.
+// -------------------------------------------------------------------------
+bool loadMaterialLibrary(const char* path, vector<Material>& materials)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+        return false;
+
+    const char* p = file.data;
+    const char* end = file.data + file.size;
+    Material* material = NULL;
+
+    while (p < end)
+    {
+        p = skipSpaces(p, end);
+        if (isKeyword(p, end, "newmtl", 6))
+        {
+            materials.push_back(Material());
+            material = &materials.back();
+            material->name = restOfLine(p + 6, end);
+        }
+        else if (material && isKeyword(p, end, "Kd", 2))
+        {
+            glm::vec3 color;
+            const char* q = parseFloat(p + 2, end, color.x);
+            if (q) q = parseFloat(q, end, color.y);
+            if (q) q = parseFloat(q, end, color.z);
+            if (q)
+                material->diffuse = color;
+        }
+        else if (material && isKeyword(p, end, "map_Kd", 6))
+        {
+            string map = restOfLine(skipMapOptions(p + 6, end), end);
+            if (!map.empty())
+                material->diffuseMap = resolvePath(path, map);
+        }
+        p = skipLine(p, end);
+    }
+    return true;
+}
@@ -0,0 +1,234 @@
+#include "Application.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+const size_t Profiler::sampleWindow;
+const size_t Profiler::traceCapacity;
+
+// Trace thread id of GPU timings, CPU threads count up from 1.
+static const uint32_t gpuThread = 0;
+
+static uint32_t threadIndex()
+{
+    static atomic<uint32_t> threadCount(0);
+    static thread_local uint32_t index = ++threadCount;
+    return index;
+}
+
+Profiler::Profiler() :
+    nextEvent(0), gpuFrame(0), gpuDropped(0), gpuOpen(false), frameStart(0.0)
+{
+    frameSection = section("frame");
+    origin = now();
+}
+
+// Profiler of the application, created on first use. GL queries it made are
+// not deleted, they go with the context.
+Profiler& Profiler::shared()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+double Profiler::now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Index of the section with this name, added on first use.
+size_t Profiler::section(const char* name)
+{
+    lock_guard<mutex> lock(dataMutex);
+    for (size_t i = 0; i < sections.size(); i++)
+        if (sections[i].name == name)
+            return i;
+
+    Section added;
+    added.name = name;
+    added.samples.resize(sampleWindow);
+    added.next = added.count = 0;
+    sections.push_back(added);
+    return sections.size() - 1;
+}
+
+// Adds a sample to the section and the trace, with dataMutex held.
+void Profiler::addEvent(const Event& event)
+{
+    Section& section = sections[event.section];
+    section.samples[section.next] = (float) event.duration;
+    section.next = (section.next + 1) % sampleWindow;
+    section.count++;
+
+    if (events.size() < traceCapacity)
+        events.push_back(event);
+    else
+        events[nextEvent] = event;
+    nextEvent = (nextEvent + 1) % traceCapacity;
+}
+
+void Profiler::record(size_t section, double start, double end)
+{
+    Event event = { (uint32_t) section, threadIndex(), start, end - start };
+
+    lock_guard<mutex> lock(dataMutex);
+    addEvent(event);
+}
+
+// Starts timing the GPU work issued until endGpu(). A nested begin is
+// ignored, since only one GL_TIME_ELAPSED query can be active.
+// ---------------------------------------------------------------------
+void Profiler::beginGpu(size_t section)
+{
+    if (gpuOpen)
+        return;
+
+    GpuQuery query;
+    query.section = section;
+    query.start = now();
+    if (freeQueries.empty())
+        glGenQueries(1, &query.query);
+    else
+    {
+        query.query = freeQueries.back();
+        freeQueries.pop_back();
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, query.query);
+    gpuFrames[gpuFrame].push_back(query);
+    gpuOpen = true;
+}
+
+void Profiler::endGpu()
+{
+    if (!gpuOpen)
+        return;
+    glEndQuery(GL_TIME_ELAPSED);
+    gpuOpen = false;
+}
+
+// Records the frame time, then swaps the query buffers. The buffer the next
+// frame fills holds the queries of the frame before this one, which the GPU
+// has usually finished, so reading them back does not wait.
+// -------------------------------------------------------------------------
+void Profiler::frame()
+{
+    double end = now();
+    if (frameStart > 0.0)
+        record(frameSection, frameStart, end);
+    frameStart = end;
+
+    endGpu();
+    gpuFrame ^= 1;
+    collectGpu(gpuFrames[gpuFrame]);
+}
+
+// Results that are not available yet are dropped rather than waited for.
+void Profiler::collectGpu(vector<GpuQuery>& queries)
+{
+    for (size_t i = 0; i < queries.size(); i++)
+    {
+        GLint available = 0;
+        glGetQueryObjectiv(queries[i].query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[i].query, GL_QUERY_RESULT, &nanoseconds);
+            // GL only measures durations, the trace places them where the CPU issued the work.
+            Event event = { (uint32_t) queries[i].section, gpuThread, queries[i].start, nanoseconds * 1e-9 };
+
+            lock_guard<mutex> lock(dataMutex);
+            addEvent(event);
+        }
+        else
+        {
+            gpuDropped++;
+        }
+        freeQueries.push_back(queries[i].query);
+    }
+    queries.clear();
+}
+
+// Percentiles by nearest rank over the samples still in the window.
+// -----------------------------------------------------------------
+Profiler::Summary Profiler::summarize(size_t section)
+{
+    vector<float> samples;
+    Summary summary;
+    {
+        lock_guard<mutex> lock(dataMutex);
+        const Section& timed = sections[section];
+        samples.assign(timed.samples.begin(), timed.samples.begin() + min(timed.count, sampleWindow));
+        summary.count = timed.count;
+    }
+
+    summary.mean = summary.p50 = summary.p95 = summary.p99 = 0.0;
+    if (samples.empty())
+        return summary;
+
+    sort(samples.begin(), samples.end());
+    double total = 0.0;
+    for (size_t i = 0; i < samples.size(); i++)
+        total += samples[i];
+    auto rank = [&](double p) { return samples[(size_t) ceil(p * samples.size()) - 1] * 1000.0; };
+    summary.mean = total / samples.size() * 1000.0;
+    summary.p50 = rank(0.50);
+    summary.p95 = rank(0.95);
+    summary.p99 = rank(0.99);
+    return summary;
+}
+
+void Profiler::report()
+{
+    vector<string> names;
+    {
+        lock_guard<mutex> lock(dataMutex);
+        for (size_t i = 0; i < sections.size(); i++)
+            names.push_back(sections[i].name);
+    }
+
+    printf("%-24s %8s %9s %9s %9s %9s\n", "section (ms)", "count", "mean", "p50", "p95", "p99");
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        Summary summary = summarize(i);
+        if (summary.count == 0)
+            continue;
+        printf("%-24s %8zu %9.3f %9.3f %9.3f %9.3f\n", names[i].c_str(), summary.count,
+               summary.mean, summary.p50, summary.p95, summary.p99);
+    }
+    if (gpuDropped)
+        printf("%zu GPU timings were not ready in time and dropped\n", gpuDropped);
+}
+
+// Chrome's trace event format, one complete ("X") event per scope.
+// ----------------------------------------------------------------
+bool Profiler::writeTrace(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    lock_guard<mutex> lock(dataMutex);
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", gpuThread);
+
+    // Oldest first, which is at nextEvent once the ring has wrapped.
+    size_t first = events.size() < traceCapacity ? 0 : nextEvent;
+    for (size_t i = 0; i < events.size(); i++)
+    {
+        const Event& event = events[(first + i) % events.size()];
+        string name;
+        for (char c : sections[event.section].name)
+        {
+            if (c == '"' || c == '\\')
+                name += '\\';
+            name += c;
+        }
+        fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                name.c_str(), event.thread, (event.start - origin) * 1e6, event.duration * 1e6);
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
@@ -0,0 +1,231 @@
+#include "Application.hpp"
+
+using namespace std;
+
+// Real GL calls.
+// --------------
+void GLRenderBackend::useProgram(unsigned int program)
+{
+    glUseProgram(program);
+}
+
+void GLRenderBackend::bindTexture(int type, unsigned int texture)
+{
+    glBindTexture(type, texture);
+}
+
+void GLRenderBackend::bindVertexArray(unsigned int vertexArray)
+{
+    glBindVertexArray(vertexArray);
+}
+
+void GLRenderBackend::setMat4(int location, const glm::mat4& value)
+{
+    glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void GLRenderBackend::setVec3(int location, const glm::vec3& value)
+{
+    glUniform3fv(location, 1, glm::value_ptr(value));
+}
+
+void GLRenderBackend::setInt(int location, int value)
+{
+    glUniform1i(location, value);
+}
+
+void GLRenderBackend::drawElements(GLenum indexType, unsigned int indexCount, unsigned int indexOffset, unsigned int instanceCount)
+{
+    size_t indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    void* offset = (void*)(indexOffset * indexSize);
+    if (instanceCount)
+        glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, offset, instanceCount);
+    else
+        glDrawElements(GL_TRIANGLES, indexCount, indexType, offset);
+}
+
+// Recorded calls.
+// ---------------
+size_t RecordingRenderBackend::count(CallType type) const
+{
+    size_t total = 0;
+    for (size_t i = 0; i < calls.size(); i++)
+        if (calls[i].type == type)
+            total++;
+    return total;
+}
+
+void RecordingRenderBackend::useProgram(unsigned int program)
+{
+    Call call = { USE_PROGRAM, program };
+    calls.push_back(call);
+}
+
+void RecordingRenderBackend::bindTexture(int, unsigned int texture)
+{
+    Call call = { BIND_TEXTURE, texture };
+    calls.push_back(call);
+}
+
+void RecordingRenderBackend::bindVertexArray(unsigned int vertexArray)
+{
+    Call call = { BIND_VERTEX_ARRAY, vertexArray };
+    calls.push_back(call);
+}
+
+void RecordingRenderBackend::setMat4(int location, const glm::mat4&)
+{
+    Call call = { SET_UNIFORM, (unsigned int) location };
+    calls.push_back(call);
+}
+
+void RecordingRenderBackend::setVec3(int location, const glm::vec3&)
+{
+    Call call = { SET_UNIFORM, (unsigned int) location };
+    calls.push_back(call);
+}
+
+void RecordingRenderBackend::setInt(int location, int)
+{
+    Call call = { SET_UNIFORM, (unsigned int) location };
+    calls.push_back(call);
+}
+
+void RecordingRenderBackend::drawElements(GLenum, unsigned int indexCount, unsigned int, unsigned int)
+{
+    Call call = { DRAW, indexCount };
+    calls.push_back(call);
+}
+
+// Least significant digit radix sort of keys, carrying values along.
+// Bytes that are the same in every key are skipped, which for a frame of
+// draws is most of the state bits. Stable, so equal keys keep their order.
+// ------------------------------------------------------------------------
+void radixSort(vector<uint64_t>& keys, vector<uint32_t>& values, vector<uint64_t>& keyScratch, vector<uint32_t>& valueScratch)
+{
+    size_t count = keys.size();
+    keyScratch.resize(count);
+    valueScratch.resize(count);
+
+    size_t histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for (size_t i = 0; i < count; i++)
+        for (int pass = 0; pass < 8; pass++)
+            histograms[pass][(keys[i] >> (pass * 8)) & 0xff]++;
+
+    for (int pass = 0; pass < 8; pass++)
+    {
+        size_t* histogram = histograms[pass];
+        if (count == 0 || histogram[(keys[0] >> (pass * 8)) & 0xff] == count)
+            continue;
+
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            size_t bucket = histogram[digit];
+            histogram[digit] = offset;
+            offset += bucket;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t target = histogram[(keys[i] >> (pass * 8)) & 0xff]++;
+            keyScratch[target] = keys[i];
+            valueScratch[target] = values[i];
+        }
+        keys.swap(keyScratch);
+        values.swap(valueScratch);
+    }
+}
+
+RenderQueue::RenderQueue()
+{
+    memset(&lastStats, 0, sizeof(lastStats));
+}
+
+uint64_t RenderQueue::sortKey(const DrawItem& item, float depth)
+{
+    // Non-negative floats order the same as their bit patterns.
+    uint32_t depthBits;
+    depth = max(depth, 0.0f);
+    memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    return ((uint64_t)(item.program & 0xff) << 56) |
+           ((uint64_t)(item.texture & 0xfff) << 44) |
+           ((uint64_t)(item.vertexArray & 0xfff) << 32) |
+           depthBits;
+}
+
+void RenderQueue::submit(const DrawItem& item, float depth)
+{
+    keys.push_back(sortKey(item, depth));
+    order.push_back(items.size());
+    items.push_back(item);
+}
+
+// Sorts the frame's draws and issues them, binding only what changed.
+// Nothing is assumed about the state on entry, the first draw binds all.
+// ----------------------------------------------------------------------
+void RenderQueue::flush(RenderBackend& backend)
+{
+    radixSort(keys, order, keyScratch, orderScratch);
+
+    RenderStats stats;
+    memset(&stats, 0, sizeof(stats));
+    const DrawItem* previous = NULL;
+
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        const DrawItem& item = items[order[i]];
+
+        if (!previous || item.program != previous->program)
+        {
+            backend.useProgram(item.program);
+            stats.programChanges++;
+        }
+        else
+        {
+            stats.redundantBinds++;
+        }
+
+        if (!previous || item.texture != previous->texture || item.textureType != previous->textureType)
+        {
+            backend.bindTexture(item.textureType, item.texture);
+            stats.textureChanges++;
+        }
+        else
+        {
+            stats.redundantBinds++;
+        }
+
+        if (!previous || item.vertexArray != previous->vertexArray)
+        {
+            backend.bindVertexArray(item.vertexArray);
+            stats.vertexArrayChanges++;
+        }
+        else
+        {
+            stats.redundantBinds++;
+        }
+
+        if (item.modelUniform.location >= 0)
+            backend.setMat4(item.modelUniform.location, item.model);
+        if (item.positionOffsetUniform.location >= 0)
+            backend.setVec3(item.positionOffsetUniform.location, item.positionOffset);
+        if (item.positionScaleUniform.location >= 0)
+            backend.setVec3(item.positionScaleUniform.location, item.positionScale);
+        if (item.octahedralNormalsUniform.location >= 0)
+            backend.setInt(item.octahedralNormalsUniform.location, item.octahedralNormals);
+        if (item.diffuseColorUniform.location >= 0)
+            backend.setVec3(item.diffuseColorUniform.location, item.diffuseColor);
+
+        backend.drawElements(item.indexType, item.indexCount, item.indexOffset, item.instanceCount);
+        stats.draws++;
+        previous = &item;
+    }
+
+    lastStats = stats;
+    items.clear();
+    keys.clear();
+    order.clear();
+}
@@ -0,0 +1,380 @@
+#include "Application.hpp"
+
+#include <algorithm>
+#include <float.h>
+
+using namespace std;
+
+// Build parameters. Below medianDepth nodes are split at the median, which
+// bounds the tree depth for the fixed size traversal stacks.
+static const int binCount = 16;
+static const uint32_t medianDepth = 64;
+static const int stackSize = 128;
+
+// Scene leaves hold one object unless SAH finds nothing better, up to 16.
+static const uint32_t sceneLeafSize = 1;
+static const uint32_t sceneMaxLeafSize = 16;
+
+static inline float halfArea(const AABB& box)
+{
+    glm::vec3 size = box.max - box.min;
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static inline void grow(AABB& box, const AABB& other)
+{
+    box.min = glm::min(box.min, other.min);
+    box.max = glm::max(box.max, other.max);
+}
+
+static inline AABB emptyBox()
+{
+    AABB box;
+    box.min = glm::vec3(FLT_MAX);
+    box.max = glm::vec3(-FLT_MAX);
+    return box;
+}
+
+static inline float centroid(const AABB& box, int axis)
+{
+    return (box.min[axis] + box.max[axis]) * 0.5f;
+}
+
+// Slab test. Misses when the box is behind the origin or beyond maxDistance.
+bool intersectRayAABB(const Ray& ray, const glm::vec3& inverseDirection, const AABB& box, float maxDistance, float& distance)
+{
+    float nearest = 0.0f, farthest = maxDistance;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float t1 = (box.min[axis] - ray.origin[axis]) * inverseDirection[axis];
+        float t2 = (box.max[axis] - ray.origin[axis]) * inverseDirection[axis];
+        nearest = max(nearest, min(t1, t2));
+        farthest = min(farthest, max(t1, t2));
+    }
+    distance = nearest;
+    return nearest <= farthest;
+}
+
+// Top down build with binned SAH. Each node tries binCount centroid bins on
+// all three axes and keeps the cheapest split, or stays a leaf when
+// splitting would cost more than testing its objects directly.
+// -----------------------------------------------------------------------
+void buildBVH(const vector<AABB>& bounds, uint32_t leafSize, uint32_t maxLeafSize, vector<BVHNode>& nodes, vector<uint32_t>& objects)
+{
+    uint32_t count = bounds.size();
+    objects.resize(count);
+    for (uint32_t i = 0; i < count; i++)
+        objects[i] = i;
+
+    nodes.clear();
+    if (count == 0)
+        return;
+    nodes.reserve(2 * count);
+
+    BVHNode root;
+    root.first = 0;
+    root.count = count;
+    nodes.push_back(root);
+
+    // Node index and depth.
+    vector<pair<uint32_t, uint32_t> > stack(1, make_pair(0u, 0u));
+    while (!stack.empty())
+    {
+        uint32_t index = stack.back().first, depth = stack.back().second;
+        stack.pop_back();
+        uint32_t first = nodes[index].first, size = nodes[index].count;
+
+        AABB box = emptyBox(), centroids = emptyBox();
+        for (uint32_t i = first; i < first + size; i++)
+        {
+            const AABB& object = bounds[objects[i]];
+            grow(box, object);
+            AABB point;
+            point.min = point.max = (object.min + object.max) * 0.5f;
+            grow(centroids, point);
+        }
+        nodes[index].bounds = box;
+        if (size <= leafSize)
+            continue;
+
+        // Costs are relative to one object test, with one for the node itself.
+        float leafCost = (float) size;
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestSplit = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroids.max[axis] - centroids.min[axis];
+            if (extent <= 0.0f)
+                continue;
+            float scale = binCount / extent;
+
+            AABB binBounds[binCount];
+            uint32_t binSizes[binCount] = { 0 };
+            for (int b = 0; b < binCount; b++)
+                binBounds[b] = emptyBox();
+            for (uint32_t i = first; i < first + size; i++)
+            {
+                const AABB& object = bounds[objects[i]];
+                int b = min(binCount - 1, (int)((centroid(object, axis) - centroids.min[axis]) * scale));
+                grow(binBounds[b], object);
+                binSizes[b]++;
+            }
+
+            // Right to left sweep first, then left to right evaluates every split.
+            float rightAreas[binCount];
+            uint32_t rightSizes[binCount];
+            AABB accumulated = emptyBox();
+            uint32_t accumulatedSize = 0;
+            for (int b = binCount - 1; b > 0; b--)
+            {
+                grow(accumulated, binBounds[b]);
+                accumulatedSize += binSizes[b];
+                rightAreas[b] = accumulatedSize ? halfArea(accumulated) : 0.0f;
+                rightSizes[b] = accumulatedSize;
+            }
+
+            accumulated = emptyBox();
+            accumulatedSize = 0;
+            for (int b = 0; b < binCount - 1; b++)
+            {
+                grow(accumulated, binBounds[b]);
+                accumulatedSize += binSizes[b];
+                if (accumulatedSize == 0 || rightSizes[b + 1] == 0)
+                    continue;
+                float cost = 1.0f + (halfArea(accumulated) * accumulatedSize + rightAreas[b + 1] * rightSizes[b + 1]) / halfArea(box);
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+
+        if (bestCost >= leafCost && size <= maxLeafSize)
+            continue;
+
+        uint32_t* begin = &objects[first];
+        uint32_t* end = begin + size;
+        uint32_t* middle;
+        if (depth >= medianDepth)
+        {
+            glm::vec3 extent = centroids.max - centroids.min;
+            int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            middle = begin + size / 2;
+            nth_element(begin, middle, end, [&](uint32_t a, uint32_t b)
+            {
+                return centroid(bounds[a], axis) < centroid(bounds[b], axis);
+            });
+        }
+        else if (bestAxis >= 0)
+        {
+            float scale = binCount / (centroids.max[bestAxis] - centroids.min[bestAxis]);
+            float minimum = centroids.min[bestAxis];
+            middle = partition(begin, end, [&](uint32_t object)
+            {
+                return min(binCount - 1, (int)((centroid(bounds[object], bestAxis) - minimum) * scale)) < bestSplit;
+            });
+        }
+        else
+        {
+            // Centroids all coincide, split the list in half.
+            middle = begin + size / 2;
+        }
+
+        BVHNode left, right;
+        left.first = first;
+        left.count = middle - begin;
+        right.first = first + left.count;
+        right.count = size - left.count;
+
+        nodes[index].first = nodes.size();
+        nodes[index].count = 0;
+        stack.push_back(make_pair((uint32_t) nodes.size(), depth + 1));
+        nodes.push_back(left);
+        stack.push_back(make_pair((uint32_t) nodes.size(), depth + 1));
+        nodes.push_back(right);
+    }
+}
+
+void SceneBVH::build(const vector<AABB>& bounds)
+{
+    objectBounds = bounds;
+    buildBVH(bounds, sceneLeafSize, sceneMaxLeafSize, nodes, objects);
+}
+
+// Updates every box for moved objects, keeping the tree as it is. Children
+// always come after their parent, so one backwards pass is enough.
+// ------------------------------------------------------------------------
+void SceneBVH::refit(const vector<AABB>& bounds)
+{
+    objectBounds = bounds;
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        BVHNode& node = nodes[i];
+        if (node.count)
+        {
+            node.bounds = emptyBox();
+            for (uint32_t j = node.first; j < node.first + node.count; j++)
+                grow(node.bounds, bounds[objects[j]]);
+        }
+        else
+        {
+            node.bounds = nodes[node.first].bounds;
+            grow(node.bounds, nodes[node.first + 1].bounds);
+        }
+    }
+}
+
+// Adds every object under node, for subtrees entirely inside the frustum.
+void SceneBVH::collect(uint32_t node, vector<uint32_t>& visible) const
+{
+    uint32_t stack[stackSize];
+    int top = 0;
+    stack[top++] = node;
+    while (top)
+    {
+        const BVHNode& current = nodes[stack[--top]];
+        if (current.count)
+            visible.insert(visible.end(), &objects[current.first], &objects[current.first] + current.count);
+        else
+        {
+            stack[top++] = current.first;
+            stack[top++] = current.first + 1;
+        }
+    }
+}
+
+// Hierarchical culling. Planes a node is entirely inside of are not tested
+// again below it, and a node inside all six is accepted without further tests.
+// Returns the number of visible objects, written to visible.
+// ---------------------------------------------------------------------------
+size_t SceneBVH::cull(const Frustum& frustum, vector<uint32_t>& visible) const
+{
+    visible.clear();
+    if (nodes.empty())
+        return 0;
+
+    struct Entry
+    {
+        uint32_t node;
+        uint32_t planeMask;
+    };
+    Entry stack[stackSize];
+    int top = 0;
+    stack[top].node = 0;
+    stack[top++].planeMask = 0x3f;
+
+    while (top)
+    {
+        Entry entry = stack[--top];
+        const BVHNode& node = nodes[entry.node];
+
+        bool outside = false;
+        uint32_t mask = entry.planeMask;
+        for (int p = 0; p < 6 && !outside; p++)
+        {
+            if (!(mask & (1 << p)))
+                continue;
+            const glm::vec4& plane = frustum.planes[p];
+            // The corners furthest along and against the plane normal.
+            glm::vec3 positive(plane.x >= 0.0f ? node.bounds.max.x : node.bounds.min.x,
+                               plane.y >= 0.0f ? node.bounds.max.y : node.bounds.min.y,
+                               plane.z >= 0.0f ? node.bounds.max.z : node.bounds.min.z);
+            glm::vec3 negative(plane.x >= 0.0f ? node.bounds.min.x : node.bounds.max.x,
+                               plane.y >= 0.0f ? node.bounds.min.y : node.bounds.max.y,
+                               plane.z >= 0.0f ? node.bounds.min.z : node.bounds.max.z);
+            if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+                outside = true;
+            else if (glm::dot(glm::vec3(plane), negative) + plane.w >= 0.0f)
+                mask &= ~(1u << p);
+        }
+        if (outside)
+            continue;
+
+        if (mask == 0)
+        {
+            collect(entry.node, visible);
+        }
+        else if (node.count)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+                if (node.count == 1 || aabbInFrustum(frustum, objectBounds[objects[i]]))
+                    visible.push_back(objects[i]);
+        }
+        else
+        {
+            stack[top].node = node.first;
+            stack[top++].planeMask = mask;
+            stack[top].node = node.first + 1;
+            stack[top++].planeMask = mask;
+        }
+    }
+    return visible.size();
+}
+
+// Nearest object along the ray within maxDistance. Without an intersector
+// objects are hit where the ray enters their AABB. Children are visited near
+// first so far subtrees are mostly skipped once something was hit.
+// -------------------------------------------------------------------------
+bool SceneBVH::raycast(const Ray& ray, float maxDistance, uint32_t& object, float& distance, const ObjectIntersector& intersect) const
+{
+    if (nodes.empty())
+        return false;
+
+    glm::vec3 inverseDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    float best = maxDistance;
+    bool hit = false;
+
+    uint32_t stack[stackSize];
+    int top = 0;
+    float entry;
+    stack[top++] = 0;
+
+    while (top)
+    {
+        const BVHNode& node = nodes[stack[--top]];
+        if (!intersectRayAABB(ray, inverseDirection, node.bounds, best, entry))
+            continue;
+
+        if (node.count)
+        {
+            for (uint32_t i = node.first; i < node.first + node.count; i++)
+            {
+                uint32_t candidate = objects[i];
+                if (!intersectRayAABB(ray, inverseDirection, objectBounds[candidate], best, entry))
+                    continue;
+                float candidateDistance = intersect ? best : entry;
+                if (intersect && !intersect(candidate, ray, candidateDistance))
+                    continue;
+                if (candidateDistance <= best)
+                {
+                    best = candidateDistance;
+                    object = candidate;
+                    hit = true;
+                }
+            }
+            continue;
+        }
+
+        float leftEntry, rightEntry;
+        bool leftHit = intersectRayAABB(ray, inverseDirection, nodes[node.first].bounds, best, leftEntry);
+        bool rightHit = intersectRayAABB(ray, inverseDirection, nodes[node.first + 1].bounds, best, rightEntry);
+        if (leftHit && rightHit)
+        {
+            // Far child goes on the stack first.
+            bool leftFirst = leftEntry <= rightEntry;
+            stack[top++] = leftFirst ? node.first + 1 : node.first;
+            stack[top++] = leftFirst ? node.first : node.first + 1;
+        }
+        else if (leftHit)
+            stack[top++] = node.first;
+        else if (rightHit)
+            stack[top++] = node.first + 1;
+    }
+
+    if (hit)
+        distance = best;
+    return hit;
+}
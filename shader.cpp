@@ -1,7 +1,7 @@
 #include "Application.hpp"
 using namespace std;
 
-Shader::Shader (const char *vectFile, const char *fragFile)
+Shader::Shader (const char *vectFile, const char *fragFile) : lookupCount(0)
 {
      // Compile the shaders.
     compile(vectFile, GL_VERTEX_SHADER, &vertexShader);
@@ -9,6 +9,34 @@ Shader::Shader (const char *vectFile, const char *fragFile)
 
     // Link shaders into main shader program and cleanup.
     linkShaders();
+    findUniforms();
+}
+
+Shader::Shader(Shader&& other) : shaderProgram(0)
+{
+    *this = move(other);
+}
+
+Shader& Shader::operator=(Shader&& other)
+{
+    if (this != &other)
+    {
+        if (shaderProgram)
+            glDeleteProgram(shaderProgram);
+        shaderProgram = other.shaderProgram;
+        vertexShader = other.vertexShader;
+        fragShader = other.fragShader;
+        uniforms = move(other.uniforms);
+        lookupCount = other.lookupCount;
+        other.shaderProgram = 0;
+    }
+    return *this;
+}
+
+Shader::~Shader()
+{
+    if (shaderProgram)
+        glDeleteProgram(shaderProgram);
 }
 
 void Shader::use ()
@@ -18,7 +46,41 @@ void Shader::use ()
 
 void Shader::setInt(const char *name, int a)
 {
-    glUniform1i(glGetUniformLocation(shaderProgram, name), a);
+    setInt(uniform(name), a);
+}
+
+// Handle for a uniform by name. Counted, so call it at setup and keep the result.
+Uniform Shader::uniform(const char* name)
+{
+    lookupCount++;
+    unordered_map<string, Uniform>::const_iterator it = uniforms.find(name);
+    return it != uniforms.end() ? it->second : Uniform();
+}
+
+// The setters write to the program currently in use.
+void Shader::setMat4(Uniform uniform, const glm::mat4& value)
+{
+    glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+void Shader::setVec3(Uniform uniform, const glm::vec3& value)
+{
+    glUniform3fv(uniform.location, 1, glm::value_ptr(value));
+}
+
+void Shader::setFloat(Uniform uniform, float value)
+{
+    glUniform1f(uniform.location, value);
+}
+
+void Shader::setInt(Uniform uniform, int value)
+{
+    glUniform1i(uniform.location, value);
+}
+
+void Shader::setSampler(Uniform uniform, int textureUnit)
+{
+    glUniform1i(uniform.location, textureUnit);
 }
 
 void Shader::compile(const char* Path, GLenum type, unsigned int *handle)
@@ -26,7 +88,8 @@ void Shader::compile(const char* Path, GLenum type, unsigned int *handle)
     // Read shader from path.
     vector<char> fileContent;
 
-    readFile(Path, fileContent);
+    if (!readFile(Path, fileContent))
+        exit(1);
     const char* shaderText (&fileContent[0]);
 
     // Create and compile the shader.
@@ -38,12 +101,13 @@ void Shader::compile(const char* Path, GLenum type, unsigned int *handle)
     // Check for any errors.
     int  success;
     char infoLog[512];
-    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &success);
+    glGetShaderiv(*handle, GL_COMPILE_STATUS, &success);
 
     if(!success)
     {
-        glGetShaderInfoLog(vertexShader, 512, NULL, infoLog);
-        cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << endl;
+        glGetShaderInfoLog(*handle, 512, NULL, infoLog);
+        cerr << (type == GL_VERTEX_SHADER ? "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" : "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n")
+             << Path << "\n" << infoLog << endl;
         exit(1);
     }
 }
@@ -63,7 +127,7 @@ void Shader::linkShaders()
 
     if(!success) {
         glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
-        cerr << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << endl;
+        cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << endl;
         exit(1);
     }
 
@@ -71,7 +135,37 @@ void Shader::linkShaders()
     glDeleteShader(fragShader);
 }
 
-int Shader::readFile(const char* filename, std::vector<char>& buffer)
+// Records the location and type of every active uniform in the linked program.
+// Arrays are reported as "name[0]" and stored under "name" as well.
+// ---------------------------------------------------------------------------
+void Shader::findUniforms()
+{
+    int count = 0, maxLength = 0;
+    glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+    vector<char> name(maxLength + 1);
+    for (int i = 0; i < count; i++)
+    {
+        int length = 0, size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(shaderProgram, i, name.size(), &length, &size, &type, &name[0]);
+
+        Uniform uniform;
+        uniform.location = glGetUniformLocation(shaderProgram, &name[0]);
+        uniform.type = type;
+        // Members of uniform blocks have no location of their own.
+        if (uniform.location < 0)
+            continue;
+
+        string key(&name[0], length);
+        uniforms[key] = uniform;
+        if (key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0)
+            uniforms[key.substr(0, key.size() - 3)] = uniform;
+    }
+}
+
+bool Shader::readFile(const char* filename, std::vector<char>& buffer)
 {
     ifstream file (filename, ifstream::in);
 
@@ -85,9 +179,9 @@ int Shader::readFile(const char* filename, std::vector<char>& buffer)
             file.read(&buffer[0], size);
         }
         buffer.push_back('\0');
+        return true;
     }
-    else
-    {
-        cerr << "Cannot open " << filename << endl;
-    }
+
+    cerr << "Cannot open " << filename << endl;
+    return false;
 }
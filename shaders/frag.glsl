@@ -4,9 +4,11 @@ out vec4 FragColor;
 in vec3 ourColor;
 in vec2 TexCoord;
 
-uniform sampler2D texture;
+uniform sampler2D diffuse;
+// Material color, white when the model has none.
+uniform vec3 diffuseColor;
 
 void main()
 {
-    FragColor = texture(texture, TexCoord);
+    FragColor = texture(diffuse, TexCoord) * vec4(diffuseColor, 1.0);
 }
@@ -1,6 +1,6 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aColor;
+layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
 
 out vec3 ourColor;
@@ -10,9 +10,25 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+// Vertex format decoding, identity for float vertices.
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+uniform bool octahedralNormals;
+
+vec3 decodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
-    ourColor = aColor;
+    vec3 position = positionOffset + aPos * positionScale;
+    vec3 normal = octahedralNormals ? decodeOctahedral(aNormal.xy) : aNormal;
+
+    gl_Position = projection * view * model * vec4(position, 1.0);
+    ourColor = normal;
     TexCoord = aTexCoord;
 }
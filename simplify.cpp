@@ -0,0 +1,463 @@
+#include "Application.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+// How a vertex may move during simplification. Seams are where one position
+// has two vertices with different UVs or normals, borders are open edges of
+// the surface. Both only collapse along themselves, so neither tears.
+enum VertexKind
+{
+    KIND_MANIFOLD,
+    KIND_BORDER,
+    KIND_SEAM,
+    KIND_LOCKED
+};
+
+// Open edges weigh more than faces, keeping borders and seams in shape.
+static const float edgeWeight = 4.0f;
+// How far past the error a pass expects to reach its goal it may go.
+static const float passErrorBound = 1.5f;
+
+// Symmetric 4x4 quadric, the summed squared distance to a set of planes.
+struct Quadric
+{
+    float a00, a11, a22, a01, a02, a12;
+    float b0, b1, b2;
+    float c;
+    float weight;
+};
+
+static void addPlane(Quadric& q, const glm::vec3& normal, float distance, float weight)
+{
+    q.a00 += weight * normal.x * normal.x;
+    q.a11 += weight * normal.y * normal.y;
+    q.a22 += weight * normal.z * normal.z;
+    q.a01 += weight * normal.x * normal.y;
+    q.a02 += weight * normal.x * normal.z;
+    q.a12 += weight * normal.y * normal.z;
+    q.b0 += weight * normal.x * distance;
+    q.b1 += weight * normal.y * distance;
+    q.b2 += weight * normal.z * distance;
+    q.c += weight * distance * distance;
+    q.weight += weight;
+}
+
+static void addQuadric(Quadric& q, const Quadric& other)
+{
+    q.a00 += other.a00;
+    q.a11 += other.a11;
+    q.a22 += other.a22;
+    q.a01 += other.a01;
+    q.a02 += other.a02;
+    q.a12 += other.a12;
+    q.b0 += other.b0;
+    q.b1 += other.b1;
+    q.b2 += other.b2;
+    q.c += other.c;
+    q.weight += other.weight;
+}
+
+// Mean squared distance of p to the quadric's planes.
+static float quadricError(const Quadric& q, const glm::vec3& p)
+{
+    float rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z;
+    float ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z;
+    float rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z;
+    float error = rx * p.x + ry * p.y + rz * p.z + 2.0f * (q.b0 * p.x + q.b1 * p.y + q.b2 * p.z) + q.c;
+    return q.weight > 0.0f ? max(error, 0.0f) / q.weight : 0.0f;
+}
+
+static inline uint64_t edgeKey(unsigned int a, unsigned int b)
+{
+    return a < b ? ((uint64_t) a << 32) | b : ((uint64_t) b << 32) | a;
+}
+
+// How many triangles use the edge, from the sorted edge list.
+static size_t edgeUses(const vector<uint64_t>& edges, unsigned int a, unsigned int b)
+{
+    uint64_t key = edgeKey(a, b);
+    pair<vector<uint64_t>::const_iterator, vector<uint64_t>::const_iterator> range = equal_range(edges.begin(), edges.end(), key);
+    return range.second - range.first;
+}
+
+// Every triangle edge, sorted for edgeUses(), and for each corner how many
+// triangles use the edge from it to the next corner.
+static void sortedEdges(const vector<unsigned int>& indices, vector<uint64_t>& edges, vector<unsigned char>& cornerUses)
+{
+    vector<pair<uint64_t, uint32_t> > corners(indices.size());
+    for (size_t i = 0; i < indices.size(); i += 3)
+        for (int k = 0; k < 3; k++)
+            corners[i + k] = make_pair(edgeKey(indices[i + k], indices[i + (k + 1) % 3]), (uint32_t)(i + k));
+    sort(corners.begin(), corners.end());
+
+    edges.resize(corners.size());
+    cornerUses.resize(corners.size());
+    for (size_t i = 0; i < corners.size();)
+    {
+        size_t end = i + 1;
+        while (end < corners.size() && corners[end].first == corners[i].first)
+            end++;
+        for (size_t j = i; j < end; j++)
+        {
+            edges[j] = corners[j].first;
+            cornerUses[corners[j].second] = (unsigned char) min<size_t>(end - i, 255);
+        }
+        i = end;
+    }
+}
+
+// Vertices sharing a position, as a ring through wedges, and the first of
+// them as the position's group.
+// -----------------------------------------------------------------------
+static void findWedges(const Vertex* vertices, size_t vertexCount, vector<unsigned int>& group, vector<unsigned int>& wedge)
+{
+    vector<unsigned int> order(vertexCount);
+    for (size_t i = 0; i < vertexCount; i++)
+        order[i] = i;
+    sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+    {
+        int compare = memcmp(&vertices[a].position, &vertices[b].position, sizeof(glm::vec3));
+        return compare < 0 || (compare == 0 && a < b);
+    });
+
+    group.resize(vertexCount);
+    wedge.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount;)
+    {
+        size_t end = i + 1;
+        while (end < vertexCount && memcmp(&vertices[order[i]].position, &vertices[order[end]].position, sizeof(glm::vec3)) == 0)
+            end++;
+        for (size_t j = i; j < end; j++)
+        {
+            group[order[j]] = order[i];
+            wedge[order[j]] = order[j + 1 < end ? j + 1 : i];
+        }
+        i = end;
+    }
+}
+
+static size_t wedgeCount(const vector<unsigned int>& wedge, unsigned int v)
+{
+    size_t count = 1;
+    for (unsigned int w = wedge[v]; w != v; w = wedge[w])
+        count++;
+    return count;
+}
+
+// Sorts vertices into kinds by the open edges around them, once in index
+// space (seams and borders) and once in position space (borders only).
+// ----------------------------------------------------------------------
+static void classifyVertices(const vector<unsigned int>& indices, const vector<unsigned int>& group,
+                             const vector<unsigned int>& wedge, const vector<uint32_t>& materials, vector<unsigned char>& kinds)
+{
+    size_t vertexCount = group.size();
+    vector<uint64_t> edges;
+    vector<unsigned char> uses, positionUses;
+    sortedEdges(indices, edges, uses);
+
+    vector<unsigned int> positionIndices(indices.size());
+    for (size_t i = 0; i < indices.size(); i++)
+        positionIndices[i] = group[indices[i]];
+    sortedEdges(positionIndices, edges, positionUses);
+
+    vector<unsigned char> openEdge(vertexCount, 0), border(vertexCount, 0), complex(vertexCount, 0);
+    for (size_t i = 0; i < indices.size(); i += 3)
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+            if (uses[i + k] == 1)
+                openEdge[a] = openEdge[b] = 1;
+            if (positionUses[i + k] == 1)
+                border[group[a]] = border[group[b]] = 1;
+            if (uses[i + k] > 2 || positionUses[i + k] > 2)
+                complex[group[a]] = complex[group[b]] = 1;
+        }
+
+    kinds.resize(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        size_t wedges = wedgeCount(wedge, v);
+        if (complex[group[v]])
+            kinds[v] = KIND_LOCKED;
+        else if (border[group[v]])
+            kinds[v] = wedges == 1 ? KIND_BORDER : KIND_LOCKED;
+        else if (openEdge[v])
+            kinds[v] = wedges == 2 && openEdge[wedge[v]] ? KIND_SEAM : KIND_LOCKED;
+        else
+            kinds[v] = wedges == 1 ? KIND_MANIFOLD : KIND_LOCKED;
+    }
+
+    // Positions where materials meet stay put, so the material ranges keep
+    // their outlines and every triangle keeps its material.
+    if (materials.empty())
+        return;
+    const uint32_t unseen = ~0u, mixed = ~0u - 1;
+    vector<uint32_t> positionMaterial(vertexCount, unseen);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        uint32_t& material = positionMaterial[group[indices[i]]];
+        uint32_t triangleMaterial = materials[i / 3];
+        material = (material == unseen || material == triangleMaterial) ? triangleMaterial : mixed;
+    }
+    for (size_t v = 0; v < vertexCount; v++)
+        if (positionMaterial[group[v]] == mixed)
+            kinds[v] = KIND_LOCKED;
+}
+
+// Face quadrics weighted by area, plus planes standing on open edges so
+// borders and seams keep their outline.
+// ----------------------------------------------------------------------
+static void buildQuadrics(const Vertex* vertices, const vector<unsigned int>& indices, const vector<unsigned int>& group,
+                          vector<Quadric>& quadrics)
+{
+    Quadric zero;
+    memset(&zero, 0, sizeof(zero));
+    quadrics.assign(group.size(), zero);
+
+    vector<uint64_t> edges;
+    vector<unsigned char> uses;
+    sortedEdges(indices, edges, uses);
+
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; k++)
+            p[k] = vertices[indices[i + k]].position;
+        glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        float length = glm::length(normal);
+        if (length == 0.0f)
+            continue;
+        normal /= length;
+
+        for (int k = 0; k < 3; k++)
+            addPlane(quadrics[group[indices[i + k]]], normal, -glm::dot(normal, p[0]), length * 0.5f);
+
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int a = indices[i + k], b = indices[i + (k + 1) % 3];
+            if (uses[i + k] != 1)
+                continue;
+            glm::vec3 edge = p[(k + 1) % 3] - p[k];
+            glm::vec3 side = glm::cross(edge, normal);
+            float sideLength = glm::length(side);
+            if (sideLength == 0.0f)
+                continue;
+            side /= sideLength;
+            float weight = glm::dot(edge, edge) * edgeWeight;
+            addPlane(quadrics[group[a]], side, -glm::dot(side, p[k]), weight);
+            addPlane(quadrics[group[b]], side, -glm::dot(side, p[k]), weight);
+        }
+    }
+}
+
+// False if moving from to "to" turns any of its other triangles over.
+static bool keepsOrientation(const Vertex* vertices, const vector<unsigned int>& indices, const vector<unsigned int>& offsets,
+                             const vector<unsigned int>& adjacency, unsigned int from, unsigned int to)
+{
+    glm::vec3 target = vertices[to].position;
+    for (unsigned int j = offsets[from]; j < offsets[from + 1]; j++)
+    {
+        const unsigned int* triangle = &indices[adjacency[j] * 3];
+        if (triangle[0] == to || triangle[1] == to || triangle[2] == to)
+            continue;
+
+        glm::vec3 before[3], after[3];
+        for (int k = 0; k < 3; k++)
+        {
+            before[k] = vertices[triangle[k]].position;
+            after[k] = triangle[k] == from ? target : before[k];
+        }
+        glm::vec3 oldNormal = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 newNormal = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(oldNormal, newNormal) <= 0.0f)
+            return false;
+    }
+    return true;
+}
+
+struct Collapse
+{
+    unsigned int from, to;
+    float error;
+};
+
+// Quadric error simplification by half edge collapses, so the result only
+// uses existing vertices and they keep their UVs and normals. Each pass
+// collapses the cheapest edges whose neighbourhoods do not overlap. The
+// quadrics keep accumulating from one target to the next, so every level's
+// error is measured against the full mesh.
+// ------------------------------------------------------------------------
+void simplifyMesh(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                  const vector<size_t>& targetIndexCounts, vector<vector<unsigned int> >& levels, vector<float>& errors,
+                  const uint32_t* triangleMaterials, vector<vector<uint32_t> >* levelMaterials)
+{
+    levels.clear();
+    errors.clear();
+    if (levelMaterials)
+        levelMaterials->clear();
+    if (targetIndexCounts.empty() || vertexCount == 0)
+        return;
+
+    vector<unsigned int> result(indices, indices + indexCount);
+    vector<uint32_t> materials;
+    if (triangleMaterials)
+        materials.assign(triangleMaterials, triangleMaterials + indexCount / 3);
+    vector<unsigned int> group, wedge;
+    vector<unsigned char> kinds;
+    vector<Quadric> quadrics;
+    findWedges(vertices, vertexCount, group, wedge);
+    classifyVertices(result, group, wedge, materials, kinds);
+    buildQuadrics(vertices, result, group, quadrics);
+
+    vector<unsigned int> offsets, adjacency, remap(vertexCount);
+    vector<uint64_t> edges;
+    vector<unsigned char> uses, locked(vertexCount);
+    vector<Collapse> collapses;
+    float worstError = 0.0f;
+
+    while (levels.size() < targetIndexCounts.size())
+    {
+        size_t target = targetIndexCounts[levels.size()];
+        if (result.size() <= target)
+        {
+            levels.push_back(result);
+            errors.push_back(sqrtf(worstError));
+            if (levelMaterials)
+                levelMaterials->push_back(materials);
+            continue;
+        }
+
+        // Triangles around each vertex, in compressed rows.
+        offsets.assign(vertexCount + 1, 0);
+        for (size_t i = 0; i < result.size(); i++)
+            offsets[result[i] + 1]++;
+        for (size_t v = 0; v < vertexCount; v++)
+            offsets[v + 1] += offsets[v];
+        adjacency.resize(result.size());
+        vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < result.size(); i++)
+            adjacency[cursor[result[i]]++] = i / 3;
+        sortedEdges(result, edges, uses);
+
+        // Seam vertices move together with their twin, which needs an open
+        // edge to another wedge of the target on the other side of the seam.
+        auto twinTarget = [&](unsigned int from, unsigned int to) -> unsigned int
+        {
+            unsigned int twin = wedge[from];
+            for (unsigned int w = wedge[to]; w != to; w = wedge[w])
+                if (edgeUses(edges, twin, w) == 1)
+                    return w;
+            return ~0u;
+        };
+
+        auto allowed = [&](unsigned int from, unsigned int to, bool open) -> bool
+        {
+            switch (kinds[from])
+            {
+            case KIND_MANIFOLD:
+                return true;
+            case KIND_BORDER:
+                return open && (kinds[to] == KIND_BORDER || kinds[to] == KIND_LOCKED);
+            case KIND_SEAM:
+                return open && (kinds[to] == KIND_SEAM || kinds[to] == KIND_LOCKED) && twinTarget(from, to) != ~0u;
+            default:
+                return false;
+            }
+        };
+
+        // Interior edges appear once each way, open ones only once, so
+        // those are tried in both directions here.
+        collapses.clear();
+        for (size_t i = 0; i < result.size(); i += 3)
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+                bool open = uses[i + k] == 1;
+                for (int direction = 0; direction < (open ? 2 : 1); direction++)
+                {
+                    unsigned int from = direction ? b : a, to = direction ? a : b;
+                    if (!allowed(from, to, open))
+                        continue;
+                    Collapse collapse = { from, to, quadricError(quadrics[group[from]], vertices[to].position) };
+                    collapses.push_back(collapse);
+                }
+            }
+        sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+        for (size_t v = 0; v < vertexCount; v++)
+            remap[v] = v;
+        fill_n(locked.begin(), vertexCount, 0);
+
+        // Most collapses remove two triangles. Ones much worse than the
+        // cheapest that would reach the goal, or than what was already
+        // accepted, wait for a later pass where their neighbours may offer
+        // something better.
+        size_t goal = (result.size() - target) / 3, removed = 0;
+        float errorLimit = collapses.empty() ? 0.0f : collapses[min(goal / 2, collapses.size() - 1)].error;
+        errorLimit = max(errorLimit, worstError) * passErrorBound;
+        bool applied = false;
+
+        for (size_t c = 0; c < collapses.size() && removed < goal && (collapses[c].error <= errorLimit || !applied); c++)
+        {
+            unsigned int from = collapses[c].from, to = collapses[c].to;
+            unsigned int twin = ~0u, twinTo = ~0u;
+            if (kinds[from] == KIND_SEAM)
+            {
+                twin = wedge[from];
+                twinTo = twinTarget(from, to);
+            }
+
+            if (locked[from] || locked[to] || (twin != ~0u && (locked[twin] || locked[twinTo])))
+                continue;
+            if (!keepsOrientation(vertices, result, offsets, adjacency, from, to) ||
+                (twin != ~0u && !keepsOrientation(vertices, result, offsets, adjacency, twin, twinTo)))
+                continue;
+
+            // Everything touching the moved vertices waits for the next pass,
+            // so the orientation checks above stay valid.
+            unsigned int moved[2] = { from, twin };
+            for (int m = 0; m < 2 && moved[m] != ~0u; m++)
+                for (unsigned int j = offsets[moved[m]]; j < offsets[moved[m] + 1]; j++)
+                {
+                    const unsigned int* triangle = &result[adjacency[j] * 3];
+                    for (int k = 0; k < 3; k++)
+                        locked[triangle[k]] = 1;
+                }
+            locked[to] = 1;
+            remap[from] = to;
+            if (twin != ~0u)
+            {
+                locked[twinTo] = 1;
+                remap[twin] = twinTo;
+            }
+
+            removed += edgeUses(edges, from, to) + (twin != ~0u ? edgeUses(edges, twin, twinTo) : 0);
+            addQuadric(quadrics[group[to]], quadrics[group[from]]);
+            worstError = max(worstError, collapses[c].error);
+            applied = true;
+        }
+
+        // Nothing left that can collapse, the remaining levels are not made.
+        if (!applied)
+            break;
+
+        // Drops the triangles that lost an edge.
+        size_t write = 0;
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+            if (a == b || b == c || c == a)
+                continue;
+            if (!materials.empty())
+                materials[write / 3] = materials[i / 3];
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+        if (!materials.empty())
+            materials.resize(write / 3);
+    }
+}
@@ -0,0 +1,576 @@
+#include "Application.hpp"
+
+#include <float.h>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#define TANGENT_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TANGENT_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Normal of vertices no face gives one, the same as the .obj loader's.
+static const glm::vec3 up(0.0f, 0.0f, 1.0f);
+
+// Work split: triangles per range summed on one worker, vertices per block
+// added up on one. Fixed sizes so results do not depend on the thread count.
+static const size_t trianglesPerRange = 1 << 16;
+static const size_t verticesPerBlock = 1 << 16;
+
+// Offsets of the attributes in Vertex, in floats.
+static const size_t floatsPerVertex = sizeof(Vertex) / sizeof(float);
+static const size_t positionOffset = offsetof(Vertex, position) / sizeof(float);
+static const size_t normalOffset = offsetof(Vertex, normal) / sizeof(float);
+static const size_t texCoordOffset = offsetof(Vertex, texCoord) / sizeof(float);
+
+// Batches gather with 32 bit float offsets, larger meshes go one at a time.
+static const size_t maxBatchedVertices = (size_t) 1 << 28;
+
+// Lane types the kernels below are written against. One triangle per lane,
+// float for a single one. Comparisons give a mask, select() picks by it.
+// ------------------------------------------------------------------------
+struct ScalarLanes
+{
+    typedef float F;
+    static const int width = 1;
+    static F gather(const float* base, const unsigned int* vertices) { return base[vertices[0] * floatsPerVertex]; }
+    static void store(float* out, F value) { *out = value; }
+};
+
+static inline float squareRoot(float a) { return sqrtf(a); }
+static inline float minimum(float a, float b) { return a < b ? a : b; }
+static inline float maximum(float a, float b) { return a > b ? a : b; }
+static inline bool greaterThan(float a, float b) { return a > b; }
+static inline float select(bool mask, float a, float b) { return mask ? a : b; }
+
+#ifdef TANGENT_AVX2
+struct Float8
+{
+    Float8() {}
+    Float8(__m256 v) : v(v) {}
+    Float8(float f) : v(_mm256_set1_ps(f)) {}
+    __m256 v;
+};
+
+static inline Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+static inline Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+static inline Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+static inline Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.v, b.v); }
+static inline Float8 squareRoot(Float8 a) { return _mm256_sqrt_ps(a.v); }
+static inline Float8 minimum(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+static inline Float8 maximum(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+static inline Float8 greaterThan(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+static inline Float8 select(Float8 mask, Float8 a, Float8 b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+
+struct VectorLanes
+{
+    typedef Float8 F;
+    static const int width = 8;
+    static F gather(const float* base, const unsigned int* vertices)
+    {
+        __m256i offsets = _mm256_slli_epi32(_mm256_loadu_si256((const __m256i*) vertices), 3);
+        return _mm256_i32gather_ps(base, offsets, sizeof(float));
+    }
+    static void store(float* out, F value) { _mm256_storeu_ps(out, value.v); }
+};
+static_assert(sizeof(Vertex) == 8 * sizeof(float), "gather() scales vertex indices by 8 floats");
+#endif
+
+#ifdef TANGENT_SSE
+struct Float4
+{
+    Float4() {}
+    Float4(__m128 v) : v(v) {}
+    Float4(float f) : v(_mm_set1_ps(f)) {}
+    __m128 v;
+};
+
+static inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+static inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+static inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+static inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+static inline Float4 squareRoot(Float4 a) { return _mm_sqrt_ps(a.v); }
+static inline Float4 minimum(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+static inline Float4 maximum(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+static inline Float4 greaterThan(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+static inline Float4 select(Float4 mask, Float4 a, Float4 b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+
+struct VectorLanes
+{
+    typedef Float4 F;
+    static const int width = 4;
+    static F gather(const float* base, const unsigned int* vertices)
+    {
+        return _mm_setr_ps(base[vertices[0] * floatsPerVertex], base[vertices[1] * floatsPerVertex],
+                           base[vertices[2] * floatsPerVertex], base[vertices[3] * floatsPerVertex]);
+    }
+    static void store(float* out, F value) { _mm_storeu_ps(out, value.v); }
+};
+#endif
+
+// Three lane vectors, one component each.
+template <typename F>
+struct Lanes3
+{
+    F x, y, z;
+};
+
+template <typename F>
+static inline Lanes3<F> operator-(const Lanes3<F>& a, const Lanes3<F>& b)
+{
+    Lanes3<F> r = { a.x - b.x, a.y - b.y, a.z - b.z };
+    return r;
+}
+
+template <typename F>
+static inline Lanes3<F> scaled(const Lanes3<F>& a, F s)
+{
+    Lanes3<F> r = { a.x * s, a.y * s, a.z * s };
+    return r;
+}
+
+template <typename F>
+static inline F dot(const Lanes3<F>& a, const Lanes3<F>& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <typename F>
+static inline Lanes3<F> cross(const Lanes3<F>& a, const Lanes3<F>& b)
+{
+    Lanes3<F> r = { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    return r;
+}
+
+// Unit length, or left as is when too short to divide by, like MikkTSpace.
+template <typename F>
+static inline Lanes3<F> normalizeNonZero(const Lanes3<F>& a)
+{
+    F length = squareRoot(dot(a, a));
+    return scaled(a, select(greaterThan(length, F(FLT_MIN)), F(1.0f) / length, F(1.0f)));
+}
+
+// a minus its part along the unit vector n.
+template <typename F>
+static inline Lanes3<F> projectOut(const Lanes3<F>& a, const Lanes3<F>& n)
+{
+    return a - scaled(n, dot(n, a));
+}
+
+template <typename L>
+static inline Lanes3<typename L::F> gather3(const float* base, const unsigned int* vertices)
+{
+    Lanes3<typename L::F> r = { L::gather(base, vertices), L::gather(base + 1, vertices), L::gather(base + 2, vertices) };
+    return r;
+}
+
+// Abramowitz and Stegun 4.4.46, within 2e-8 of acos over [-1, 1].
+template <typename F>
+static inline F arcCos(F x)
+{
+    F a = maximum(x, F(0.0f) - x);
+    F p = F(-0.0012624911f);
+    p = p * a + F(0.0066700901f);
+    p = p * a + F(-0.0170881256f);
+    p = p * a + F(0.0308918810f);
+    p = p * a + F(-0.0501743046f);
+    p = p * a + F(0.0889789874f);
+    p = p * a + F(-0.2145988016f);
+    p = p * a + F(1.5707963050f);
+    F r = squareRoot(maximum(F(1.0f) - a, F(0.0f))) * p;
+    return select(greaterThan(F(0.0f), x), F(3.14159265f) - r, r);
+}
+
+// Angle between two edges leaving a corner, zero if either has no length.
+template <typename F>
+static inline F cornerAngle(const Lanes3<F>& a, const Lanes3<F>& b)
+{
+    F lengths = squareRoot(dot(a, a) * dot(b, b));
+    F cosine = select(greaterThan(lengths, F(0.0f)), dot(a, b) / lengths, F(1.0f));
+    return arcCos(minimum(maximum(cosine, F(-1.0f)), F(1.0f)));
+}
+
+// Adds the weighted face normal of triangles [first, last) to sums[v - base]
+// at each of their corners, L::width triangles at a time. Returns the first
+// triangle of the tail too short for a whole batch.
+// -------------------------------------------------------------------------
+template <typename L>
+static size_t addNormalBatches(const Vertex* vertices, const unsigned int* indices, size_t first, size_t last,
+                               NormalWeighting weighting, glm::vec3* sums, size_t base)
+{
+    typedef typename L::F F;
+    const float* positions = (const float*) vertices + positionOffset;
+
+    size_t t = first;
+    for (; t + L::width <= last; t += L::width)
+    {
+        unsigned int corners[3][L::width];
+        for (int i = 0; i < L::width; i++)
+            for (int k = 0; k < 3; k++)
+                corners[k][i] = indices[(t + i) * 3 + k];
+
+        Lanes3<F> p0 = gather3<L>(positions, corners[0]);
+        Lanes3<F> p1 = gather3<L>(positions, corners[1]);
+        Lanes3<F> p2 = gather3<L>(positions, corners[2]);
+        Lanes3<F> e1 = p1 - p0, e2 = p2 - p0;
+        Lanes3<F> normal = cross(e1, e2);
+
+        // The cross product is the area weighted normal as it is.
+        float x[L::width], y[L::width], z[L::width], w[3][L::width];
+        if (weighting == NORMALS_AREA)
+        {
+            L::store(x, normal.x);
+            L::store(y, normal.y);
+            L::store(z, normal.z);
+            for (int i = 0; i < L::width; i++)
+                for (int k = 0; k < 3; k++)
+                    sums[corners[k][i] - base] += glm::vec3(x[i], y[i], z[i]);
+            continue;
+        }
+
+        F length = squareRoot(dot(normal, normal));
+        normal = scaled(normal, select(greaterThan(length, F(0.0f)), F(1.0f) / length, F(0.0f)));
+        Lanes3<F> e3 = p2 - p1;
+        L::store(x, normal.x);
+        L::store(y, normal.y);
+        L::store(z, normal.z);
+        L::store(w[0], cornerAngle(e1, e2));
+        L::store(w[1], cornerAngle(p0 - p1, e3));
+        L::store(w[2], cornerAngle(e2, e3));
+        for (int i = 0; i < L::width; i++)
+            for (int k = 0; k < 3; k++)
+                sums[corners[k][i] - base] += glm::vec3(x[i], y[i], z[i]) * w[k][i];
+    }
+    return t;
+}
+
+// MikkTSpace's per corner tangent of triangles [first, last): the face's uv
+// tangent with the vertex normal projected out, weighted by the corner angle
+// in the normal's plane. w sums the angles signed by the face's orientation
+// in uv space. Triangles without uv area add nothing, as MikkTSpace leaves
+// them out of its groups.
+// --------------------------------------------------------------------------
+template <typename L>
+static size_t addTangentBatches(const Vertex* vertices, const unsigned int* indices, size_t first, size_t last,
+                                glm::vec4* sums, size_t base)
+{
+    typedef typename L::F F;
+    const float* floats = (const float*) vertices;
+
+    size_t t = first;
+    for (; t + L::width <= last; t += L::width)
+    {
+        unsigned int corners[3][L::width];
+        for (int i = 0; i < L::width; i++)
+            for (int k = 0; k < 3; k++)
+                corners[k][i] = indices[(t + i) * 3 + k];
+
+        Lanes3<F> p[3], n[3];
+        F u[3], v[3];
+        for (int k = 0; k < 3; k++)
+        {
+            p[k] = gather3<L>(floats + positionOffset, corners[k]);
+            n[k] = gather3<L>(floats + normalOffset, corners[k]);
+            u[k] = L::gather(floats + texCoordOffset, corners[k]);
+            v[k] = L::gather(floats + texCoordOffset + 1, corners[k]);
+        }
+
+        Lanes3<F> d1 = p[1] - p[0], d2 = p[2] - p[0];
+        F u21 = u[1] - u[0], v21 = v[1] - v[0], u31 = u[2] - u[0], v31 = v[2] - v[0];
+        F signedArea = u21 * v31 - v21 * u31;
+        Lanes3<F> face = scaled(d1, v31) - scaled(d2, v21);
+
+        F orientation = select(greaterThan(signedArea, F(0.0f)), F(1.0f), F(-1.0f));
+        F length = squareRoot(dot(face, face));
+        auto valid = greaterThan(maximum(signedArea, F(0.0f) - signedArea), F(FLT_MIN));
+        face = scaled(face, select(greaterThan(length, F(FLT_MIN)), orientation / length, orientation));
+
+        float x[3][L::width], y[3][L::width], z[3][L::width], w[3][L::width];
+        for (int k = 0; k < 3; k++)
+        {
+            const Lanes3<F>& normal = n[k];
+            Lanes3<F> tangent = normalizeNonZero(projectOut(face, normal));
+            Lanes3<F> toPrevious = normalizeNonZero(projectOut(p[(k + 2) % 3] - p[k], normal));
+            Lanes3<F> toNext = normalizeNonZero(projectOut(p[(k + 1) % 3] - p[k], normal));
+            F angle = select(valid, arcCos(minimum(maximum(dot(toPrevious, toNext), F(-1.0f)), F(1.0f))), F(0.0f));
+
+            L::store(x[k], tangent.x * angle);
+            L::store(y[k], tangent.y * angle);
+            L::store(z[k], tangent.z * angle);
+            L::store(w[k], orientation * angle);
+        }
+
+        for (int i = 0; i < L::width; i++)
+            for (int k = 0; k < 3; k++)
+                sums[corners[k][i] - base] += glm::vec4(x[k][i], y[k][i], z[k][i], w[k][i]);
+    }
+    return t;
+}
+
+static void addNormals(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t first, size_t last,
+                       NormalWeighting weighting, glm::vec3* sums, size_t base)
+{
+    // A bare cross product is too little work to pay for gathering the
+    // corners into lanes, area weighted normals go one at a time.
+#if defined(TANGENT_AVX2) || defined(TANGENT_SSE)
+    if (weighting == NORMALS_ANGLE && vertexCount <= maxBatchedVertices)
+        first = addNormalBatches<VectorLanes>(vertices, indices, first, last, weighting, sums, base);
+#else
+    (void) vertexCount;
+#endif
+    addNormalBatches<ScalarLanes>(vertices, indices, first, last, weighting, sums, base);
+}
+
+static void addTangents(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t first, size_t last,
+                        glm::vec4* sums, size_t base)
+{
+#if defined(TANGENT_AVX2) || defined(TANGENT_SSE)
+    if (vertexCount <= maxBatchedVertices)
+        first = addTangentBatches<VectorLanes>(vertices, indices, first, last, sums, base);
+#else
+    (void) vertexCount;
+#endif
+    addTangentBatches<ScalarLanes>(vertices, indices, first, last, sums, base);
+}
+
+const char* tangentInstructionSet()
+{
+#if defined(TANGENT_AVX2)
+    return "AVX2";
+#elif defined(TANGENT_SSE)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+// Triangles [first, last) and the vertices [low, high) they touch.
+struct TriangleSpan
+{
+    size_t first, last;
+    size_t low, high;
+};
+
+// Sums the per corner values add() gives every triangle into one T per
+// vertex and hands each total to finish(). On a pool, every range of
+// triangles sums into a buffer covering just the vertices it touches, so no
+// two workers ever write the same memory, then blocks of vertices add up the
+// buffers overlapping them. Adjacent ranges merge until the buffers take at
+// most twice the vertex count, which only costs parallelism on meshes whose
+// index order jumps all over the vertices (optimizeVertexFetch() fixes that).
+// ---------------------------------------------------------------------------
+template <typename T, typename Add, typename Finish>
+static void accumulate(size_t vertexCount, const unsigned int* indices, size_t triangleCount, ThreadPool* pool,
+                       const Add& add, const Finish& finish)
+{
+    size_t rangeCount = (triangleCount + trianglesPerRange - 1) / trianglesPerRange;
+    if (!pool || rangeCount <= 1)
+    {
+        vector<T> sums(vertexCount, T(0.0f));
+        add(0, triangleCount, sums.data(), 0);
+        for (size_t v = 0; v < vertexCount; v++)
+            finish(v, sums[v]);
+        return;
+    }
+
+    vector<TriangleSpan> spans(rangeCount);
+    pool->parallelFor(rangeCount, [&](size_t r)
+    {
+        TriangleSpan& span = spans[r];
+        span.first = r * trianglesPerRange;
+        span.last = min(span.first + trianglesPerRange, triangleCount);
+        unsigned int low = ~0u, high = 0;
+        for (size_t i = span.first * 3; i < span.last * 3; i++)
+        {
+            low = min(low, indices[i]);
+            high = max(high, indices[i]);
+        }
+        span.low = low;
+        span.high = (size_t) high + 1;
+    });
+
+    size_t covered = 0;
+    for (size_t r = 0; r < spans.size(); r++)
+        covered += spans[r].high - spans[r].low;
+    while (covered > 2 * vertexCount && spans.size() > 1)
+    {
+        vector<TriangleSpan> merged;
+        for (size_t r = 0; r < spans.size(); r += 2)
+        {
+            TriangleSpan span = spans[r];
+            if (r + 1 < spans.size())
+            {
+                span.last = spans[r + 1].last;
+                span.low = min(span.low, spans[r + 1].low);
+                span.high = max(span.high, spans[r + 1].high);
+            }
+            merged.push_back(span);
+        }
+        spans.swap(merged);
+        covered = 0;
+        for (size_t r = 0; r < spans.size(); r++)
+            covered += spans[r].high - spans[r].low;
+    }
+
+    vector<vector<T> > partial(spans.size());
+    pool->parallelFor(spans.size(), [&](size_t r)
+    {
+        partial[r].assign(spans[r].high - spans[r].low, T(0.0f));
+        add(spans[r].first, spans[r].last, partial[r].data(), spans[r].low);
+    });
+
+    pool->parallelFor((vertexCount + verticesPerBlock - 1) / verticesPerBlock, [&](size_t b)
+    {
+        size_t low = b * verticesPerBlock, high = min(low + verticesPerBlock, vertexCount);
+        vector<size_t> overlapping;
+        for (size_t r = 0; r < spans.size(); r++)
+            if (spans[r].low < high && spans[r].high > low)
+                overlapping.push_back(r);
+
+        for (size_t v = low; v < high; v++)
+        {
+            T sum(0.0f);
+            for (size_t i = 0; i < overlapping.size(); i++)
+            {
+                const TriangleSpan& span = spans[overlapping[i]];
+                if (v >= span.low && v < span.high)
+                    sum += partial[overlapping[i]][v - span.low];
+            }
+            finish(v, sum);
+        }
+    });
+}
+
+// Unit tangent from a summed one, or any direction across the normal if the
+// faces around gave none.
+static glm::vec4 finishTangent(const glm::vec4& sum, const glm::vec3& normal)
+{
+    glm::vec3 tangent(sum.x, sum.y, sum.z);
+    float length = glm::length(tangent);
+    if (length > FLT_MIN)
+        tangent = tangent / length;
+    else
+    {
+        glm::vec3 axis = fabsf(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        tangent = glm::cross(glm::cross(normal, axis), normal);
+        length = glm::length(tangent);
+        tangent = length > FLT_MIN ? tangent / length : axis;
+    }
+    return glm::vec4(tangent, sum.w < 0.0f ? -1.0f : 1.0f);
+}
+
+void computeNormals(Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                    NormalWeighting weighting, ThreadPool* pool)
+{
+    // Reads positions and writes normals, separate floats of the same vertices.
+    accumulate<glm::vec3>(vertexCount, indices, indexCount / 3, pool,
+        [&](size_t first, size_t last, glm::vec3* sums, size_t base)
+        {
+            addNormals(vertices, vertexCount, indices, first, last, weighting, sums, base);
+        },
+        [&](size_t v, const glm::vec3& sum)
+        {
+            float length = glm::length(sum);
+            vertices[v].normal = length > 0.0f ? sum / length : up;
+        });
+}
+
+void computeTangents(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                     glm::vec4* tangents, ThreadPool* pool)
+{
+    accumulate<glm::vec4>(vertexCount, indices, indexCount / 3, pool,
+        [&](size_t first, size_t last, glm::vec4* sums, size_t base)
+        {
+            addTangents(vertices, vertexCount, indices, first, last, sums, base);
+        },
+        [&](size_t v, const glm::vec4& sum)
+        {
+            tangents[v] = finishTangent(sum, vertices[v].normal);
+        });
+}
+
+// Angle between two edges leaving a corner, zero if either has no length.
+static float cornerAngle(const glm::vec3& a, const glm::vec3& b)
+{
+    float lengths = sqrtf(glm::dot(a, a) * glm::dot(b, b));
+    if (!(lengths > 0.0f))
+        return 0.0f;
+    return acosf(max(-1.0f, min(1.0f, glm::dot(a, b) / lengths)));
+}
+
+// Unit length, or left as is when too short to divide by.
+static glm::vec3 normalizeNonZero(const glm::vec3& a)
+{
+    float length = glm::length(a);
+    return length > FLT_MIN ? a / length : a;
+}
+
+void computeNormalsScalar(Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                          NormalWeighting weighting)
+{
+    vector<glm::vec3> sums(vertexCount, glm::vec3(0.0f));
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const glm::vec3& p0 = vertices[indices[i]].position;
+        const glm::vec3& p1 = vertices[indices[i + 1]].position;
+        const glm::vec3& p2 = vertices[indices[i + 2]].position;
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        if (weighting == NORMALS_AREA)
+        {
+            for (int k = 0; k < 3; k++)
+                sums[indices[i + k]] += normal;
+            continue;
+        }
+
+        float length = glm::length(normal);
+        normal = length > 0.0f ? normal / length : glm::vec3(0.0f);
+        sums[indices[i]] += normal * cornerAngle(p1 - p0, p2 - p0);
+        sums[indices[i + 1]] += normal * cornerAngle(p0 - p1, p2 - p1);
+        sums[indices[i + 2]] += normal * cornerAngle(p0 - p2, p1 - p2);
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        float length = glm::length(sums[v]);
+        vertices[v].normal = length > 0.0f ? sums[v] / length : up;
+    }
+}
+
+void computeTangentsScalar(const Vertex* vertices, size_t vertexCount, const unsigned int* indices, size_t indexCount,
+                           glm::vec4* tangents)
+{
+    vector<glm::vec4> sums(vertexCount, glm::vec4(0.0f));
+    for (size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        const Vertex* corners[3] = { &vertices[indices[i]], &vertices[indices[i + 1]], &vertices[indices[i + 2]] };
+        glm::vec3 d1 = corners[1]->position - corners[0]->position;
+        glm::vec3 d2 = corners[2]->position - corners[0]->position;
+        glm::vec2 t21 = corners[1]->texCoord - corners[0]->texCoord;
+        glm::vec2 t31 = corners[2]->texCoord - corners[0]->texCoord;
+        float signedArea = t21.x * t31.y - t21.y * t31.x;
+        if (!(fabsf(signedArea) > FLT_MIN))
+            continue;
+
+        float orientation = signedArea > 0.0f ? 1.0f : -1.0f;
+        glm::vec3 face = normalizeNonZero(d1 * t31.y - d2 * t21.y) * orientation;
+        for (int k = 0; k < 3; k++)
+        {
+            const glm::vec3& normal = corners[k]->normal;
+            const glm::vec3& p = corners[k]->position;
+            glm::vec3 tangent = normalizeNonZero(face - normal * glm::dot(normal, face));
+            glm::vec3 toPrevious = corners[(k + 2) % 3]->position - p;
+            glm::vec3 toNext = corners[(k + 1) % 3]->position - p;
+            toPrevious = normalizeNonZero(toPrevious - normal * glm::dot(normal, toPrevious));
+            toNext = normalizeNonZero(toNext - normal * glm::dot(normal, toNext));
+            float angle = acosf(max(-1.0f, min(1.0f, glm::dot(toPrevious, toNext))));
+            sums[indices[i + k]] += glm::vec4(tangent * angle, orientation * angle);
+        }
+    }
+
+    for (size_t v = 0; v < vertexCount; v++)
+        tangents[v] = finishTangent(sums[v], vertices[v].normal);
+}
@@ -0,0 +1,219 @@
+#include "Application.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+Image::~Image()
+{
+    if (data)
+        stbi_image_free(data);
+}
+
+Texture& Texture::operator=(Texture&& other)
+{
+    if (this != &other)
+    {
+        if (id)
+            glDeleteTextures(1, &id);
+        id = other.id;
+        type = other.type;
+        other.id = 0;
+    }
+    return *this;
+}
+
+Texture::~Texture()
+{
+    if (id)
+        glDeleteTextures(1, &id);
+}
+
+// Decodes an image file to 8 bit RGB, bottom row first the way OpenGL wants
+// it. The rows are flipped here rather than through stb_image's global flip
+// setting, so it is safe to call from worker threads.
+// --------------------------------------------------------------------------
+bool loadImage(const char* path, Image& image)
+{
+    int channels;
+    image.data = stbi_load(path, &image.width, &image.height, &channels, 3);
+    if (!image.data)
+        return false;
+
+    size_t rowBytes = (size_t) image.width * 3;
+    for (int y = 0; y < image.height / 2; y++)
+    {
+        unsigned char* top = image.data + y * rowBytes;
+        unsigned char* bottom = image.data + (image.height - 1 - y) * rowBytes;
+        swap_ranges(top, top + rowBytes, bottom);
+    }
+    return true;
+}
+
+// Binary PPM, flipped so the top row comes first.
+bool writeImage(const char* path, const unsigned char* rgba, int width, int height)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    bool ok = fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+    vector<unsigned char> row(width * 3);
+    for (int y = height - 1; y >= 0 && ok; y--)
+    {
+        const unsigned char* source = rgba + (size_t) y * width * 4;
+        for (int x = 0; x < width; x++)
+        {
+            row[x * 3] = source[x * 4];
+            row[x * 3 + 1] = source[x * 4 + 1];
+            row[x * 3 + 2] = source[x * 4 + 2];
+        }
+        ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return (fclose(file) == 0) && ok;
+}
+
+// Creates a GL texture from a decoded image and generates its mipmaps.
+// ---------------------------------------------------------------------
+Texture uploadTexture(const Image& image, const SamplerParams& params)
+{
+    Texture texture;
+    texture.type = params.type;
+    glGenTextures(1, &(texture.id));
+    glBindTexture(texture.type, texture.id);
+    // Set wrapping parameters.
+    glTexParameteri(texture.type, GL_TEXTURE_WRAP_S, params.wrap);
+    glTexParameteri(texture.type, GL_TEXTURE_WRAP_T, params.wrap);
+    // Set filtering parameters.
+    glTexParameteri(texture.type, GL_TEXTURE_MIN_FILTER, params.minFilter);
+    glTexParameteri(texture.type, GL_TEXTURE_MAG_FILTER, params.magFilter);
+
+    // Rows of RGB pixels are not 4 byte aligned for odd widths.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(texture.type, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data);
+    glGenerateMipmap(texture.type);
+    return texture;
+}
+
+// Texture owned by the returned pointer alone, deleted with the last copy.
+shared_ptr<Texture> createTexture(const Image& image, const SamplerParams& params)
+{
+    return make_shared<Texture>(uploadTexture(image, params));
+}
+
+// Pre-compressed textures are made by tools/texconvert and need no decoding.
+bool isCompressedTexture(const string& path)
+{
+    return path.size() > 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0;
+}
+
+// The .ktx2 next to an image if one was converted, otherwise the image itself.
+string compressedTexturePath(const string& path)
+{
+    size_t dot = path.find_last_of('.');
+    string compressed = path.substr(0, dot) + ".ktx2";
+    FILE* file = fopen(compressed.c_str(), "rb");
+    if (!file)
+        return path;
+    fclose(file);
+    return compressed;
+}
+
+// Loads and uploads a texture file of any supported kind.
+bool loadTexture(const char* path, const SamplerParams& params, Texture& texture)
+{
+    if (isCompressedTexture(path))
+        return loadKtx2Texture(path, params, texture);
+
+    Image image;
+    if (!loadImage(path, image))
+        return false;
+    texture = uploadTexture(image, params);
+    return true;
+}
+
+// Texture file owned by the returned pointer, NULL if it cannot be loaded.
+shared_ptr<Texture> createTexture(const char* path, const SamplerParams& params)
+{
+    Texture texture;
+    if (!loadTexture(path, params, texture))
+        return shared_ptr<Texture>();
+    return make_shared<Texture>(move(texture));
+}
+
+static string cacheKey(const string& path, const SamplerParams& params)
+{
+    char state[64];
+    snprintf(state, sizeof(state), "|%x|%x|%x|%x", params.type, params.wrap, params.minFilter, params.magFilter);
+    return path + state;
+}
+
+TextureCache::TextureCache() : entries(make_shared<Entries>()), hitCount(0), missCount(0)
+{
+}
+
+// Returns the shared texture for path, creating it on a miss. A decoded image
+// can be passed in when it is already at hand, e.g. from the AssetLoader.
+// Returns NULL if the image cannot be loaded.
+// ---------------------------------------------------------------------------
+shared_ptr<Texture> TextureCache::acquire(const string& path, const SamplerParams& params, const Image* decoded)
+{
+    string key = cacheKey(path, params);
+    {
+        lock_guard<mutex> lock(entries->mutex);
+        map<string, weak_ptr<Texture> >::iterator it = entries->textures.find(key);
+        shared_ptr<Texture> texture = (it != entries->textures.end()) ? it->second.lock() : shared_ptr<Texture>();
+        if (texture)
+        {
+            hitCount++;
+            return texture;
+        }
+    }
+    missCount++;
+
+    Texture created;
+    if (decoded)
+        created = uploadTexture(*decoded, params);
+    else if (!loadTexture(path.c_str(), params, created))
+        return shared_ptr<Texture>();
+
+    // The deleter drops the entry too, unless a newer texture took its place.
+    shared_ptr<Entries> owner = entries;
+    shared_ptr<Texture> texture(new Texture(move(created)), [owner, key](Texture* texture)
+    {
+        {
+            lock_guard<mutex> lock(owner->mutex);
+            map<string, weak_ptr<Texture> >::iterator it = owner->textures.find(key);
+            if (it != owner->textures.end() && it->second.expired())
+                owner->textures.erase(it);
+        }
+        delete texture;
+    });
+
+    lock_guard<mutex> lock(entries->mutex);
+    entries->textures[key] = texture;
+    return texture;
+}
+
+bool TextureCache::contains(const string& path, const SamplerParams& params)
+{
+    lock_guard<mutex> lock(entries->mutex);
+    map<string, weak_ptr<Texture> >::iterator it = entries->textures.find(cacheKey(path, params));
+    return it != entries->textures.end() && !it->second.expired();
+}
+
+// Number of textures currently alive.
+size_t TextureCache::size()
+{
+    lock_guard<mutex> lock(entries->mutex);
+    size_t alive = 0;
+    for (map<string, weak_ptr<Texture> >::iterator it = entries->textures.begin(); it != entries->textures.end(); ++it)
+        if (!it->second.expired())
+            alive++;
+    return alive;
+}
+
+void TextureCache::printStats()
+{
+    cout << "Texture cache: " << size() << " textures, " << hitCount << " hits, " << missCount << " misses" << endl;
+}
@@ -0,0 +1,132 @@
+#include "Application.hpp"
+
+using namespace std;
+
+// Loads on a worker leave up to this much in its arena for the next job.
+static const size_t keptArenaBytes = 64 << 20;
+
+// Starts the worker threads, one per hardware thread when no count is given.
+// --------------------------------------------------------------------------
+ThreadPool::ThreadPool(unsigned int threadCount) : stopping(false)
+{
+    if (threadCount == 0)
+        threadCount = max(1u, thread::hardware_concurrency());
+
+    for (unsigned int i = 0; i < threadCount; i++)
+        workers.push_back(thread(&ThreadPool::run, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+// Pool shared by the loaders, created on first use.
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::enqueue(function<void()> job)
+{
+    {
+        lock_guard<mutex> lock(queueMutex);
+        jobs.push_back(job);
+    }
+    jobAvailable.notify_one();
+}
+
+// Runs body(0) .. body(count - 1) across the pool and returns once all are done.
+// The calling thread takes items too, so this is safe to call from inside a job.
+// -------------------------------------------------------------------------------
+void ThreadPool::parallelFor(size_t count, const function<void(size_t)>& body)
+{
+    struct State
+    {
+        atomic<size_t> next;
+        atomic<size_t> done;
+        mutex doneMutex;
+        condition_variable allDone;
+        size_t count;
+        const function<void(size_t)>* body;
+    };
+
+    if (count == 0)
+        return;
+    if (count == 1)
+    {
+        body(0);
+        return;
+    }
+
+    // Helpers may still be queued after we return, so the state is shared.
+    shared_ptr<State> state = make_shared<State>();
+    state->next = 0;
+    state->done = 0;
+    state->count = count;
+    state->body = &body;
+
+    function<void()> work = [state]()
+    {
+        size_t finished = 0;
+        for (size_t i = state->next++; i < state->count; i = state->next++)
+        {
+            (*state->body)(i);
+            finished++;
+        }
+        if (finished && state->done.fetch_add(finished) + finished == state->count)
+        {
+            lock_guard<mutex> lock(state->doneMutex);
+            state->allDone.notify_all();
+        }
+    };
+
+    size_t helpers = min(count - 1, workers.size());
+    for (size_t i = 0; i < helpers; i++)
+        enqueue(work);
+
+    work();
+
+    unique_lock<mutex> lock(state->doneMutex);
+    while (state->done < count)
+        state->allDone.wait(lock);
+}
+
+// Takes jobs until the pool stops. Going idle the worker's arena goes back
+// to the heap, so a block is reused only by loads queued back to back; the
+// first load after an idle spell allocates its block again.
+// --------------------------------------------------------------------------
+void ThreadPool::run()
+{
+    Arena& arena = Arena::forThisThread();
+    arena.keepBytes = keptArenaBytes;
+
+    while (1)
+    {
+        function<void()> job;
+        {
+            unique_lock<mutex> lock(queueMutex);
+            if (!stopping && jobs.empty() && arena.capacity() > 0)
+            {
+                lock.unlock();
+                arena.release();
+                lock.lock();
+            }
+            while (!stopping && jobs.empty())
+                jobAvailable.wait(lock);
+            if (stopping && jobs.empty())
+                return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -0,0 +1,188 @@
+#include "../Application.hpp"
+
+#include <chrono>
+#include <sstream>
+
+using namespace std;
+
+// Renders models offscreen from a list of camera poses, for thumbnails and
+// image regression tests. Needs no window or GPU, Mesa's llvmpipe works.
+// Every line of the job file is
+//   model.obj texture.jpg eyeX eyeY eyeZ targetX targetY targetZ
+// and renders to DIR/NNNN.ppm. Materials with a diffuse map in the model's
+// .mtl files draw with it, the texture covers the others. With --reference
+// each image is also compared with the one of the same name there, failing
+// below --min-psnr.
+// Usage: batchrender [--size WxH] [--out DIR] [--reference DIR] [--min-psnr DB] jobs.txt
+
+struct Job
+{
+    string model, texture;
+    glm::vec3 eye, target;
+};
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool readJobs(const char* path, vector<Job>& jobs)
+{
+    ifstream file(path);
+    if (!file)
+        return false;
+
+    string line;
+    for (int number = 1; getline(file, line); number++)
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        istringstream fields(line);
+        Job job;
+        if (!(fields >> job.model >> job.texture >> job.eye.x >> job.eye.y >> job.eye.z >> job.target.x >> job.target.y >> job.target.z))
+        {
+            cerr << path << ":" << number << ": expected model, texture, eye and target" << endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+// RGB in the row order glReadPixels gives, bottom first, which is also how
+// loadImage decodes the references.
+static void toRgb(const unsigned char* rgba, int width, int height, vector<unsigned char>& rgb)
+{
+    rgb.resize((size_t) width * height * 3);
+    for (size_t i = 0; i < (size_t) width * height; i++)
+    {
+        rgb[i * 3] = rgba[i * 4];
+        rgb[i * 3 + 1] = rgba[i * 4 + 1];
+        rgb[i * 3 + 2] = rgba[i * 4 + 2];
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int width = 256, height = 256;
+    string outputDir = ".", referenceDir;
+    double minPsnr = 40.0;
+    const char* jobPath = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &width, &height) == 2)
+            i++;
+        else if (arg == "--out" && i + 1 < argc)
+            outputDir = argv[++i];
+        else if (arg == "--reference" && i + 1 < argc)
+            referenceDir = argv[++i];
+        else if (arg == "--min-psnr" && i + 1 < argc)
+            minPsnr = atof(argv[++i]);
+        else if (!jobPath && arg[0] != '-')
+            jobPath = argv[i];
+        else
+            jobPath = NULL, i = argc;
+    }
+    if (!jobPath || width <= 0 || height <= 0)
+    {
+        cerr << "Usage: " << argv[0] << " [--size WxH] [--out DIR] [--reference DIR] [--min-psnr DB] jobs.txt" << endl;
+        return 1;
+    }
+
+    vector<Job> jobs;
+    if (!readJobs(jobPath, jobs))
+    {
+        cerr << "Could not read " << jobPath << endl;
+        return 1;
+    }
+
+    HeadlessContext context;
+    if (!context.isOpen())
+        return 1;
+    cout << "Renderer: " << glGetString(GL_RENDERER) << endl;
+
+    RenderTarget target(width, height);
+    if (!target.isComplete())
+        return 1;
+    PixelReader reader(width, height);
+
+    Shader shader("./shaders/vert.glsl", "./shaders/frag.glsl");
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) width / (float) height, 0.1f, 100.0f);
+    shader.use();
+    shader.setMat4(shader.uniform("projection"), projection);
+    Uniform viewUniform = shader.uniform("view");
+
+    // Jobs usually share a handful of models, each is loaded once.
+    MeshOptions options;
+    options.optimize = true;
+    map<string, unique_ptr<Mesh> > meshes;
+    TextureCache textures;
+
+    int failures = 0;
+    double start = now();
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        const Job& job = jobs[i];
+        unique_ptr<Mesh>& mesh = meshes[job.model + "\n" + job.texture];
+        if (!mesh)
+        {
+            shared_ptr<Texture> texture = textures.acquire(job.texture);
+            if (!texture)
+            {
+                cerr << "Could not load " << job.texture << endl;
+                return 1;
+            }
+            mesh.reset(new Mesh(job.model.c_str(), options));
+            mesh->setupBuffers(shader, texture);
+            mesh->loadMaterialTextures(textures);
+        }
+
+        target.bind();
+        glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        shader.use();
+        shader.setMat4(viewUniform, glm::lookAt(job.eye, job.target, glm::vec3(0.0f, 1.0f, 0.0f)));
+        mesh->draw(shader);
+
+        // Pixels arrive a few jobs later, while the following ones render.
+        char name[32];
+        snprintf(name, sizeof(name), "%04zu.ppm", i);
+        reader.read([&, name](const unsigned char* rgba)
+        {
+            string output = outputDir + "/" + name;
+            if (!writeImage(output.c_str(), rgba, width, height))
+            {
+                cerr << "Could not write " << output << endl;
+                failures++;
+                return;
+            }
+            if (referenceDir.empty())
+                return;
+
+            string path = referenceDir + "/" + name;
+            Image reference;
+            if (!loadImage(path.c_str(), reference) || reference.width != width || reference.height != height)
+            {
+                cerr << path << ": missing or not " << width << "x" << height << endl;
+                failures++;
+                return;
+            }
+            vector<unsigned char> rgb;
+            toRgb(rgba, width, height, rgb);
+            double quality = psnr(rgb.data(), reference.data, rgb.size());
+            bool passed = quality >= minPsnr;
+            printf("  %s PSNR %.2f dB %s\n", name, quality, passed ? "ok" : "FAILED");
+            failures += !passed;
+        });
+    }
+    reader.finish();
+    double seconds = now() - start;
+
+    printf("%zu images at %dx%d in %.3f s, %.1f ms each (%zu models)\n", jobs.size(), width, height,
+           seconds, jobs.empty() ? 0.0 : seconds * 1000.0 / jobs.size(), meshes.size());
+    if (failures)
+        cerr << failures << " of " << jobs.size() << " images failed" << endl;
+    return failures ? 1 : 0;
+}
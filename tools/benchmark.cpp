@@ -0,0 +1,1730 @@
+#include "../Application.hpp"
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <float.h>
+#include <new>
+#include <sys/stat.h>
+#include <utime.h>
+
+using namespace std;
+
+// Command line benchmark for the CPU side of the loader. Needs no window or GPU.
+// Run from the project root so the asset paths resolve.
+// Usage: benchmark [grid resolution] [--stream-mb MB] [--json results.json]
+
+// Every heap allocation in the process goes through here, so a section can
+// count what it allocates. Allocations of at least largeAllocation bytes are
+// counted separately, to catch copies of big arrays. Each block starts with
+// its size, so the bytes live right now and their peak are known too.
+static atomic<size_t> allocationCount(0), allocationBytes(0), largeAllocationCount(0);
+static atomic<size_t> largeAllocation(~(size_t) 0);
+static atomic<size_t> liveBytes(0), peakLiveBytes(0);
+static const size_t allocationHeader = 16;
+
+// The header arithmetic stays out of line. Inlined into a caller, GCC sees
+// free() and a negative offset applied to a pointer from new and warns with
+// -Wmismatched-new-delete and -Warray-bounds.
+#if defined(__GNUC__)
+#define ALLOCATION_NOINLINE __attribute__((noinline))
+#else
+#define ALLOCATION_NOINLINE
+#endif
+
+ALLOCATION_NOINLINE static void* allocateBlock(size_t size)
+{
+    char* memory = (char*) malloc(size + allocationHeader);
+    if (!memory)
+        return NULL;
+    *(size_t*) memory = size;
+    return memory + allocationHeader;
+}
+
+// Returns the size the block was allocated with.
+ALLOCATION_NOINLINE static size_t freeBlock(void* memory)
+{
+    char* block = (char*) memory - allocationHeader;
+    size_t size = *(size_t*) block;
+    free(block);
+    return size;
+}
+
+void* operator new(size_t size)
+{
+    allocationCount++;
+    allocationBytes += size;
+    if (size >= largeAllocation)
+        largeAllocationCount++;
+    void* memory = allocateBlock(size);
+    if (!memory)
+        throw bad_alloc();
+
+    size_t live = liveBytes += size;
+    size_t peak = peakLiveBytes;
+    while (live > peak && !peakLiveBytes.compare_exchange_weak(peak, live))
+        ;
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    if (memory)
+        liveBytes -= freeBlock(memory);
+}
+
+// Temporary buffers, e.g. of stable_sort, come from here.
+void* operator new(size_t size, const nothrow_t&) noexcept
+{
+    try
+    {
+        return operator new(size);
+    }
+    catch (const bad_alloc&)
+    {
+        return NULL;
+    }
+}
+
+void operator delete(void* memory, const nothrow_t&) noexcept
+{
+    operator delete(memory);
+}
+
+static double now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Headline numbers of every section, written out by --json so runs can be
+// compared between releases. A failed check makes the benchmark exit nonzero.
+struct Result
+{
+    string benchmark, subject, metric;
+    double value;
+};
+
+static vector<Result> results;
+static int failedChecks = 0;
+
+static void record(const char* benchmark, const string& subject, const char* metric, double value)
+{
+    Result result = { benchmark, subject, metric, value };
+    results.push_back(result);
+}
+
+static bool check(const char* benchmark, const string& subject, const char* metric, bool passed)
+{
+    record(benchmark, subject, metric, passed ? 1.0 : 0.0);
+    failedChecks += !passed;
+    return passed;
+}
+
+static string jsonString(const string& text)
+{
+    string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '"' || text[i] == '\\')
+            quoted += '\\';
+        quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+static bool writeResults(const char* path, int resolution)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\n  \"threads\": %u,\n  \"gridResolution\": %d,\n  \"failedChecks\": %d,\n  \"results\": [",
+            ThreadPool::shared().size(), resolution, failedChecks);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& result = results[i];
+        fprintf(file, "%s\n    {\"benchmark\": %s, \"subject\": %s, \"metric\": %s, \"value\": %.9g}", i ? "," : "",
+                jsonString(result.benchmark).c_str(), jsonString(result.subject).c_str(),
+                jsonString(result.metric).c_str(), result.value);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+static size_t fileSize(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size > 0 ? (size_t) size : 0;
+}
+
+static string fileBytes(const char* path)
+{
+    string bytes(fileSize(path), '\0');
+    FILE* file = fopen(path, "rb");
+    if (file)
+    {
+        if (fread(&bytes[0], 1, bytes.size(), file) != bytes.size())
+            bytes.clear();
+        fclose(file);
+    }
+    return bytes;
+}
+
+// Writes a tessellated grid in the same v/vt/vn layout our exporters produce.
+static void generateGrid(const char* path, int resolution)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        cerr << "Cannot write " << path << endl;
+        exit(1);
+    }
+
+    fprintf(file, "# generated %dx%d grid\n", resolution, resolution);
+    for (int y = 0; y <= resolution; y++)
+        for (int x = 0; x <= resolution; x++)
+        {
+            float u = (float) x / resolution, v = (float) y / resolution;
+            fprintf(file, "v %f %f %f\n", u * 10.0f - 5.0f, sinf(u * 12.0f) * cosf(v * 9.0f), v * 10.0f - 5.0f);
+            fprintf(file, "vt %f %f\n", u, v);
+            fprintf(file, "vn %f %f %f\n", 0.0f, 1.0f, 0.0f);
+        }
+
+    int row = resolution + 1;
+    for (int y = 0; y < resolution; y++)
+        for (int x = 0; x < resolution; x++)
+        {
+            int a = y * row + x + 1, b = a + 1, c = a + row, d = c + 1;
+            fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, c, c, c, b, b, b);
+            fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", b, b, b, c, c, c, d, d, d);
+        }
+    fclose(file);
+}
+
+static bool sameData(const ObjData& a, const ObjData& b)
+{
+    return a.temp_vertices.size() == b.temp_vertices.size() &&
+           a.temp_uvs.size() == b.temp_uvs.size() &&
+           a.temp_normals.size() == b.temp_normals.size() &&
+           a.vertexIndices == b.vertexIndices &&
+           a.uvIndices == b.uvIndices &&
+           a.normalIndices == b.normalIndices &&
+           memcmp(a.temp_vertices.data(), b.temp_vertices.data(), a.temp_vertices.size() * sizeof(glm::vec3)) == 0 &&
+           memcmp(a.temp_uvs.data(), b.temp_uvs.data(), a.temp_uvs.size() * sizeof(glm::vec2)) == 0 &&
+           memcmp(a.temp_normals.data(), b.temp_normals.data(), a.temp_normals.size() * sizeof(glm::vec3)) == 0;
+}
+
+// Times one parser on one file, returns throughput in MB/s.
+static double timeParse(const char* path, LoadMode mode, ObjData& data)
+{
+    double mb = fileSize(path) / (1024.0 * 1024.0);
+    int iterations = mb < 1.0 ? 20 : 3;
+
+    double best = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        data = ObjData();
+        double start = now();
+        loadObj(path, mode, data);
+        best = min(best, now() - start);
+    }
+    return mb / best;
+}
+
+static void benchmarkParse(const char* path)
+{
+    ObjData reference, mapped, parallel;
+    double fscanfRate = timeParse(path, LOAD_FSCANF, reference);
+    double mappedRate = timeParse(path, LOAD_MAPPED, mapped);
+    double parallelRate = timeParse(path, LOAD_PARALLEL, parallel);
+
+    bool match = check("parse", path, "match", sameData(reference, mapped) && sameData(reference, parallel));
+    printf("%-32s %8.2f MB  fscanf %8.1f MB/s  mapped %8.1f MB/s  parallel %8.1f MB/s  %s\n",
+           path, fileSize(path) / (1024.0 * 1024.0), fscanfRate, mappedRate, parallelRate, match ? "match" : "MISMATCH");
+    record("parse", path, "fscanf MB/s", fscanfRate);
+    record("parse", path, "mapped MB/s", mappedRate);
+    record("parse", path, "parallel MB/s", parallelRate);
+}
+
+// Unit cube as six quads with corners "v", "v/vt", "v//vn" or "v/vt/vn"
+// for form 0 to 3. Faces wind counter-clockwise seen from outside.
+static string quadCube(const char* header, int form, bool relative)
+{
+    static const int quads[6][4] = {
+        { 1, 4, 3, 2 }, { 5, 6, 7, 8 }, { 1, 2, 6, 5 }, { 2, 3, 7, 6 }, { 3, 4, 8, 7 }, { 1, 5, 8, 4 }
+    };
+    string text = string(header) +
+        "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\nv 0 0 1\nv 1 0 1\nv 1 1 1\nv 0 1 1\n"
+        "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n"
+        "vn 0 0 -1\nvn 0 0 1\nvn 0 -1 0\nvn 1 0 0\nvn 0 1 0\nvn -1 0 0\n";
+    for (int f = 0; f < 6; f++)
+    {
+        text += "f";
+        for (int k = 0; k < 4; k++)
+        {
+            // Relative indices count back from the 8 positions, 4 uvs and 6 normals read so far.
+            int v = relative ? quads[f][k] - 9 : quads[f][k];
+            int vt = relative ? k - 4 : k + 1;
+            int vn = relative ? f - 6 : f + 1;
+            char corner[64];
+            if (form == 0)
+                snprintf(corner, sizeof(corner), " %d", v);
+            else if (form == 1)
+                snprintf(corner, sizeof(corner), " %d/%d", v, vt);
+            else if (form == 2)
+                snprintf(corner, sizeof(corner), " %d//%d", v, vn);
+            else
+                snprintf(corner, sizeof(corner), " %d/%d/%d", v, vt, vn);
+            text += corner;
+        }
+        text += "  # quad " + to_string(f) + "\n";
+    }
+    return text;
+}
+
+static bool parseText(const string& text, ObjData& data)
+{
+    data = ObjData();
+    return parseObj(text.data(), text.data() + text.size(), data);
+}
+
+// Area of every triangle, and whether all of them face along normal.
+static float triangleArea(const ObjData& data, const glm::vec3& normal, bool& facing)
+{
+    float area = 0.0f;
+    facing = true;
+    for (size_t i = 0; i < data.vertexIndices.size(); i += 3)
+    {
+        const glm::vec3& a = data.temp_vertices[data.vertexIndices[i]];
+        glm::vec3 cross = glm::cross(data.temp_vertices[data.vertexIndices[i + 1]] - a, data.temp_vertices[data.vertexIndices[i + 2]] - a);
+        area += glm::length(cross) * 0.5f;
+        facing = facing && glm::dot(cross, normal) > 0.0f;
+    }
+    return area;
+}
+
+// Face forms, relative indices, polygons, generated normals and malformed
+// faces on small made up files, then the chunked parser against the serial
+// one on a large file mixing all of them.
+static void benchmarkObjForms()
+{
+    ObjData reference, data;
+    int passed = 0, total = 0;
+    auto expect = [&](const char* name, bool ok)
+    {
+        total++;
+        passed += check("obj forms", name, "ok", ok);
+        if (!ok)
+            printf("  obj form check failed: %s\n", name);
+    };
+
+    bool parsed = parseText(quadCube("", 3, false), reference);
+    expect("v/vt/vn quads", parsed && reference.vertexIndices.size() == 36 && reference.temp_normals.size() == 6);
+
+    const char* forms[] = { "v", "v/vt", "v//vn" };
+    for (int f = 0; f < 3; f++)
+    {
+        parsed = parseText(quadCube("", f, false), data);
+        bool ok = parsed && data.vertexIndices == reference.vertexIndices;
+        // Missing uvs all point at one added zero uv.
+        for (size_t i = 0; ok && f != 1 && i < data.uvIndices.size(); i++)
+            ok = data.temp_uvs[data.uvIndices[i]] == glm::vec2(0.0f);
+        if (f == 2)
+            ok = ok && data.normalIndices == reference.normalIndices;
+        expect(forms[f], ok);
+    }
+
+    parsed = parseText(quadCube("", 3, true), data);
+    expect("negative indices", parsed && data.vertexIndices == reference.vertexIndices &&
+           data.uvIndices == reference.uvIndices && data.normalIndices == reference.normalIndices);
+
+    // Outside a smoothing group every corner gets the face normal, which is the cube's own.
+    parsed = parseText(quadCube("s off\n", 0, false), data);
+    bool flat = parsed;
+    for (size_t i = 0; flat && i < data.normalIndices.size(); i++)
+        flat = glm::length(data.temp_normals[data.normalIndices[i]] - reference.temp_normals[reference.normalIndices[i]]) < 1e-5f;
+    expect("flat normals", flat);
+
+    // Inside one each position gets one normal, averaged over the triangles
+    // around it. Which quad diagonals those are skews it, but it points away
+    // from the centre.
+    parsed = parseText(quadCube("s 1\n", 0, false), data);
+    bool smooth = parsed && data.temp_normals.size() == 6 + 8;
+    for (size_t i = 0; smooth && i < data.normalIndices.size(); i++)
+    {
+        glm::vec3 outwards = glm::normalize(data.temp_vertices[data.vertexIndices[i]] - glm::vec3(0.5f));
+        smooth = glm::dot(data.temp_normals[data.normalIndices[i]], outwards) > 0.9f;
+    }
+    expect("smooth normals", smooth);
+
+    // Concave polygons: an L, a comb, and a star, with the fan going wrong at corner 0.
+    const char* polygons[] = {
+        "v 0 0 0\nv 2 0 0\nv 2 1 0\nv 1 1 0\nv 1 2 0\nv 0 2 0\nf 4 5 6 1 2 3\n",
+        "v 0 0 0\nv 5 0 0\nv 5 3 0\nv 4 3 0\nv 4 1 0\nv 3 1 0\nv 3 3 0\nv 2 3 0\nv 2 1 0\nv 1 1 0\nv 1 3 0\nv 0 3 0\n"
+        "f 1 2 3 4 5 6 7 8 9 10 11 12\n",
+        "v 0 -3 0\nv 0 -1 1\nv 0 0 3\nv 0 1 1\nv 0 3 0\nv 0 1 -1\nv 0 0 -3\nv 0 -1 -1\nf 2 3 4 5 6 7 8 1\n",
+    };
+    const float areas[] = { 3.0f, 11.0f, 12.0f };
+    const glm::vec3 normals[] = { glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(-1.0f, 0.0f, 0.0f) };
+    for (int i = 0; i < 3; i++)
+    {
+        bool facing = false;
+        parsed = parseText(polygons[i], data);
+        float area = parsed ? triangleArea(data, normals[i], facing) : 0.0f;
+        expect(("concave polygon " + to_string(i)).c_str(), parsed && facing && fabs(area - areas[i]) < 1e-4f);
+    }
+
+    expect("two corner face fails", !parseText("v 0 0 0\nv 1 0 0\nf 1 2\n", data));
+    expect("zero index fails", !parseText("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 0 1 2\n", data));
+    expect("bad corner fails", !parseText("v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 x\n", data));
+
+    // A one component vt gets v = 0 and keeps its place, so the faces still
+    // point at the uvs after it.
+    parsed = parseText("v 0 0 0\nv 1 0 0\nv 0 1 0\nvt 0.5\nvt 0.25 0.75\nvt 1 1\nf 1/1 2/2 3/3\n", data);
+    expect("short vt", parsed && data.temp_uvs.size() == 3 && data.temp_uvs[data.uvIndices[0]] == glm::vec2(0.5f, 0.0f) &&
+           data.temp_uvs[data.uvIndices[1]] == glm::vec2(0.25f, 0.75f) && data.temp_uvs[data.uvIndices[2]] == glm::vec2(1.0f));
+
+    // Several megabytes of cubes in every form with the smoothing state
+    // switching, so chunks start in the middle of all of it.
+    const char* smoothing[] = { "s 1\n", "", "s off\n", "" };
+    string large;
+    for (int i = 0; large.size() < 8 * 1024 * 1024; i++)
+        large += quadCube(smoothing[i % 4], i % 3, i % 2 == 1);
+    ThreadPool pool(4);
+    ObjData parallel;
+    double start = now();
+    parsed = parseText(large, reference);
+    double serialTime = now() - start;
+    start = now();
+    bool parallelParsed = parseObjParallel(large.data(), large.data() + large.size(), parallel, pool);
+    double parallelTime = now() - start;
+    expect("chunked matches serial", parsed && parallelParsed && sameData(reference, parallel));
+
+    printf("OBJ forms %d/%d checks passed  mixed %.1f MB: serial %6.1f MB/s  4 chunks %6.1f MB/s\n", passed, total,
+           large.size() / (1024.0 * 1024.0), large.size() / serialTime / (1024.0 * 1024.0),
+           large.size() / parallelTime / (1024.0 * 1024.0));
+    record("obj forms", "mixed", "serial MB/s", large.size() / serialTime / (1024.0 * 1024.0));
+}
+
+// Whole Mesh construction, serial against parallel, including the reshape step.
+static void benchmarkMesh(const char* path)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+
+    double start = now();
+    Mesh serial(path, options);
+    double serialTime = now() - start;
+
+    options.mode = LOAD_PARALLEL;
+    start = now();
+    Mesh parallel(path, options);
+    double parallelTime = now() - start;
+
+    bool identical = serial.vertices.size() == parallel.vertices.size() &&
+        memcmp(serial.vertices.data(), parallel.vertices.data(), serial.vertices.size() * sizeof(Vertex)) == 0 &&
+        serial.indices == parallel.indices;
+
+    printf("%-32s mesh serial %8.1f ms  parallel %8.1f ms  (%u threads)  x%5.1f  %s\n",
+           path, serialTime * 1000.0, parallelTime * 1000.0, ThreadPool::shared().size(),
+           serialTime / parallelTime, identical ? "identical" : "DIFFERENT");
+    record("mesh", path, "serial ms", serialTime * 1000.0);
+    record("mesh", path, "parallel ms", parallelTime * 1000.0);
+    record("mesh", path, "unique vertices", serial.vertexCount());
+    check("mesh", path, "identical", identical);
+    serial.printStats(path);
+}
+
+// Post transform cache efficiency in file order against after the optimization pass.
+static void benchmarkOptimize(const char* path)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+    Mesh original(path, options);
+
+    options.optimize = true;
+    double start = now();
+    Mesh optimized(path, options);
+    double optimizeTime = now() - start;
+
+    VertexCacheStats before = analyzeVertexCache(original.indexData(), original.indexCount(), original.vertexCount());
+    VertexCacheStats after = analyzeVertexCache(optimized.indexData(), optimized.indexCount(), optimized.vertexCount());
+
+    printf("%-32s ACMR %5.3f -> %5.3f  ATVR %5.3f -> %5.3f  load+optimize %8.1f ms\n",
+           path, before.acmr, after.acmr, before.atvr, after.atvr, optimizeTime * 1000.0);
+    record("optimize", path, "ACMR", after.acmr);
+    record("optimize", path, "load+optimize ms", optimizeTime * 1000.0);
+}
+
+// Round trip error of the quantized vertex formats, decoded the same way as vert.glsl.
+static void benchmarkQuantize(const char* path)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+    Mesh mesh(path, options);
+
+    const VertexFormat formats[] = { VERTEX_PACKED_OCTAHEDRAL, VERTEX_PACKED_1010102 };
+    const char* names[] = { "octahedral", "1010102" };
+    const float maxNormalError[] = { 0.01f, 0.12f };   // Degrees.
+    float extent = glm::length(mesh.bounds.max - mesh.bounds.min);
+
+    for (int f = 0; f < 2; f++)
+    {
+        vector<PackedVertex> packed;
+        double start = now();
+        packVertices(mesh.vertexData(), mesh.vertexCount(), mesh.bounds, formats[f], packed);
+        double packTime = now() - start;
+
+        float positionError = 0.0f, normalError = 0.0f, uvError = 0.0f, uvUlps = 0.0f;
+        for (size_t i = 0; i < packed.size(); i++)
+        {
+            const Vertex& original = mesh.vertexData()[i];
+            Vertex decoded = unpackVertex(packed[i], mesh.bounds, formats[f]);
+
+            positionError = max(positionError, glm::length(decoded.position - original.position) / extent);
+            // The angle from the chord between the unit vectors, acosf is too coarse near 0.
+            float chord = glm::length(glm::normalize(decoded.normal) - glm::normalize(original.normal));
+            normalError = max(normalError, 2.0f * asinf(min(chord * 0.5f, 1.0f)) * 180.0f / 3.14159265f);
+            for (int c = 0; c < 2; c++)
+            {
+                float error = fabsf(decoded.texCoord[c] - original.texCoord[c]);
+                uvError = max(uvError, error);
+                // One half float ulp at the original value, 2^-24 for subnormals.
+                int exponent;
+                frexpf(original.texCoord[c], &exponent);
+                uvUlps = max(uvUlps, error / ldexpf(1.0f, max(exponent - 11, -24)));
+            }
+        }
+
+        printf("%-32s %-10s %2u -> %2u bytes/vertex  position %.2e of extent  normal %6.4f deg  uv %.2e  pack %6.2f ms\n",
+               path, names[f], (unsigned) sizeof(Vertex), (unsigned) sizeof(PackedVertex),
+               positionError, normalError, uvError, packTime * 1000.0);
+        record("quantize", string(path) + " " + names[f], "position error", positionError);
+        record("quantize", string(path) + " " + names[f], "pack ms", packTime * 1000.0);
+        // 16 bit positions are within half a step of 2^-16 per axis, snorm
+        // rounding bounds the normal angle at about half a step per component.
+        check("quantize", string(path) + " " + names[f], "position error", positionError <= 1.0f / 32768.0f);
+        check("quantize", string(path) + " " + names[f], "normal error", normalError <= maxNormalError[f]);
+        check("quantize", string(path) + " " + names[f], "uv error", uvUlps <= 1.0f);
+    }
+}
+
+// Many meshes through the AssetLoader at once against loading them one by
+// one, then the order and pacing of their callbacks.
+static void benchmarkAsync(const char* path, int count)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+
+    double start = now();
+    for (int i = 0; i < count; i++)
+        Mesh mesh(path, options);
+    double serialTime = now() - start;
+
+    Mesh reference(path, options);
+    int received = 0, correct = 0;
+
+    AssetLoader loader;
+    start = now();
+    for (int i = 0; i < count; i++)
+        loader.loadMesh(path, NULL, options, [&](Mesh& mesh, const Image*)
+        {
+            received++;
+            if (mesh.vertexCount() == reference.vertexCount() && mesh.indexCount() == reference.indexCount() &&
+                memcmp(mesh.vertexData(), reference.vertexData(), mesh.vertexCount() * sizeof(Vertex)) == 0)
+                correct++;
+        });
+
+    // Drain the queue the same way the main loop does, a few milliseconds at a time.
+    while (loader.pending() > 0)
+        if (loader.upload(0.004) == 0)
+            this_thread::yield();
+    double asyncTime = now() - start;
+
+    printf("%-32s %d loads  serial %8.1f ms  async %8.1f ms  %d/%d received, %d correct\n",
+           path, count, serialTime * 1000.0, asyncTime * 1000.0, received, count, correct);
+    record("async", path, "serial ms", serialTime * 1000.0);
+    record("async", path, "async ms", asyncTime * 1000.0);
+    check("async", path, "all correct", correct == count);
+
+    // A large mesh queued first comes back after the small ones behind it.
+    const char* largePath = "bench_async_large.obj";
+    generateGrid(largePath, 300);
+    vector<string> arrivals;
+    {
+        ThreadPool pool(4);
+        AssetLoader ordered(NULL, pool);
+        ordered.loadMesh(largePath, NULL, options, [&](Mesh&, const Image*) { arrivals.push_back(largePath); });
+        for (int i = 0; i < 16; i++)
+            ordered.loadMesh(path, NULL, options, [&](Mesh&, const Image*) { arrivals.push_back(path); });
+        while (ordered.pending() > 0)
+            if (ordered.upload(0.004) == 0)
+                this_thread::yield();
+    }
+    remove(largePath);
+
+    // With callbacks of a millisecond each upload() stops within one callback
+    // of its budget. All loads finish first, a single worker running them in
+    // order, so no parsing thread competes with the timed calls.
+    promise<void> loaded;
+    ThreadPool single(1);
+    AssetLoader paced(NULL, single);
+    double longestCallback = 0.0;
+    for (int i = 0; i < 16; i++)
+        paced.loadMesh(path, NULL, options, [&](Mesh&, const Image*)
+        {
+            double callbackStart = now();
+            this_thread::sleep_for(chrono::milliseconds(1));
+            longestCallback = max(longestCallback, now() - callbackStart);
+        });
+    single.enqueue([&]() { loaded.set_value(); });
+    loaded.get_future().wait();
+
+    const double budget = 0.004;
+    double overrun = 0.0;
+    while (paced.pending() > 0)
+    {
+        double callStart = now();
+        paced.upload(budget);
+        overrun = max(overrun, now() - callStart - budget);
+    }
+
+    printf("%-32s large mesh arrived %s of %zu, worst upload overrun %.2f ms, longest callback %.2f ms\n", path,
+           !arrivals.empty() && arrivals.back() == largePath ? "last" : "early", arrivals.size(),
+           overrun * 1000.0, longestCallback * 1000.0);
+    check("async", path, "completion order", arrivals.size() == 17 && arrivals.back() == largePath);
+    check("async", path, "upload budget", overrun <= longestCallback + 0.001);
+}
+
+// Loads meshes into a scene list the way the app does. Moving them in must
+// not copy any vertex array, so no allocation may be as large as one.
+static void benchmarkMeshMoves(const char* path, int count)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+
+    size_t vertexBytes;
+    {
+        Mesh reference(path, options);
+        vertexBytes = reference.vertexCount() * sizeof(Vertex);
+    }
+
+    vector<Mesh> meshes;
+    size_t loadAllocations = 0, moveAllocations = 0, moveBytes = 0, vertexCopies = 0;
+    largeAllocation = vertexBytes;
+    for (int i = 0; i < count; i++)
+    {
+        size_t allocations = allocationCount;
+        Mesh mesh(path, options);
+        loadAllocations += allocationCount - allocations;
+
+        allocations = allocationCount;
+        size_t bytes = allocationBytes, large = largeAllocationCount, capacity = meshes.capacity();
+        meshes.emplace_back(move(mesh));
+        moveAllocations += allocationCount - allocations;
+        moveBytes += allocationBytes - bytes;
+        vertexCopies += largeAllocationCount - large;
+        // The list's own new buffer can outgrow a small mesh's vertices.
+        if (meshes.capacity() != capacity && meshes.capacity() * sizeof(Mesh) >= vertexBytes)
+            vertexCopies--;
+    }
+    largeAllocation = ~(size_t) 0;
+
+    printf("%-32s %d meshes  %zu allocations per load  moves: %zu allocations, %zu bytes, %zu vertex array copies\n",
+           path, count, loadAllocations / count, moveAllocations, moveBytes, vertexCopies);
+    record("moves", path, "allocations per load", loadAllocations / count);
+    check("moves", path, "no vertex copies", vertexCopies == 0);
+}
+
+// Sorting a frame of draws, checked against a recording backend. Every
+// object uses one of a few meshes, each with its own program, texture and VAO.
+static void benchmarkRenderQueue(int objectCount, int meshCount)
+{
+    vector<DrawItem> meshes(meshCount);
+    for (int m = 0; m < meshCount; m++)
+    {
+        meshes[m].program = 1 + m % 4;
+        meshes[m].texture = 1 + m % 32;
+        meshes[m].vertexArray = 1 + m;
+        meshes[m].indexCount = 36;
+        meshes[m].modelUniform.location = 0;
+    }
+
+    // Submission order is scene order, which is unrelated to state.
+    srand(1234);
+    vector<int> objects(objectCount);
+    vector<float> depths(objectCount);
+    for (int i = 0; i < objectCount; i++)
+    {
+        objects[i] = rand() % meshCount;
+        depths[i] = (float) rand() / RAND_MAX * 100.0f;
+    }
+
+    size_t unsortedChanges = 0;
+    for (int i = 0; i < objectCount; i++)
+    {
+        const DrawItem& item = meshes[objects[i]];
+        const DrawItem* previous = i ? &meshes[objects[i - 1]] : NULL;
+        unsortedChanges += !previous || item.program != previous->program;
+        unsortedChanges += !previous || item.texture != previous->texture;
+        unsortedChanges += !previous || item.vertexArray != previous->vertexArray;
+    }
+
+    RenderQueue queue;
+    RecordingRenderBackend backend;
+    double submitTime = 0.0, flushTime = 0.0;
+    const int frames = 10;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        backend.calls.clear();
+        double start = now();
+        for (int i = 0; i < objectCount; i++)
+            queue.submit(meshes[objects[i]], depths[i]);
+        submitTime += now() - start;
+
+        start = now();
+        queue.flush(backend);
+        flushTime += now() - start;
+    }
+
+    const RenderStats& stats = queue.stats();
+    size_t sortedChanges = stats.programChanges + stats.textureChanges + stats.vertexArrayChanges;
+    bool consistent = stats.draws == (size_t) objectCount &&
+        backend.count(RecordingRenderBackend::DRAW) == stats.draws &&
+        backend.count(RecordingRenderBackend::USE_PROGRAM) == stats.programChanges &&
+        backend.count(RecordingRenderBackend::BIND_TEXTURE) == stats.textureChanges &&
+        backend.count(RecordingRenderBackend::BIND_VERTEX_ARRAY) == stats.vertexArrayChanges &&
+        stats.vertexArrayChanges == (size_t) meshCount;
+
+    printf("RenderQueue %d draws %d meshes  state changes %zu unsorted -> %zu sorted  submit %6.3f ms  sort+flush %6.3f ms  %s\n",
+           objectCount, meshCount, unsortedChanges, sortedChanges, submitTime * 1000.0 / frames, flushTime * 1000.0 / frames,
+           consistent ? "consistent" : "INCONSISTENT");
+    string subject = to_string(objectCount) + " draws " + to_string(meshCount) + " meshes";
+    record("render queue", subject, "submit ms", submitTime * 1000.0 / frames);
+    record("render queue", subject, "sort+flush ms", flushTime * 1000.0 / frames);
+    record("render queue", subject, "state changes", sortedChanges);
+    check("render queue", subject, "consistent", consistent);
+}
+
+// Frustum culling of random spheres around the camera, SIMD against scalar.
+static void benchmarkCulling(int count)
+{
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = extractFrustum(projection * view);
+
+    srand(42);
+    SphereList spheres;
+    for (int i = 0; i < count; i++)
+    {
+        BoundingSphere sphere;
+        sphere.center = glm::vec3(rand() % 2000 - 1000, rand() % 2000 - 1000, rand() % 2000 - 1000) * 0.1f;
+        sphere.radius = (rand() % 100) * 0.01f + 0.1f;
+        spheres.push_back(sphere);
+    }
+
+    vector<unsigned char> visible, reference;
+    const int frames = 20;
+    size_t inside = 0, referenceInside = 0;
+
+    double start = now();
+    for (int frame = 0; frame < frames; frame++)
+        inside = cullSpheres(frustum, spheres, visible);
+    double simdTime = (now() - start) / frames;
+
+    start = now();
+    for (int frame = 0; frame < frames; frame++)
+        referenceInside = cullSpheresScalar(frustum, spheres, reference);
+    double scalarTime = (now() - start) / frames;
+
+    string subject = to_string(count) + " spheres";
+    bool identical = check("culling", subject, "identical", inside == referenceInside && visible == reference);
+    printf("Culling %d spheres  %zu visible  simd %7.3f ms  scalar %7.3f ms  %s\n", count, inside,
+           simdTime * 1000.0, scalarTime * 1000.0, identical ? "identical" : "DIFFERENT");
+    record("culling", subject, "simd ms", simdTime * 1000.0);
+    record("culling", subject, "scalar ms", scalarTime * 1000.0);
+}
+
+// Scene BVH over random boxes: build, refit, hierarchical culling and ray
+// queries, with culling and nearest hits checked against brute force.
+static void benchmarkSceneBVH(int count)
+{
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = extractFrustum(projection * view);
+
+    srand(42);
+    vector<AABB> bounds(count);
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 center = glm::vec3(rand() % 2000 - 1000, rand() % 2000 - 1000, rand() % 2000 - 1000) * 0.1f;
+        glm::vec3 extent = glm::vec3(rand() % 100, rand() % 100, rand() % 100) * 0.01f + 0.05f;
+        bounds[i].min = center - extent;
+        bounds[i].max = center + extent;
+    }
+
+    SceneBVH bvh;
+    double start = now();
+    bvh.build(bounds);
+    double buildTime = now() - start;
+
+    // Everything drifts a little, as if the objects moved since the build.
+    for (int i = 0; i < count; i++)
+    {
+        glm::vec3 offset = glm::vec3(rand() % 21 - 10, rand() % 21 - 10, rand() % 21 - 10) * 0.01f;
+        bounds[i].min += offset;
+        bounds[i].max += offset;
+    }
+    start = now();
+    bvh.refit(bounds);
+    double refitTime = now() - start;
+
+    const int frames = 20;
+    vector<uint32_t> visible;
+    start = now();
+    for (int frame = 0; frame < frames; frame++)
+        bvh.cull(frustum, visible);
+    double cullTime = (now() - start) / frames;
+
+    vector<uint32_t> reference;
+    start = now();
+    for (int frame = 0; frame < frames; frame++)
+    {
+        reference.clear();
+        for (int i = 0; i < count; i++)
+            if (aabbInFrustum(frustum, bounds[i]))
+                reference.push_back(i);
+    }
+    double bruteTime = (now() - start) / frames;
+    sort(visible.begin(), visible.end());
+    bool cullMatches = visible == reference;
+
+    // Rays from around the origin in random directions.
+    const int rayCount = 10000, checkedRays = 200;
+    vector<Ray> rays(rayCount);
+    for (int i = 0; i < rayCount; i++)
+    {
+        rays[i].origin = glm::vec3(rand() % 200 - 100, rand() % 200 - 100, rand() % 200 - 100) * 0.1f;
+        glm::vec3 direction(rand() % 2001 - 1000, rand() % 2001 - 1000, rand() % 2001 - 1000);
+        rays[i].direction = glm::normalize(direction + glm::vec3(0.5f));
+    }
+
+    vector<uint32_t> hits(rayCount);
+    vector<float> distances(rayCount);
+    size_t hitCount = 0;
+    start = now();
+    for (int i = 0; i < rayCount; i++)
+    {
+        uint32_t object = ~0u;
+        float distance = 0.0f;
+        hitCount += bvh.raycast(rays[i], 200.0f, object, distance);
+        hits[i] = object;
+        distances[i] = distance;
+    }
+    double rayTime = now() - start;
+
+    bool raysMatch = true;
+    for (int i = 0; i < checkedRays; i++)
+    {
+        const Ray& ray = rays[i];
+        glm::vec3 inverseDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+        float best = 200.0f, distance;
+        bool hit = false;
+        for (int j = 0; j < count; j++)
+            if (intersectRayAABB(ray, inverseDirection, bounds[j], best, distance))
+            {
+                best = distance;
+                hit = true;
+            }
+        // Compared by distance, two boxes may be entered at the same point.
+        if (hit != (hits[i] != ~0u) || (hit && best != distances[i]))
+            raysMatch = false;
+    }
+
+    printf("SceneBVH %7d boxes %7zu nodes  build %8.2f ms  refit %6.2f ms  cull %6.3f ms (brute %7.3f ms) %zu visible %s  "
+           "%8.0f rays/s %zu hits %s\n",
+           count, bvh.nodeCount(), buildTime * 1000.0, refitTime * 1000.0, cullTime * 1000.0, bruteTime * 1000.0,
+           visible.size(), cullMatches ? "identical" : "DIFFERENT", rayCount / rayTime, hitCount,
+           raysMatch ? "identical" : "DIFFERENT");
+    string subject = to_string(count) + " boxes";
+    record("scene bvh", subject, "build ms", buildTime * 1000.0);
+    record("scene bvh", subject, "cull ms", cullTime * 1000.0);
+    record("scene bvh", subject, "rays/s", rayCount / rayTime);
+    check("scene bvh", subject, "cull identical", cullMatches);
+    check("scene bvh", subject, "rays identical", raysMatch);
+}
+
+// Rays from around a mesh towards points inside its bounds, through the
+// triangle BVH on one and on all threads, checked against brute force.
+static void benchmarkTriangleBVH(const char* path, int rayCount)
+{
+    MeshOptions options;
+    options.useCache = false;
+    Mesh mesh(path, options);
+
+    double start = now();
+    TriangleBVH bvh;
+    bvh.build(mesh.vertexData(), mesh.indexData(), mesh.lod(0).indexCount);
+    double buildTime = now() - start;
+
+    srand(42);
+    glm::vec3 center = (mesh.bounds.min + mesh.bounds.max) * 0.5f;
+    glm::vec3 size = mesh.bounds.max - mesh.bounds.min;
+    float radius = glm::length(size);
+    vector<Ray> rays(rayCount);
+    for (int i = 0; i < rayCount; i++)
+    {
+        glm::vec3 around = glm::normalize(glm::vec3(rand() % 2001 - 1000, rand() % 2001 - 1000, rand() % 2001 - 1000) + glm::vec3(0.5f));
+        glm::vec3 target = mesh.bounds.min + size * glm::vec3(rand() % 1001, rand() % 1001, rand() % 1001) * 0.001f;
+        rays[i].origin = center + around * radius;
+        rays[i].direction = glm::normalize(target - rays[i].origin);
+    }
+
+    vector<TriangleHit> hits(rayCount);
+    vector<unsigned char> hit(rayCount);
+    start = now();
+    for (int i = 0; i < rayCount; i++)
+        hit[i] = bvh.intersect(rays[i], FLT_MAX, hits[i]);
+    double singleTime = now() - start;
+
+    start = now();
+    size_t hitCount = bvh.intersect(rays, FLT_MAX, hits, hit);
+    double parallelTime = now() - start;
+
+    // Brute force is slow on large meshes, so only some rays are checked.
+    int checked = min(rayCount, (int)(2e8 / max<size_t>(1, bvh.triangleCount())) + 1);
+    bool identical = true;
+    for (int i = 0; i < checked; i++)
+    {
+        TriangleHit reference;
+        bool referenceHit = bvh.intersectBruteForce(rays[i], FLT_MAX, reference);
+        // Rays through a shared edge may report either triangle at the same distance.
+        if (referenceHit != (bool) hit[i] || (referenceHit && reference.distance != hits[i].distance))
+            identical = false;
+    }
+
+    glm::vec2 uv = hitCount ? bvh.texCoord(hits[0]) : glm::vec2(0.0f);
+    printf("%-32s %8zu triangles %8zu nodes  build %8.2f ms  %6.2f Mrays/s  %6.2f Mrays/s on %u threads  %zu hits  "
+           "first uv %.3f %.3f  %d checked %s\n",
+           path, bvh.triangleCount(), bvh.nodeCount(), buildTime * 1000.0, rayCount / singleTime / 1e6,
+           rayCount / parallelTime / 1e6, ThreadPool::shared().size(), hitCount, uv.x, uv.y, checked,
+           identical ? "identical" : "DIFFERENT");
+    record("triangle bvh", path, "build ms", buildTime * 1000.0);
+    record("triangle bvh", path, "Mrays/s", rayCount / singleTime / 1e6);
+    record("triangle bvh", path, "parallel Mrays/s", rayCount / parallelTime / 1e6);
+    check("triangle bvh", path, "identical", identical);
+}
+
+// Open edges of a triangle list once vertices at the same position are merged.
+static void openPositionEdges(const Mesh& mesh, const unsigned int* indices, size_t indexCount, vector<pair<unsigned int, unsigned int> >& open)
+{
+    map<vector<float>, unsigned int> positions;
+    vector<unsigned int> group(mesh.vertexCount());
+    for (size_t v = 0; v < mesh.vertexCount(); v++)
+    {
+        const glm::vec3& p = mesh.vertexData()[v].position;
+        vector<float> key(&p.x, &p.x + 3);
+        group[v] = positions.insert(make_pair(key, (unsigned int) positions.size())).first->second;
+    }
+
+    map<pair<unsigned int, unsigned int>, int> uses;
+    for (size_t i = 0; i < indexCount; i += 3)
+        for (int k = 0; k < 3; k++)
+        {
+            unsigned int a = group[indices[i + k]], b = group[indices[i + (k + 1) % 3]];
+            uses[make_pair(min(a, b), max(a, b))]++;
+        }
+
+    open.clear();
+    for (map<pair<unsigned int, unsigned int>, int>::iterator it = uses.begin(); it != uses.end(); ++it)
+        if (it->second == 1)
+            open.push_back(it->first);
+}
+
+// Level of detail generation: size and error of each level, and whether
+// simplification opened holes where the full mesh had none.
+static void benchmarkLods(const char* path, int levels)
+{
+    MeshOptions options;
+    options.useCache = false;
+    options.lodLevels = levels;
+
+    double start = now();
+    Mesh mesh(path, options);
+    double loadTime = now() - start;
+
+    vector<pair<unsigned int, unsigned int> > open;
+    openPositionEdges(mesh, mesh.indexData(), mesh.lod(0).indexCount, open);
+    set<unsigned int> border;
+    for (size_t i = 0; i < open.size(); i++)
+    {
+        border.insert(open[i].first);
+        border.insert(open[i].second);
+    }
+
+    printf("%-32s %d levels requested, %zu made in %.2f ms (load included)\n", path, levels, mesh.lodCount() - 1, loadTime * 1000.0);
+    for (size_t level = 0; level < mesh.lodCount(); level++)
+    {
+        const MeshLod& lod = mesh.lod(level);
+        openPositionEdges(mesh, mesh.indexData() + lod.indexOffset, lod.indexCount, open);
+        size_t holes = 0;
+        for (size_t i = 0; i < open.size(); i++)
+            if (!border.count(open[i].first) || !border.count(open[i].second))
+                holes++;
+        printf("  LOD %zu %8u triangles  error %9.5f (%6.3f%% of radius)  %zu new open edges %s\n",
+               level, lod.indexCount / 3, lod.error, 100.0f * lod.error / mesh.sphere.radius, holes, holes ? "TORN" : "closed");
+        string subject = string(path) + " LOD " + to_string(level);
+        record("lods", subject, "triangles", lod.indexCount / 3);
+        record("lods", subject, "relative error", lod.error / mesh.sphere.radius);
+        check("lods", subject, "closed", holes == 0);
+    }
+    record("lods", path, "load ms", loadTime * 1000.0);
+}
+
+// BC1 encode speed and quality on a synthetic image with gradients and edges.
+static void benchmarkTexture(int size)
+{
+    vector<unsigned char> image((size_t) size * size * 3);
+    for (int y = 0; y < size; y++)
+        for (int x = 0; x < size; x++)
+        {
+            unsigned char* pixel = &image[((size_t) y * size + x) * 3];
+            bool tile = ((x / 32) + (y / 32)) % 2 == 0;
+            pixel[0] = (unsigned char)(x * 255 / size);
+            pixel[1] = (unsigned char)(y * 255 / size);
+            pixel[2] = tile ? 200 : 40;
+        }
+
+    vector<unsigned char> blocks, decoded;
+    double start = now();
+    encodeBC1(image.data(), size, size, blocks);
+    double encodeTime = now() - start;
+    decodeBC1(blocks.data(), size, size, decoded);
+
+    double quality = psnr(image.data(), decoded.data(), image.size());
+    printf("BC1 %dx%-20d %6.1f Mpixel/s  %zu -> %zu bytes  PSNR %.2f dB\n",
+           size, size, (double) size * size / encodeTime / 1e6, image.size(), blocks.size(), quality);
+    string subject = to_string(size) + "x" + to_string(size);
+    record("bc1", subject, "Mpixel/s", (double) size * size / encodeTime / 1e6);
+    record("bc1", subject, "PSNR dB", quality);
+    // Smooth gradients and flat tiles, a working encoder stays well above this.
+    check("bc1", subject, "PSNR", quality >= 38.0);
+}
+
+// JPEG decode through stb_image, as the loader does for uncompressed textures.
+static void benchmarkDecode(const char* path)
+{
+    double best = 1e30;
+    int width = 0, height = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        Image image;
+        double start = now();
+        if (!check("decode", path, "loaded", loadImage(path, image)))
+        {
+            printf("%-32s could not load\n", path);
+            return;
+        }
+        best = min(best, now() - start);
+        width = image.width;
+        height = image.height;
+    }
+
+    printf("%-32s decode %5dx%-5d %8.2f ms  %6.1f Mpixel/s\n", path, width, height, best * 1000.0,
+           (double) width * height / best / 1e6);
+    record("decode", path, "ms", best * 1000.0);
+    record("decode", path, "Mpixel/s", (double) width * height / best / 1e6);
+}
+
+// Cost of a timed scope, against the 1% of a 60 Hz frame it may take with
+// a few dozen scopes per frame. Checks the percentiles on known durations.
+static void benchmarkProfiler(int scopeCount)
+{
+    Profiler& profiler = Profiler::shared();
+    size_t section = profiler.section("benchmark scope");
+
+    volatile int sink = 0;
+    double start = now();
+    for (int i = 0; i < scopeCount; i++)
+        sink = sink + i;
+    double empty = now() - start;
+
+    start = now();
+    for (int i = 0; i < scopeCount; i++)
+    {
+        ProfileScope scope(section);
+        sink = sink + i;
+    }
+    double scoped = now() - start;
+    double perScope = (scoped - empty) / scopeCount;
+
+    // Durations 1..100 ms, so p50, p95 and p99 are exactly known.
+    size_t known = profiler.section("benchmark known");
+    for (int i = 100; i >= 1; i--)
+        profiler.record(known, 0.0, i * 0.001);
+    Profiler::Summary summary = profiler.summarize(known);
+    // Samples are stored as float seconds, so allow for their rounding.
+    bool exact = fabs(summary.p50 - 50.0) < 1e-3 && fabs(summary.p95 - 95.0) < 1e-3 && fabs(summary.p99 - 99.0) < 1e-3;
+
+    printf("Profiler %-19d %6.1f ns/scope  %5.3f%% of a 16.7 ms frame at 50 scopes  percentiles %s\n",
+           scopeCount, perScope * 1e9, 50 * perScope / (1.0 / 60.0) * 100.0, exact ? "ok" : "WRONG");
+    record("profiler", "scope", "ns", perScope * 1e9);
+    check("profiler", "percentiles", "exact", exact);
+}
+
+// A bumpy grid in strips of four columns, strip i using material i modulo
+// materialCount, with usemtl switching along every row. The first row comes
+// before any usemtl, so it gets the default material, and all of it is
+// smoothed so the strips share their border vertices.
+static void generateMaterialGrid(const char* objPath, const char* mtlPath, int materialCount, int rows)
+{
+    FILE* mtl = fopen(mtlPath, "w");
+    FILE* obj = fopen(objPath, "w");
+    if (!mtl || !obj)
+    {
+        cerr << "Cannot write " << objPath << " and " << mtlPath << endl;
+        exit(1);
+    }
+
+    for (int m = 0; m < materialCount; m++)
+        fprintf(mtl, "newmtl m%02d\nNs 10\nKd %f 0.5 %f\n%s\n", m, (float) m / materialCount, 1.0f - (float) m / materialCount,
+                m == 0 ? "map_Kd -clamp on -s 1 1 1 textures\\strip texture.png" : "");
+
+    int columns = materialCount * 8;
+    fprintf(obj, "mtllib %s\ns 1\n", mtlPath);
+    for (int y = 0; y <= rows; y++)
+        for (int x = 0; x <= columns; x++)
+            fprintf(obj, "v %d %d %f\nvt %f %f\n", x, y, 0.2f * sinf(x * 0.3f) * cosf(y * 0.4f), (float) x / columns, (float) y / rows);
+
+    int row = columns + 1;
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < columns; x++)
+        {
+            if (y > 0 && x % 4 == 0)
+                fprintf(obj, "usemtl m%02d\n", (x / 4) % materialCount);
+            int a = y * row + x + 1, b = a + 1, c = a + row, d = c + 1;
+            fprintf(obj, "f %d/%d %d/%d %d/%d %d/%d\n", a, a, b, b, d, d, c, c);
+        }
+    fclose(obj);
+    fclose(mtl);
+}
+
+// Whether a triangle lies within one strip of its material, or within the
+// first row for the default one. Simplified triangles may lie on a border.
+static bool inMaterialStrip(const glm::vec3* corners, uint32_t material, int materialCount)
+{
+    glm::vec3 lo = glm::min(glm::min(corners[0], corners[1]), corners[2]);
+    glm::vec3 hi = glm::max(glm::max(corners[0], corners[1]), corners[2]);
+    if (material == (uint32_t) materialCount)
+        return hi.y <= 1.0f;
+    if (lo.y < 1.0f)
+        return false;
+    for (int strip = (int) lo.x / 4 - 1; strip <= (int) lo.x / 4; strip++)
+        if (strip >= 0 && (uint32_t) strip % materialCount == material && lo.x >= strip * 4 && hi.x <= strip * 4 + 4)
+            return true;
+    return false;
+}
+
+// Whether every level's ranges are back to back and cover it, and every
+// triangle in them lies in its material's strips.
+static bool checkMaterialRanges(const Mesh& mesh, int materialCount)
+{
+    for (size_t level = 0; level < mesh.lodCount(); level++)
+    {
+        const MeshLod& lod = mesh.lod(level);
+        uint32_t next = lod.indexOffset;
+        for (uint32_t r = lod.firstRange; r < lod.firstRange + lod.rangeCount; r++)
+        {
+            const MeshRange& range = mesh.range(r);
+            if (range.indexOffset != next || range.indexCount == 0)
+                return false;
+            next += range.indexCount;
+
+            for (uint32_t i = range.indexOffset; i < range.indexOffset + range.indexCount; i += 3)
+            {
+                glm::vec3 corners[3];
+                for (int k = 0; k < 3; k++)
+                    corners[k] = mesh.vertexData()[mesh.indexData()[i + k]].position;
+                if (!inMaterialStrip(corners, range.material, materialCount))
+                    return false;
+            }
+        }
+        if (next != lod.indexOffset + lod.indexCount)
+            return false;
+    }
+    return true;
+}
+
+// Material library parsing, grouping faces into one range per material in
+// every level of detail, the chunked parser's material runs and the cache.
+static void benchmarkMaterials(int materialCount)
+{
+    const char* objPath = "bench_materials.obj";
+    const char* mtlPath = "bench_materials.mtl";
+    generateMaterialGrid(objPath, mtlPath, materialCount, 64);
+
+    MeshOptions options;
+    options.useCache = false;
+    options.optimize = true;
+    options.lodLevels = 2;
+    double start = now();
+    Mesh mesh(objPath, options);
+    double loadTime = now() - start;
+
+    bool materialsRead = mesh.materials.size() == (size_t) materialCount + 1 && mesh.materials.back().name.empty() &&
+                         mesh.materials[0].diffuseMap == "textures/strip texture.png";
+    for (int m = 0; materialsRead && m < materialCount; m++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "m%02d", m);
+        materialsRead = mesh.materials[m].name == name && fabs(mesh.materials[m].diffuse.x - (float) m / materialCount) < 1e-5f &&
+                        (m == 0 || mesh.materials[m].diffuseMap.empty());
+    }
+    bool grouped = mesh.lodCount() > 1 && mesh.lod(0).rangeCount == (uint32_t) materialCount + 1 && checkMaterialRanges(mesh, materialCount);
+
+    ObjData serial, chunked;
+    loadObj(objPath, LOAD_MAPPED, serial);
+    loadObj(objPath, LOAD_PARALLEL, chunked);
+    bool runsMatch = serial.materialNames == chunked.materialNames && serial.materialLibraries == chunked.materialLibraries &&
+                     serial.materialRuns.size() == chunked.materialRuns.size();
+    for (size_t i = 0; runsMatch && i < serial.materialRuns.size(); i++)
+        runsMatch = serial.materialRuns[i].firstCorner == chunked.materialRuns[i].firstCorner &&
+                    serial.materialRuns[i].material == chunked.materialRuns[i].material;
+
+    options.useCache = true;
+    string cache = string(objPath) + ".cache";
+    remove(cache.c_str());
+    Mesh written(objPath, options);
+    Mesh cached(objPath, options);
+    bool cacheMatches = cached.lodCount() == mesh.lodCount() && cached.materials.size() == mesh.materials.size() &&
+                        cached.indexCount() == mesh.indexCount() &&
+                        memcmp(cached.indexData(), mesh.indexData(), mesh.indexCount() * sizeof(unsigned int)) == 0;
+    for (size_t level = 0; cacheMatches && level < mesh.lodCount(); level++)
+        cacheMatches = cached.lod(level).firstRange == mesh.lod(level).firstRange && cached.lod(level).rangeCount == mesh.lod(level).rangeCount;
+    for (size_t m = 0; cacheMatches && m < mesh.materials.size(); m++)
+        cacheMatches = cached.materials[m].name == mesh.materials[m].name && cached.materials[m].diffuse == mesh.materials[m].diffuse;
+
+    size_t draws = 0;
+    for (size_t level = 0; level < mesh.lodCount(); level++)
+        draws += mesh.lod(level).rangeCount;
+    printf("%-32s %d materials, %zu runs -> %u ranges, %zu levels with %zu ranges in all, load %.2f ms  %s %s %s %s\n",
+           objPath, materialCount, serial.materialRuns.size(), mesh.lod(0).rangeCount, mesh.lodCount(), draws, loadTime * 1000.0,
+           materialsRead ? "read" : "MATERIALS WRONG", grouped ? "grouped" : "RANGES WRONG",
+           runsMatch ? "chunks match" : "CHUNKS DIFFER", cacheMatches ? "cached" : "CACHE DIFFERS");
+    string subject = to_string(materialCount) + " materials";
+    record("materials", subject, "load ms", loadTime * 1000.0);
+    record("materials", subject, "ranges", mesh.lod(0).rangeCount);
+    check("materials", subject, "read", materialsRead);
+    check("materials", subject, "grouped", grouped);
+    check("materials", subject, "chunks match", runsMatch);
+    check("materials", subject, "cached", cacheMatches);
+
+    remove(cache.c_str());
+    remove(objPath);
+    remove(mtlPath);
+}
+
+// A height field scan written row by row, each row's v, vt and vn lines and
+// then the faces joining it to the row before, as scanners export them.
+// Odd rows use negative indices, bands of rows change material, and now and
+// then a face reaches back to the very first vertex. Stops once the file
+// is megabytes long, returns the triangles written.
+static uint64_t generateScan(const char* path, uint64_t megabytes)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        cerr << "Cannot write " << path << endl;
+        exit(1);
+    }
+
+    const int width = 1000, row = width + 1;
+    uint64_t bytes = fprintf(file, "# generated scan\n"), triangles = 0;
+    for (int y = 0; bytes < megabytes << 20; y++)
+    {
+        for (int x = 0; x <= width; x++)
+        {
+            float z = 0.5f * sinf(x * 0.05f) * cosf(y * 0.07f);
+            glm::vec3 normal = glm::normalize(glm::vec3(-0.025f * cosf(x * 0.05f) * cosf(y * 0.07f),
+                                                        0.035f * sinf(x * 0.05f) * sinf(y * 0.07f), 1.0f));
+            bytes += fprintf(file, "v %d %d %.5f\nvt %.5f %.5f\nvn %.5f %.5f %.5f\n", x, y, z,
+                             (float) x / width, (float)(y % 1000) / 1000.0f, normal.x, normal.y, normal.z);
+        }
+        if (y % 64 == 0)
+            bytes += fprintf(file, "usemtl band%d\n", (y / 64) % 4);
+        if (y == 0)
+            continue;
+
+        // Corners as written in the file: absolute, or counted back from the last vertex.
+        long long above = (long long)(y - 1) * row + 1, here = (long long) y * row + 1, last = here + width;
+        auto corner = [&](long long index) { return y % 2 ? index - last - 1 : index; };
+        for (int x = 0; x < width; x++)
+        {
+            long long a = corner(above + x), b = corner(above + x + 1), c = corner(here + x), d = corner(here + x + 1);
+            bytes += fprintf(file, "f %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld\nf %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld\n",
+                             a, a, a, c, c, c, b, b, b, b, b, b, c, c, c, d, d, d);
+            triangles += 2;
+        }
+        if (y % 16 == 0)
+        {
+            bytes += fprintf(file, "f 1/1/1 %lld/%lld/%lld %lld/%lld/%lld\n", here, here, here, here + 1, here + 1, here + 1);
+            triangles++;
+        }
+    }
+    fclose(file);
+    return triangles;
+}
+
+// Checks streamed chunks as they arrive: corner by corner against a whole
+// loadObj() of the file if one is given, and always for being well formed.
+class CheckingMeshSink : public MeshSink
+{
+public:
+    CheckingMeshSink(const ObjData* reference) : reference(reference), corner(0), vertices(0), indices(0), valid(true), matches(true) {}
+
+    virtual bool write(const MeshChunk& chunk)
+    {
+        valid = valid && chunk.firstVertex == vertices && chunk.firstIndex == indices && chunk.indexCount % 3 == 0;
+        size_t covered = 0;
+        for (size_t r = 0; r < chunk.rangeCount; r++)
+        {
+            valid = valid && chunk.ranges[r].indexOffset == covered;
+            covered += chunk.ranges[r].indexCount;
+        }
+        valid = valid && covered == chunk.indexCount;
+
+        for (size_t i = 0; i < chunk.indexCount; i++)
+        {
+            if (chunk.indices[i] >= chunk.vertexCount)
+            {
+                valid = false;
+                break;
+            }
+            if (!reference)
+                continue;
+            const Vertex& vertex = chunk.vertices[chunk.indices[i]];
+            matches = matches && corner < reference->vertexIndices.size() &&
+                      vertex.position == reference->temp_vertices[reference->vertexIndices[corner]] &&
+                      vertex.texCoord == reference->temp_uvs[reference->uvIndices[corner]] &&
+                      vertex.normal == reference->temp_normals[reference->normalIndices[corner]];
+            corner++;
+        }
+        vertices += chunk.vertexCount;
+        indices += chunk.indexCount;
+        return true;
+    }
+
+    virtual bool finish(const vector<string>& materialNames)
+    {
+        names = materialNames;
+        matches = matches && (!reference || (corner == reference->vertexIndices.size() && names == reference->materialNames));
+        return true;
+    }
+
+    const ObjData* reference;
+    size_t corner;
+    uint64_t vertices, indices;
+    bool valid, matches;
+    vector<string> names;
+};
+
+// Streams a scan many times larger than the memory budget to a file and
+// checks the heap never held more than the budget, then replays the file.
+// A smaller scan with a tighter budget, so that faces reach back past the
+// kept attributes, is compared with loading it whole. Pass --stream-mb
+// with a few thousand to run the ceiling on a multi-gigabyte file.
+static void benchmarkStreaming(uint64_t megabytes, size_t budget)
+{
+    const char* smallPath = "bench_scan_small.obj";
+    const char* scanPath = "bench_scan.obj";
+    const char* streamPath = "bench_scan.obj.stream";
+
+    generateScan(smallPath, 8);
+    bool matches, valid;
+    uint64_t smallMisses;
+    {
+        ObjData reference;
+        loadObj(smallPath, LOAD_MAPPED, reference);
+        CheckingMeshSink sink(&reference);
+        MeshStreamStats stats;
+        bool streamed = streamMesh(smallPath, sink, 2 << 20, stats);
+        matches = streamed && sink.matches;
+        valid = streamed && sink.valid;
+        smallMisses = stats.attributeMisses;
+    }
+    remove(smallPath);
+
+    uint64_t triangles = generateScan(scanPath, megabytes);
+    MeshStreamStats stats;
+    bool streamed;
+    size_t before = liveBytes;
+    peakLiveBytes = before;
+    double start = now();
+    {
+        FileMeshSink sink(streamPath);
+        streamed = sink.isOpen() && streamMesh(scanPath, sink, budget, stats);
+    }
+    double streamTime = now() - start;
+    size_t peak = peakLiveBytes - before;
+
+    uint64_t vertexTotal = 0, indexTotal = 0;
+    CheckingMeshSink replayed(NULL);
+    bool replays = streamed && readMeshStreamTotals(streamPath, vertexTotal, indexTotal) && replayMeshStream(streamPath, replayed) &&
+                   replayed.valid && replayed.vertices == vertexTotal && replayed.indices == indexTotal &&
+                   indexTotal == triangles * 3 && replayed.names.size() == 4;
+    valid = valid && streamed && stats.indices == triangles * 3;
+
+    double fileMB = stats.bytes / (1024.0 * 1024.0);
+    printf("Streaming %7.1f MB in %llu chunks  %6.1f MB/s  peak heap %6.2f MB of %zu MB  %llu attributes read back  %s %s %s %s\n",
+           fileMB, (unsigned long long) stats.chunks, fileMB / streamTime, peak / (1024.0 * 1024.0), budget >> 20,
+           (unsigned long long) smallMisses, peak <= budget ? "bounded" : "OVER BUDGET", matches ? "matches" : "DIFFERS",
+           valid ? "valid" : "INVALID", replays ? "replays" : "REPLAY FAILED");
+    string subject = to_string(megabytes) + " MB scan";
+    record("streaming", subject, "MB/s", fileMB / streamTime);
+    record("streaming", subject, "peak heap MB", peak / (1024.0 * 1024.0));
+    check("streaming", subject, "within budget", peak <= budget);
+    check("streaming", subject, "matches whole load", matches);
+    check("streaming", subject, "valid chunks", valid);
+    check("streaming", subject, "replays", replays);
+    check("streaming", subject, "reads spilled attributes", smallMisses > 0);
+
+    remove(scanPath);
+    remove(streamPath);
+}
+
+// Heap traffic of repeated loads parsing into the heap against the thread's
+// arena. The first load of each warms up, the arena keeps its block after
+// as this thread opts in the way pool workers do.
+static void benchmarkArena(const char* path, int loads)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+    Arena& arena = Arena::forThisThread();
+    arena.keepBytes = 64 << 20;
+    double time[2] = { 0.0, 0.0 };
+    size_t allocations[2] = { 0, 0 }, bytes[2] = { 0, 0 };
+    size_t blocks = 0;
+    bool identical = true;
+
+    options.useArena = false;
+    Mesh reference(path, options);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        options.useArena = pass == 1;
+        Mesh warmup(path, options);
+        blocks = arena.blockAllocations;
+        for (int i = 0; i < loads; i++)
+        {
+            size_t count = allocationCount, size = allocationBytes;
+            double start = now();
+            Mesh mesh(path, options);
+            time[pass] += now() - start;
+            allocations[pass] += allocationCount - count;
+            bytes[pass] += allocationBytes - size;
+            identical = identical && mesh.vertices.size() == reference.vertices.size() &&
+                memcmp(mesh.vertices.data(), reference.vertices.data(), mesh.vertices.size() * sizeof(Vertex)) == 0 &&
+                mesh.indices == reference.indices;
+        }
+    }
+    blocks = arena.blockAllocations - blocks;
+
+    printf("%-32s per load heap %6zu allocs %8.2f MB %7.2f ms  arena %6zu allocs %8.2f MB %7.2f ms  kept %.2f MB  %s\n",
+           path, allocations[0] / loads, bytes[0] / (double) loads / (1024.0 * 1024.0), time[0] * 1000.0 / loads,
+           allocations[1] / loads, bytes[1] / (double) loads / (1024.0 * 1024.0), time[1] * 1000.0 / loads,
+           arena.capacity() / (1024.0 * 1024.0), identical ? "identical" : "DIFFERENT");
+    record("arena", path, "heap allocations per load", allocations[0] / (double) loads);
+    record("arena", path, "arena allocations per load", allocations[1] / (double) loads);
+    record("arena", path, "heap MB per load", bytes[0] / (double) loads / (1024.0 * 1024.0));
+    record("arena", path, "arena MB per load", bytes[1] / (double) loads / (1024.0 * 1024.0));
+    record("arena", path, "heap ms", time[0] * 1000.0 / loads);
+    record("arena", path, "arena ms", time[1] * 1000.0 / loads);
+    check("arena", path, "identical", identical);
+    check("arena", path, "fewer allocations", allocations[1] < allocations[0]);
+    check("arena", path, "fewer bytes", bytes[1] <= bytes[0]);
+    // Loads too large for the arena to keep hand it back and start over each time.
+    if (arena.capacity() > 0)
+        check("arena", path, "no new blocks once warm", blocks == 0);
+
+    // A copy may outlive the load, so it must not be in the arena.
+    ArenaVector<unsigned int> temporary(4, 0u, ArenaAllocator<unsigned int>(&arena));
+    ArenaVector<unsigned int> copy(temporary);
+    check("arena", path, "copies on the heap", copy.get_allocator().arena == NULL);
+
+    arena.keepBytes = 0;
+    arena.release();
+}
+
+// Wavy heightfield of resolution squared quads, uvs running along it.
+static void generateWaves(int resolution, vector<Vertex>& vertices, vector<unsigned int>& indices)
+{
+    int side = resolution + 1;
+    vertices.resize((size_t) side * side);
+    for (int y = 0; y < side; y++)
+        for (int x = 0; x < side; x++)
+        {
+            Vertex& vertex = vertices[(size_t) y * side + x];
+            float u = (float) x / resolution, v = (float) y / resolution;
+            vertex.position = glm::vec3(u * 100.0f, sinf(u * 40.0f) * cosf(v * 30.0f) * 3.0f, v * 100.0f);
+            vertex.normal = glm::vec3(0.0f);
+            vertex.texCoord = glm::vec2(u * 8.0f, v * 8.0f);
+        }
+
+    indices.clear();
+    indices.reserve((size_t) resolution * resolution * 6);
+    for (int y = 0; y < resolution; y++)
+        for (int x = 0; x < resolution; x++)
+        {
+            unsigned int corner = y * side + x;
+            unsigned int quad[6] = { corner, corner + side, corner + 1, corner + 1, corner + side, corner + side + 1 };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+}
+
+// Largest distance between matching vectors of two arrays once made unit
+// length, about the angle between them in radians for small ones.
+static float maxAngle(const glm::vec3* a, size_t aStride, const glm::vec3* b, size_t bStride, size_t count)
+{
+    float worst = 0.0f;
+    for (size_t i = 0; i < count; i++)
+    {
+        const glm::vec3& x = *(const glm::vec3*)((const char*) a + i * aStride);
+        const glm::vec3& y = *(const glm::vec3*)((const char*) b + i * bStride);
+        worst = max(worst, glm::length(x / glm::length(x) - y / glm::length(y)));
+    }
+    return worst;
+}
+
+// Normals and tangents of a multi-million triangle mesh: the scalar reference
+// against the batched pass on one thread and on the pool. Both have to agree
+// with the reference to within a thousandth of a radian.
+static void benchmarkTangents(int resolution)
+{
+    vector<Vertex> reference, batched;
+    vector<unsigned int> indices;
+    generateWaves(resolution, reference, indices);
+    batched = reference;
+    size_t triangles = indices.size() / 3;
+    string subject = to_string(triangles) + " triangles";
+
+    const char* names[] = { "area", "angle" };
+    NormalWeighting weightings[] = { NORMALS_AREA, NORMALS_ANGLE };
+    for (int w = 0; w < 2; w++)
+    {
+        double start = now();
+        computeNormalsScalar(reference.data(), reference.size(), indices.data(), indices.size(), weightings[w]);
+        double scalarTime = now() - start;
+        start = now();
+        computeNormals(batched.data(), batched.size(), indices.data(), indices.size(), weightings[w]);
+        double serialTime = now() - start;
+        start = now();
+        computeNormals(batched.data(), batched.size(), indices.data(), indices.size(), weightings[w], &ThreadPool::shared());
+        double parallelTime = now() - start;
+        float error = maxAngle(&reference[0].normal, sizeof(Vertex), &batched[0].normal, sizeof(Vertex), reference.size());
+
+        printf("%-32s %s normals scalar %7.1f ms  %s %7.1f ms  %u threads %7.1f ms  x%5.1f  max error %.2e rad\n",
+               subject.c_str(), names[w], scalarTime * 1000.0, tangentInstructionSet(), serialTime * 1000.0,
+               ThreadPool::shared().size(), parallelTime * 1000.0, scalarTime / parallelTime, error);
+        string metric = string(names[w]) + " normals";
+        record("tangents", subject, (metric + " scalar ms").c_str(), scalarTime * 1000.0);
+        record("tangents", subject, (metric + " ms").c_str(), parallelTime * 1000.0);
+        record("tangents", subject, (metric + " Mtriangles/s").c_str(), triangles / parallelTime / 1e6);
+        check("tangents", subject, (metric + " match scalar").c_str(), error < 1e-3f);
+    }
+
+    // Both from the same angle weighted normals, so only the tangents differ.
+    vector<glm::vec4> referenceTangents(reference.size()), batchedTangents(reference.size());
+    double start = now();
+    computeTangentsScalar(reference.data(), reference.size(), indices.data(), indices.size(), referenceTangents.data());
+    double scalarTime = now() - start;
+    start = now();
+    computeTangents(reference.data(), reference.size(), indices.data(), indices.size(), batchedTangents.data());
+    double serialTime = now() - start;
+    start = now();
+    computeTangents(reference.data(), reference.size(), indices.data(), indices.size(), batchedTangents.data(), &ThreadPool::shared());
+    double parallelTime = now() - start;
+
+    float error = maxAngle((const glm::vec3*) &referenceTangents[0], sizeof(glm::vec4),
+                           (const glm::vec3*) &batchedTangents[0], sizeof(glm::vec4), reference.size());
+    size_t handedness = 0;
+    float orthogonal = 0.0f;
+    for (size_t i = 0; i < reference.size(); i++)
+    {
+        handedness += referenceTangents[i].w != batchedTangents[i].w;
+        orthogonal = max(orthogonal, fabsf(glm::dot(glm::vec3(batchedTangents[i]), reference[i].normal)));
+    }
+
+    printf("%-32s tangents scalar %7.1f ms  %s %7.1f ms  %u threads %7.1f ms  x%5.1f  max error %.2e rad\n",
+           subject.c_str(), scalarTime * 1000.0, tangentInstructionSet(), serialTime * 1000.0,
+           ThreadPool::shared().size(), parallelTime * 1000.0, scalarTime / parallelTime, error);
+    record("tangents", subject, "tangents scalar ms", scalarTime * 1000.0);
+    record("tangents", subject, "tangents ms", parallelTime * 1000.0);
+    record("tangents", subject, "tangents Mtriangles/s", triangles / parallelTime / 1e6);
+    check("tangents", subject, "tangents match scalar", error < 1e-3f && handedness == 0);
+    check("tangents", subject, "tangents across normals", orthogonal < 1e-3f);
+}
+
+// Mesh with smoothed normals and tangents, checked against the reference on
+// its own vertices, and the cache telling smoothed normals from the file's.
+static void benchmarkMeshTangents(const char* path)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+    Mesh original(path, options);
+    options.smoothNormals = true;
+    options.generateTangents = true;
+    Mesh smoothed(path, options);
+
+    vector<Vertex> reference(smoothed.vertexData(), smoothed.vertexData() + smoothed.vertexCount());
+    computeNormalsScalar(reference.data(), reference.size(), smoothed.indexData(), smoothed.lod(0).indexCount, NORMALS_ANGLE);
+    vector<glm::vec4> tangents(reference.size());
+    computeTangentsScalar(reference.data(), reference.size(), smoothed.indexData(), smoothed.lod(0).indexCount, tangents.data());
+
+    float normalError = maxAngle(&reference[0].normal, sizeof(Vertex), &smoothed.vertexData()[0].normal, sizeof(Vertex), reference.size());
+    float tangentError = maxAngle((const glm::vec3*) &tangents[0], sizeof(glm::vec4),
+                                  (const glm::vec3*) &smoothed.tangents[0], sizeof(glm::vec4), reference.size());
+    printf("%-32s smoothed normals max error %.2e rad  tangents %.2e rad\n", path, normalError, tangentError);
+    check("tangents", path, "mesh normals match scalar", normalError < 1e-3f);
+    check("tangents", path, "mesh tangents match scalar", smoothed.tangents.size() == smoothed.vertexCount() && tangentError < 1e-3f);
+
+    // The cache written with smoothed normals is not one for the file's normals.
+    string cache = string(path) + ".cache";
+    remove(cache.c_str());
+    options.useCache = true;
+    Mesh written(path, options);
+    options.smoothNormals = false;
+    Mesh reread(path, options);
+    bool fileNormals = reread.vertexCount() == original.vertexCount() &&
+        memcmp(reread.vertexData(), original.vertexData(), original.vertexCount() * sizeof(Vertex)) == 0;
+    check("tangents", path, "cache keeps file normals apart", fileNormals);
+    remove(cache.c_str());
+}
+
+// Parsing against mapping the binary cache written by the first load.
+static void benchmarkCache(const char* path)
+{
+    string cache = string(path) + ".cache";
+    remove(cache.c_str());
+
+    double start = now();
+    Mesh parsed(path);
+    double parseTime = now() - start;
+
+    start = now();
+    Mesh cached(path);
+    double cacheTime = now() - start;
+
+    bool identical = parsed.vertexCount() == cached.vertexCount() && parsed.indexCount() == cached.indexCount() &&
+        memcmp(parsed.vertexData(), cached.vertexData(), parsed.vertexCount() * sizeof(Vertex)) == 0 &&
+        memcmp(parsed.indexData(), cached.indexData(), parsed.indexCount() * sizeof(unsigned int)) == 0;
+
+    printf("%-32s parse+write %8.2f ms  cache load %8.3f ms  %s\n",
+           path, parseTime * 1000.0, cacheTime * 1000.0, identical ? "identical" : "DIFFERENT");
+    record("cache", path, "parse+write ms", parseTime * 1000.0);
+    record("cache", path, "cache load ms", cacheTime * 1000.0);
+    check("cache", path, "identical", identical);
+
+    // Touching the .obj keeps the cache, only the time in its header changes.
+    string before = fileBytes(cache.c_str());
+    struct stat info;
+    stat(path, &info);
+    utimbuf times;
+    times.actime = info.st_atime;
+    times.modtime = info.st_mtime + 100;
+    utime(path, &times);
+    Mesh touched(path);
+    string after = fileBytes(cache.c_str());
+    size_t changed = 0;
+    for (size_t i = 0; i < before.size() && i < after.size(); i++)
+        changed += before[i] != after[i];
+    check("cache", path, "new time stored", before.size() == after.size() && changed > 0 && changed <= 8);
+
+    // An index past the vertices gets the cache rejected and the file parsed again.
+    size_t offset = after.find(string((const char*) parsed.indexData(), 256));
+    if (offset != string::npos)
+    {
+        memset(&after[offset], 0xff, sizeof(uint32_t));
+        FILE* file = fopen(cache.c_str(), "wb");
+        fwrite(after.data(), 1, after.size(), file);
+        fclose(file);
+    }
+    Mesh reparsed(path);
+    check("cache", path, "bad index rejected", offset != string::npos && reparsed.indexCount() == parsed.indexCount() &&
+          memcmp(reparsed.indexData(), parsed.indexData(), parsed.indexCount() * sizeof(unsigned int)) == 0);
+    remove(cache.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    // Grid resolution of the synthetic model, 1000 gives roughly 180MB.
+    int resolution = 1000;
+    // Size of the scan streamed with a 16MB budget.
+    uint64_t streamMegabytes = 128;
+    const char* jsonPath = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (strcmp(argv[i], "--stream-mb") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            streamMegabytes = atoi(argv[++i]);
+        else if (atoi(argv[i]) > 0)
+            resolution = atoi(argv[i]);
+        else
+        {
+            cerr << "Usage: " << argv[0] << " [grid resolution] [--stream-mb MB] [--json results.json]" << endl;
+            return 1;
+        }
+    }
+    const char* largePath = "bench_large.obj";
+
+    generateGrid(largePath, resolution);
+
+    benchmarkParse("assets/models/teapot.obj");
+    benchmarkParse("assets/models/cube.obj");
+    benchmarkParse(largePath);
+    benchmarkObjForms();
+    benchmarkMesh("assets/models/teapot.obj");
+    benchmarkMesh(largePath);
+    benchmarkCache(largePath);
+    benchmarkArena("assets/models/teapot.obj", 16);
+    benchmarkArena(largePath, 2);
+    benchmarkOptimize("assets/models/teapot.obj");
+    benchmarkOptimize(largePath);
+    benchmarkQuantize("assets/models/teapot.obj");
+    benchmarkQuantize(largePath);
+    benchmarkAsync("assets/models/teapot.obj", 64);
+    benchmarkMeshMoves("assets/models/teapot.obj", 64);
+    benchmarkTexture(2048);
+    benchmarkDecode("assets/textures/tiles.jpg");
+    benchmarkDecode("assets/textures/Intergalactic Spaceship_color_4.jpg");
+    benchmarkRenderQueue(10000, 64);
+    benchmarkRenderQueue(100000, 256);
+    benchmarkCulling(100000);
+    benchmarkSceneBVH(10000);
+    benchmarkSceneBVH(100000);
+    benchmarkSceneBVH(1000000);
+    benchmarkTriangleBVH("assets/models/teapot.obj", 1000000);
+    benchmarkTriangleBVH(largePath, 1000000);
+    benchmarkLods("assets/models/teapot.obj", 4);
+    benchmarkLods(largePath, 4);
+    benchmarkMaterials(40);
+    benchmarkStreaming(streamMegabytes, 16 << 20);
+    benchmarkTangents(1200);
+    benchmarkMeshTangents("assets/models/teapot.obj");
+    benchmarkProfiler(1000000);
+
+    remove(largePath);
+
+    if (jsonPath && !writeResults(jsonPath, resolution))
+    {
+        cerr << "Could not write " << jsonPath << endl;
+        return 1;
+    }
+    if (failedChecks)
+        cerr << failedChecks << " checks failed" << endl;
+    return failedChecks ? 1 : 0;
+}
@@ -0,0 +1,86 @@
+#include "../Application.hpp"
+
+using namespace std;
+
+// Pre-bakes the binary mesh caches for a list of .obj files, so the asset
+// pipeline can ship them and the app never parses text on startup.
+// With --stream MB a model is instead read in windows holding about MB
+// megabytes at most and written as chunks to "<name>.obj.stream", for scans
+// too large to load whole. Those skip --optimize, --lods and --smooth-normals.
+// Usage: objconvert [--parallel] [--optimize] [--lods N] [--smooth-normals] [--stream MB] model.obj [model.obj ...]
+
+int main(int argc, char** argv)
+{
+    MeshOptions options(LOAD_MAPPED);
+    options.useCache = false;
+
+    size_t streamBudget = 0;
+    int failures = 0, converted = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--parallel") == 0)
+        {
+            options.mode = LOAD_PARALLEL;
+            continue;
+        }
+        if (strcmp(argv[i], "--optimize") == 0)
+        {
+            options.optimize = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--lods") == 0 && i + 1 < argc)
+        {
+            options.lodLevels = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--smooth-normals") == 0)
+        {
+            options.smoothNormals = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+        {
+            streamBudget = (size_t) atoi(argv[++i]) << 20;
+            continue;
+        }
+
+        if (streamBudget)
+        {
+            string path = string(argv[i]) + ".stream";
+            FileMeshSink sink(path.c_str());
+            MeshStreamStats stats;
+            if (sink.isOpen() && streamMesh(argv[i], sink, streamBudget, stats))
+            {
+                cout << argv[i] << ": " << stats.indices << " corners -> " << stats.vertices << " vertices in "
+                     << stats.chunks << " chunks, " << stats.attributeMisses << " attributes read back" << endl;
+                converted++;
+            }
+            else
+            {
+                cerr << "Could not write " << path << endl;
+                remove(path.c_str());
+                failures++;
+            }
+            continue;
+        }
+
+        Mesh mesh(argv[i], options);
+        if (mesh.writeCache(argv[i]))
+        {
+            mesh.printStats(argv[i]);
+            converted++;
+        }
+        else
+        {
+            cerr << "Could not write mesh cache for " << argv[i] << endl;
+            failures++;
+        }
+    }
+
+    if (converted + failures == 0)
+    {
+        cerr << "Usage: " << argv[0] << " [--parallel] [--optimize] [--lods N] [--smooth-normals] [--stream MB] model.obj [model.obj ...]" << endl;
+        return 1;
+    }
+    return failures ? 1 : 0;
+}
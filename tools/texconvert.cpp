@@ -0,0 +1,70 @@
+#include "../Application.hpp"
+
+using namespace std;
+
+// Compresses textures to BC1 with a full mip chain in a .ktx2 file next to
+// the source image, which the app then uploads without decoding anything.
+// Prints the PSNR of every level against the uncompressed mip.
+// Usage: texconvert image.jpg [image.jpg ...]
+
+static bool convert(const char* path)
+{
+    // loadImage gives rows bottom up, the order the runtime uploads them in.
+    Image image;
+    if (!loadImage(path, image))
+    {
+        cerr << "Could not load " << path << endl;
+        return false;
+    }
+
+    int width = image.width, height = image.height;
+    vector<unsigned char> level(image.data, image.data + (size_t) width * height * 3), next, decoded;
+    vector<vector<unsigned char> > levels;
+
+    cout << path << ": " << width << "x" << height << endl;
+    while (1)
+    {
+        levels.push_back(vector<unsigned char>());
+        encodeBC1(level.data(), width, height, levels.back());
+        decodeBC1(levels.back().data(), width, height, decoded);
+        printf("  level %2d %5dx%-5d %8zu bytes  PSNR %.2f dB\n", (int) levels.size() - 1, width, height,
+               levels.back().size(), psnr(level.data(), decoded.data(), level.size()));
+
+        if (width == 1 && height == 1)
+            break;
+        halveImage(level.data(), width, height, next);
+        level.swap(next);
+        width = max(1, width / 2);
+        height = max(1, height / 2);
+    }
+
+    string output = string(path).substr(0, string(path).find_last_of('.')) + ".ktx2";
+    if (!writeKtx2(output.c_str(), image.width, image.height, levels))
+    {
+        cerr << "Could not write " << output << endl;
+        return false;
+    }
+
+    size_t compressed = 0;
+    for (size_t i = 0; i < levels.size(); i++)
+        compressed += levels[i].size();
+    // Runtime GL_RGB upload plus generated mips take about 4/3 of the base level.
+    size_t uncompressed = (size_t) image.width * image.height * 3 * 4 / 3;
+    cout << "  wrote " << output << ", " << compressed / 1024 << " KB vs " << uncompressed / 1024 << " KB uncompressed" << endl;
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        cerr << "Usage: " << argv[0] << " image.jpg [image.jpg ...]" << endl;
+        return 1;
+    }
+
+    int failures = 0;
+    for (int i = 1; i < argc; i++)
+        if (!convert(argv[i]))
+            failures++;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+#include "Application.hpp"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define TRIANGLE_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+static const uint32_t packSize = 4;
+static const int stackSize = 128;
+
+// Möller-Trumbore on one triangle. The SSE version below does the same
+// operations in the same order, so both find the same distances.
+// --------------------------------------------------------------------
+static inline bool intersectTriangle(const Ray& ray, const glm::vec3& corner, const glm::vec3& edge1, const glm::vec3& edge2,
+                                     float& distance, float& u, float& v)
+{
+    glm::vec3 p(ray.direction.y * edge2.z - ray.direction.z * edge2.y,
+                ray.direction.z * edge2.x - ray.direction.x * edge2.z,
+                ray.direction.x * edge2.y - ray.direction.y * edge2.x);
+    float determinant = edge1.x * p.x + edge1.y * p.y + edge1.z * p.z;
+    if (determinant == 0.0f)
+        return false;
+    float inverse = 1.0f / determinant;
+
+    glm::vec3 t = ray.origin - corner;
+    u = (t.x * p.x + t.y * p.y + t.z * p.z) * inverse;
+    glm::vec3 q(t.y * edge1.z - t.z * edge1.y,
+                t.z * edge1.x - t.x * edge1.z,
+                t.x * edge1.y - t.y * edge1.x);
+    v = (ray.direction.x * q.x + ray.direction.y * q.y + ray.direction.z * q.z) * inverse;
+    distance = (edge2.x * q.x + edge2.y * q.y + edge2.z * q.z) * inverse;
+    return u >= 0.0f && v >= 0.0f && u + v <= 1.0f && distance > 0.0f;
+}
+
+// Builds the tree over triangle bounds and lays the leaves out as packs.
+// ----------------------------------------------------------------------
+void TriangleBVH::build(const Vertex* vertices, const unsigned int* indices, size_t indexCount)
+{
+    size_t triangleCount = indexCount / 3;
+    vector<AABB> bounds(triangleCount);
+    texCoords.resize(triangleCount * 3);
+    for (size_t i = 0; i < triangleCount; i++)
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            const Vertex& vertex = vertices[indices[i * 3 + k]];
+            bounds[i].min = k ? glm::min(bounds[i].min, vertex.position) : vertex.position;
+            bounds[i].max = k ? glm::max(bounds[i].max, vertex.position) : vertex.position;
+            texCoords[i * 3 + k] = vertex.texCoord;
+        }
+    }
+
+    vector<uint32_t> order;
+    buildBVH(bounds, packSize, packSize, nodes, order);
+
+    packs.clear();
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        BVHNode& node = nodes[n];
+        if (!node.count)
+            continue;
+
+        TrianglePack pack;
+        memset(&pack, 0, sizeof(pack));
+        for (uint32_t lane = 0; lane < node.count; lane++)
+        {
+            uint32_t triangle = order[node.first + lane];
+            glm::vec3 p0 = vertices[indices[triangle * 3]].position;
+            glm::vec3 p1 = vertices[indices[triangle * 3 + 1]].position;
+            glm::vec3 p2 = vertices[indices[triangle * 3 + 2]].position;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                pack.corner[axis][lane] = p0[axis];
+                pack.edge1[axis][lane] = p1[axis] - p0[axis];
+                pack.edge2[axis][lane] = p2[axis] - p0[axis];
+            }
+            pack.triangle[lane] = triangle;
+        }
+        node.first = packs.size();
+        packs.push_back(pack);
+    }
+}
+
+// Tests the four triangles of a pack, keeping the nearest hit closer than hit.distance.
+// -------------------------------------------------------------------------------------
+void TriangleBVH::intersectPack(const TrianglePack& pack, const Ray& ray, TriangleHit& hit, bool& found) const
+{
+#ifdef TRIANGLE_SSE
+    __m128 dx = _mm_set1_ps(ray.direction.x), dy = _mm_set1_ps(ray.direction.y), dz = _mm_set1_ps(ray.direction.z);
+    __m128 e1x = _mm_loadu_ps(pack.edge1[0]), e1y = _mm_loadu_ps(pack.edge1[1]), e1z = _mm_loadu_ps(pack.edge1[2]);
+    __m128 e2x = _mm_loadu_ps(pack.edge2[0]), e2y = _mm_loadu_ps(pack.edge2[1]), e2z = _mm_loadu_ps(pack.edge2[2]);
+
+    __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+    __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+    __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+    __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+    __m128 zero = _mm_setzero_ps();
+    __m128 valid = _mm_cmpneq_ps(determinant, zero);
+    if (!_mm_movemask_ps(valid))
+        return;
+    __m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+    __m128 tx = _mm_sub_ps(_mm_set1_ps(ray.origin.x), _mm_loadu_ps(pack.corner[0]));
+    __m128 ty = _mm_sub_ps(_mm_set1_ps(ray.origin.y), _mm_loadu_ps(pack.corner[1]));
+    __m128 tz = _mm_sub_ps(_mm_set1_ps(ray.origin.z), _mm_loadu_ps(pack.corner[2]));
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverse);
+
+    __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+    __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+    __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverse);
+    __m128 distance = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse);
+
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+    valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+    valid = _mm_and_ps(valid, _mm_cmpgt_ps(distance, zero));
+    valid = _mm_and_ps(valid, _mm_cmple_ps(distance, _mm_set1_ps(hit.distance)));
+    int mask = _mm_movemask_ps(valid);
+    if (!mask)
+        return;
+
+    float distances[4], us[4], vs[4];
+    _mm_storeu_ps(distances, distance);
+    _mm_storeu_ps(us, u);
+    _mm_storeu_ps(vs, v);
+    for (int lane = 0; lane < 4; lane++)
+    {
+        if (!(mask & (1 << lane)) || distances[lane] > hit.distance)
+            continue;
+        hit.distance = distances[lane];
+        hit.triangle = pack.triangle[lane];
+        hit.u = us[lane];
+        hit.v = vs[lane];
+        found = true;
+    }
+#else
+    for (int lane = 0; lane < 4; lane++)
+    {
+        glm::vec3 corner(pack.corner[0][lane], pack.corner[1][lane], pack.corner[2][lane]);
+        glm::vec3 edge1(pack.edge1[0][lane], pack.edge1[1][lane], pack.edge1[2][lane]);
+        glm::vec3 edge2(pack.edge2[0][lane], pack.edge2[1][lane], pack.edge2[2][lane]);
+        float distance, u, v;
+        if (intersectTriangle(ray, corner, edge1, edge2, distance, u, v) && distance <= hit.distance)
+        {
+            hit.distance = distance;
+            hit.triangle = pack.triangle[lane];
+            hit.u = u;
+            hit.v = v;
+            found = true;
+        }
+    }
+#endif
+}
+
+// Nearest triangle along the ray within maxDistance, visiting near children first.
+// --------------------------------------------------------------------------------
+bool TriangleBVH::intersect(const Ray& ray, float maxDistance, TriangleHit& hit) const
+{
+    if (nodes.empty())
+        return false;
+
+    glm::vec3 inverseDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+    TriangleHit best;
+    best.distance = maxDistance;
+    bool found = false;
+
+    // Nodes are pushed with the distance the ray enters them, so ones
+    // beyond a hit found meanwhile are dropped without another box test.
+    struct Entry
+    {
+        uint32_t node;
+        float distance;
+    };
+    Entry stack[stackSize];
+    int top = 0;
+    float rootEntry;
+    if (!intersectRayAABB(ray, inverseDirection, nodes[0].bounds, best.distance, rootEntry))
+        return false;
+    stack[top].node = 0;
+    stack[top++].distance = rootEntry;
+
+    while (top)
+    {
+        Entry entry = stack[--top];
+        if (entry.distance > best.distance)
+            continue;
+
+        const BVHNode& node = nodes[entry.node];
+        if (node.count)
+        {
+            intersectPack(packs[node.first], ray, best, found);
+            continue;
+        }
+
+        float leftEntry, rightEntry;
+        bool leftHit = intersectRayAABB(ray, inverseDirection, nodes[node.first].bounds, best.distance, leftEntry);
+        bool rightHit = intersectRayAABB(ray, inverseDirection, nodes[node.first + 1].bounds, best.distance, rightEntry);
+        if (leftHit && rightHit)
+        {
+            // Far child goes on the stack first.
+            bool leftFirst = leftEntry <= rightEntry;
+            stack[top].node = leftFirst ? node.first + 1 : node.first;
+            stack[top++].distance = leftFirst ? rightEntry : leftEntry;
+            stack[top].node = leftFirst ? node.first : node.first + 1;
+            stack[top++].distance = leftFirst ? leftEntry : rightEntry;
+        }
+        else if (leftHit || rightHit)
+        {
+            stack[top].node = leftHit ? node.first : node.first + 1;
+            stack[top++].distance = leftHit ? leftEntry : rightEntry;
+        }
+    }
+
+    if (found)
+        hit = best;
+    return found;
+}
+
+size_t TriangleBVH::intersect(const vector<Ray>& rays, float maxDistance, vector<TriangleHit>& hits,
+                              vector<unsigned char>& hit, ThreadPool& pool) const
+{
+    hits.resize(rays.size());
+    hit.resize(rays.size());
+
+    // Batches large enough that queueing them costs little against the rays.
+    const size_t batch = 1024;
+    pool.parallelFor((rays.size() + batch - 1) / batch, [&](size_t b)
+    {
+        size_t end = min((b + 1) * batch, rays.size());
+        for (size_t i = b * batch; i < end; i++)
+            hit[i] = intersect(rays[i], maxDistance, hits[i]);
+    });
+
+    size_t count = 0;
+    for (size_t i = 0; i < hit.size(); i++)
+        count += hit[i];
+    return count;
+}
+
+bool TriangleBVH::intersectBruteForce(const Ray& ray, float maxDistance, TriangleHit& hit) const
+{
+    bool found = false;
+    hit.distance = maxDistance;
+    for (size_t p = 0; p < packs.size(); p++)
+    {
+        const TrianglePack& pack = packs[p];
+        for (int lane = 0; lane < 4; lane++)
+        {
+            glm::vec3 corner(pack.corner[0][lane], pack.corner[1][lane], pack.corner[2][lane]);
+            glm::vec3 edge1(pack.edge1[0][lane], pack.edge1[1][lane], pack.edge1[2][lane]);
+            glm::vec3 edge2(pack.edge2[0][lane], pack.edge2[1][lane], pack.edge2[2][lane]);
+            float distance, u, v;
+            if (intersectTriangle(ray, corner, edge1, edge2, distance, u, v) && distance <= hit.distance)
+            {
+                hit.distance = distance;
+                hit.triangle = pack.triangle[lane];
+                hit.u = u;
+                hit.v = v;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+// Texture coordinate at the hit point, interpolated with the barycentrics.
+glm::vec2 TriangleBVH::texCoord(const TriangleHit& hit) const
+{
+    const glm::vec2* corners = &texCoords[hit.triangle * 3];
+    return corners[0] * (1.0f - hit.u - hit.v) + corners[1] * hit.u + corners[2] * hit.v;
+}
@@ -0,0 +1,140 @@
+#include "Application.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+using namespace std;
+
+static inline int16_t toSnorm16(float value)
+{
+    return (int16_t) floorf(glm::clamp(value, -1.0f, 1.0f) * 32767.0f + 0.5f);
+}
+
+// Same rule GL uses for normalized signed integers.
+static inline float fromSnorm16(int16_t value)
+{
+    return max(value / 32767.0f, -1.0f);
+}
+
+static inline float signNotZero(float value)
+{
+    return value >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Maps a unit vector onto the [-1, 1] square by folding the octahedron's lower half.
+// ----------------------------------------------------------------------------------
+glm::vec2 encodeOctahedral(glm::vec3 n)
+{
+    n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f)
+        e = glm::vec2((1.0f - fabsf(n.y)) * signNotZero(n.x), (1.0f - fabsf(n.x)) * signNotZero(n.y));
+    return e;
+}
+
+// Mirrors decodeOctahedral in vert.glsl.
+glm::vec3 decodeOctahedral(glm::vec2 e)
+{
+    glm::vec3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+    if (n.z < 0.0f)
+    {
+        float x = n.x;
+        n.x = (1.0f - fabsf(n.y)) * signNotZero(x);
+        n.y = (1.0f - fabsf(x)) * signNotZero(n.y);
+    }
+    return glm::normalize(n);
+}
+
+// Signed normalized 10_10_10_2, matching GL_INT_2_10_10_10_REV.
+static uint32_t packNormal1010102(glm::vec3 n)
+{
+    uint32_t x = (uint32_t)(int) floorf(glm::clamp(n.x, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3ff;
+    uint32_t y = (uint32_t)(int) floorf(glm::clamp(n.y, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3ff;
+    uint32_t z = (uint32_t)(int) floorf(glm::clamp(n.z, -1.0f, 1.0f) * 511.0f + 0.5f) & 0x3ff;
+    return x | (y << 10) | (z << 20);
+}
+
+static glm::vec3 unpackNormal1010102(uint32_t packed)
+{
+    glm::vec3 n;
+    for (int i = 0; i < 3; i++)
+    {
+        // Sign extend the 10 bit field.
+        int value = (int)((packed >> (10 * i)) & 0x3ff);
+        if (value >= 512)
+            value -= 1024;
+        n[i] = max(value / 511.0f, -1.0f);
+    }
+    return n;
+}
+
+// Offset and scale mapping the mesh AABB onto [-1, 1], used to quantize positions.
+void positionTransform(const AABB& bounds, glm::vec3& offset, glm::vec3& scale)
+{
+    offset = (bounds.min + bounds.max) * 0.5f;
+    scale = (bounds.max - bounds.min) * 0.5f;
+    for (int i = 0; i < 3; i++)
+        if (scale[i] <= 0.0f)
+            scale[i] = 1.0f;
+}
+
+// Converts vertices into the compact layout uploaded for the quantized formats.
+// ------------------------------------------------------------------------------
+void packVertices(const Vertex* vertices, size_t count, const AABB& bounds, VertexFormat format, vector<PackedVertex>& out)
+{
+    glm::vec3 offset, scale;
+    positionTransform(bounds, offset, scale);
+
+    out.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const Vertex& vertex = vertices[i];
+        PackedVertex& packed = out[i];
+
+        glm::vec3 position = (vertex.position - offset) / scale;
+        packed.position[0] = toSnorm16(position.x);
+        packed.position[1] = toSnorm16(position.y);
+        packed.position[2] = toSnorm16(position.z);
+        packed.position[3] = 0;
+
+        float length = glm::length(vertex.normal);
+        glm::vec3 normal = length > 0.0f ? vertex.normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+        if (format == VERTEX_PACKED_OCTAHEDRAL)
+        {
+            glm::vec2 e = encodeOctahedral(normal);
+            uint16_t x = (uint16_t) toSnorm16(e.x), y = (uint16_t) toSnorm16(e.y);
+            packed.normal = (uint32_t) x | ((uint32_t) y << 16);
+        }
+        else
+        {
+            packed.normal = packNormal1010102(normal);
+        }
+
+        packed.texCoord[0] = glm::packHalf1x16(vertex.texCoord.x);
+        packed.texCoord[1] = glm::packHalf1x16(vertex.texCoord.y);
+    }
+}
+
+// Decodes a packed vertex the way the vertex shader does, for checking precision on the CPU.
+// ------------------------------------------------------------------------------------------
+Vertex unpackVertex(const PackedVertex& packed, const AABB& bounds, VertexFormat format)
+{
+    glm::vec3 offset, scale;
+    positionTransform(bounds, offset, scale);
+
+    Vertex vertex;
+    glm::vec3 position(fromSnorm16(packed.position[0]), fromSnorm16(packed.position[1]), fromSnorm16(packed.position[2]));
+    vertex.position = offset + position * scale;
+
+    if (format == VERTEX_PACKED_OCTAHEDRAL)
+    {
+        int16_t x = (int16_t)(packed.normal & 0xffff), y = (int16_t)(packed.normal >> 16);
+        vertex.normal = decodeOctahedral(glm::vec2(fromSnorm16(x), fromSnorm16(y)));
+    }
+    else
+    {
+        vertex.normal = glm::normalize(unpackNormal1010102(packed.normal));
+    }
+
+    vertex.texCoord = glm::vec2(glm::unpackHalf1x16(packed.texCoord[0]), glm::unpackHalf1x16(packed.texCoord[1]));
+    return vertex;
+}